@@ -0,0 +1,281 @@
+// Background Mining with Tickets
+// ============================================================================
+//
+// In async mode the CLI does not mine. Each event is queued for a miner
+// thread and the operator gets a ticket back at once; tickets are handed
+// out in order and the miner takes them in that order, so the chain sees
+// the events exactly as they were entered.
+//
+// The miner is then the chain's only writer. It holds `writer` while it
+// mines a block or seals a due batch, and anything else that writes
+// (save, load, settings) first lets the queue drain, then takes the same
+// mutex with background_pause. Reads only need the chain's read lock, so
+// they see the committed blocks while the next one is being mined.
+//
+// A ticket is committed once its event is in a linked block. With
+// batching that waits for the batch to seal; background_wait asks the
+// miner to seal it straight away instead of waiting for it to fill.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "background.h"
+#include "blockchain.h"
+#include "queue.h"
+
+typedef struct {
+    uint64_t ticket;      // 0 asks for the open batch to be sealed
+    InsurancePayload payload;
+} Job;
+
+typedef struct {
+    uint64_t ticket;
+    char reason[128];
+} Failure;
+
+static BoundedQueue jobs;
+static pthread_t miner;
+static int running = 0;
+
+// Everything below is guarded by state_lock; progress is broadcast
+// whenever the miner finishes a job
+static pthread_mutex_t state_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t progress = PTHREAD_COND_INITIALIZER;
+static uint64_t issued = 0;
+static uint64_t taken = 0;
+static uint64_t committed = 0;
+static uint32_t outstanding = 0;    // jobs pushed and not yet finished
+static uint32_t seal_failures = 0;
+static Failure *failures = NULL;
+static uint32_t failure_count = 0;
+
+static pthread_mutex_t writer = PTHREAD_MUTEX_INITIALIZER;
+
+// First line of a job's output, for the failure record
+static void first_line(const char *output, size_t size, char *line, size_t line_size) {
+    size_t length = 0;
+    while (output && length < size && output[length] != '\n') length++;
+    if (length >= line_size) length = line_size - 1;
+    if (length > 0) memcpy(line, output, length);
+    line[length] = '\0';
+}
+
+// The caller holds state_lock
+static void record_failure(uint64_t ticket, const char *output, size_t size) {
+    Failure *grown = (Failure*)realloc(failures, (failure_count + 1) * sizeof(Failure));
+    if (!grown) return;
+    failures = grown;
+    failures[failure_count].ticket = ticket;
+    first_line(output, size, failures[failure_count].reason, sizeof(failures[failure_count].reason));
+    if (failures[failure_count].reason[0] == '\0') {
+        snprintf(failures[failure_count].reason, sizeof(failures[failure_count].reason), "Could not mine the event");
+    }
+    failure_count++;
+}
+
+// Mine one queued event, or seal the open batch, with the engine's
+// messages captured instead of printed over the operator's prompt
+static void run_job(const Job *job) {
+    char *output = NULL;
+    size_t size = 0;
+    FILE *fp = open_memstream(&output, &size);
+    int ok = 1;
+
+    blockchain_set_output(fp);
+    if (job->ticket > 0) {
+        ok = blockchain_add_block(job->payload);
+    } else {
+        Block sealed;
+        int mined = blockchain_seal_batch(&sealed, 1);
+        if (mined > 0) blockchain_persist_block(sealed.block_id);
+        ok = mined >= 0;
+    }
+    blockchain_set_output(NULL);
+    if (fp) fclose(fp);
+
+    pthread_mutex_lock(&state_lock);
+    if (job->ticket > 0) {
+        taken = job->ticket;
+        // A failed event that is still pending is retried with its batch
+        if (!ok && blockchain_pending_events() == 0) record_failure(job->ticket, output, size);
+    } else if (!ok) {
+        seal_failures++;
+    }
+    pthread_mutex_unlock(&state_lock);
+    free(output);
+}
+
+// Once no batch is open, everything the miner has taken is committed
+static void update_committed() {
+    pthread_mutex_lock(&state_lock);
+    if (blockchain_pending_events() == 0) committed = taken;
+    pthread_cond_broadcast(&progress);
+    pthread_mutex_unlock(&state_lock);
+}
+
+// The only thread that mines while async mode is on. Like the daemon's
+// writer it wakes at least once a second to seal a partial batch on time
+static void* miner_thread(void *arg) {
+    FILE *quiet = fopen("/dev/null", "w");
+    void *item;
+    (void)arg;
+
+    for (;;) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += 1;
+
+        int popped = queue_pop_until(&jobs, &item, &deadline);
+        if (popped == 0) break;
+
+        pthread_mutex_lock(&writer);
+        blockchain_set_output(quiet);
+        blockchain_seal_if_due();
+        blockchain_set_output(NULL);
+        if (popped > 0) {
+            run_job((Job*)item);
+            free(item);
+        }
+        update_committed();
+        pthread_mutex_unlock(&writer);
+
+        if (popped > 0) {
+            pthread_mutex_lock(&state_lock);
+            outstanding--;
+            pthread_cond_broadcast(&progress);
+            pthread_mutex_unlock(&state_lock);
+        }
+    }
+    if (quiet) fclose(quiet);
+    return NULL;
+}
+
+// Counted as outstanding before the push, so a pause never misses it.
+// The caller must not hold state_lock: a full queue blocks the push
+static int push_job(uint64_t ticket, const InsurancePayload *payload) {
+    Job *job = (Job*)calloc(1, sizeof(Job));
+    if (!job) return 0;
+    job->ticket = ticket;
+    if (payload) job->payload = *payload;
+
+    pthread_mutex_lock(&state_lock);
+    outstanding++;
+    pthread_mutex_unlock(&state_lock);
+    if (!queue_push(&jobs, job)) {
+        pthread_mutex_lock(&state_lock);
+        outstanding--;
+        pthread_cond_broadcast(&progress);
+        pthread_mutex_unlock(&state_lock);
+        free(job);
+        return 0;
+    }
+    return 1;
+}
+
+// Start the miner thread. Returns 1 when it is running
+int background_start() {
+    if (running) return 1;
+    if (!queue_init(&jobs, BACKGROUND_QUEUE_DEPTH)) return 0;
+    if (pthread_create(&miner, NULL, miner_thread, NULL) != 0) {
+        queue_destroy(&jobs);
+        return 0;
+    }
+    running = 1;
+    return 1;
+}
+
+// Mine everything still queued, then stop the miner thread. Tickets keep
+// counting up, so a later start never reuses one
+void background_stop() {
+    if (!running) return;
+    queue_close(&jobs);
+    pthread_join(miner, NULL);
+    queue_destroy(&jobs);
+    running = 0;
+}
+
+int background_active() {
+    return running;
+}
+
+// Queue an event for the miner. Returns its ticket, 0 when the miner is
+// not running or memory ran out. Waits while the queue is full
+uint64_t background_submit(const InsurancePayload *payload) {
+    if (!running) return 0;
+
+    // Numbered under the lock but pushed outside it; only the CLI thread
+    // submits, so pushes stay in ticket order
+    pthread_mutex_lock(&state_lock);
+    uint64_t ticket = ++issued;
+    pthread_mutex_unlock(&state_lock);
+
+    if (!push_job(ticket, payload)) {
+        pthread_mutex_lock(&state_lock);
+        issued--;
+        pthread_mutex_unlock(&state_lock);
+        return 0;
+    }
+    return ticket;
+}
+
+// Block until the ticket's event is in a block. Returns 1 once it is, 0
+// when it failed (reason says why), -1 for a ticket never handed out
+int background_wait(uint64_t ticket, char *reason, size_t size) {
+    pthread_mutex_lock(&state_lock);
+    if (ticket == 0 || ticket > issued) {
+        pthread_mutex_unlock(&state_lock);
+        return -1;
+    }
+
+    int result = 1;
+    uint32_t failures_seen = seal_failures;
+    if (ticket > committed && running) {
+        // Don't wait for the batch to fill; the seal runs after the event
+        pthread_mutex_unlock(&state_lock);
+        push_job(0, NULL);
+        pthread_mutex_lock(&state_lock);
+    }
+    while (ticket > committed && running && seal_failures == failures_seen) {
+        pthread_cond_wait(&progress, &state_lock);
+    }
+    if (ticket > committed) {
+        snprintf(reason, size, "%s", seal_failures != failures_seen ? "Could not seal the batch; the event is still pending"
+                                                                    : "The miner stopped first");
+        result = 0;
+    }
+    for (uint32_t i = 0; result && i < failure_count; i++) {
+        if (failures[i].ticket == ticket) {
+            snprintf(reason, size, "%s", failures[i].reason);
+            result = 0;
+        }
+    }
+    pthread_mutex_unlock(&state_lock);
+    return result;
+}
+
+void background_status(BackgroundStatus *status) {
+    pthread_mutex_lock(&state_lock);
+    status->running = running;
+    status->issued = issued;
+    status->taken = taken;
+    status->committed = committed;
+    status->queued = (uint32_t)(issued - taken);
+    status->failed = failure_count;
+    pthread_mutex_unlock(&state_lock);
+}
+
+// Let every queued event be mined, then keep the miner off the chain
+// until background_resume, so another writer can take its place
+void background_pause() {
+    if (!running) return;
+    pthread_mutex_lock(&state_lock);
+    while (outstanding > 0) pthread_cond_wait(&progress, &state_lock);
+    pthread_mutex_unlock(&state_lock);
+    pthread_mutex_lock(&writer);
+}
+
+void background_resume() {
+    if (running) pthread_mutex_unlock(&writer);
+}
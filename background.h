@@ -0,0 +1,31 @@
+// Background Mining with Tickets
+// ============================================================================
+
+#ifndef BACKGROUND_H
+#define BACKGROUND_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "insurance_types.h"
+
+#define BACKGROUND_QUEUE_DEPTH 1024
+
+typedef struct {
+    int running;
+    uint64_t issued;      // last ticket handed out
+    uint64_t taken;       // last ticket the miner has worked on
+    uint64_t committed;   // every ticket up to here is in a block, or failed
+    uint32_t queued;      // events waiting for the miner
+    uint32_t failed;      // tickets whose event was dropped
+} BackgroundStatus;
+
+int background_start();
+void background_stop();
+int background_active();
+uint64_t background_submit(const InsurancePayload *payload);
+int background_wait(uint64_t ticket, char *reason, size_t size);
+void background_status(BackgroundStatus *status);
+void background_pause();
+void background_resume();
+
+#endif // BACKGROUND_H
@@ -0,0 +1,439 @@
+// Benchmark Suite for the Core Engine
+// ============================================================================
+//
+// Usage: bench_runner [-o results.jsonl] [blocks ...]
+//
+// Measures raw SHA-256 compression, block hashing, mining latency per
+// difficulty, block times under retargeting, and then, for each
+// synthetic chain size (default 1000, 100000 and 1000000 blocks),
+// building, verifying, viewing the tail of, querying, saving (plain and
+// compressed) and loading the chain, snapshotting its indexes and loading
+// it again from the snapshot, reading it in bounded-memory mode through
+// the block cache, and the memory its records take.
+// Every measurement is one JSON object per line, e.g.
+//
+//   {"bench":"verify","blocks":100000,"metric":"throughput","value":812345,"unit":"blocks/s"}
+//
+// so two runs can be diffed or compared with a script. Progress goes to
+// stderr.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "blockchain.h"
+#include "miner.h"
+#include "sha256.h"
+#include "sha256_mb.h"
+#include "storage.h"
+#include "snapshot.h"
+#include "metrics.h"
+
+#define BENCH_SECONDS 1.0          // per throughput loop
+#define MINE_SAMPLES 32
+#define MINE_BUDGET_SECONDS 10.0   // per difficulty; fewer samples beyond it
+#define MINE_MAX_DIFFICULTY 20
+#define RETARGET_GOAL_SECONDS 0.05
+#define RETARGET_BLOCKS 96         // the first half lets the controller settle
+#define CACHE_BLOCKS 4096          // block cache for the bounded-memory runs
+#define CACHE_READS 100000         // random block reads, mostly misses
+
+static FILE *results = NULL;
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// One result line; param_name may be NULL for unparameterized benches
+static void report(const char *bench, const char *param_name, uint64_t param,
+                   const char *metric, double value, const char *unit) {
+    fprintf(results, "{\"bench\":\"%s\"", bench);
+    if (param_name) fprintf(results, ",\"%s\":%llu", param_name, (unsigned long long)param);
+    fprintf(results, ",\"metric\":\"%s\",\"value\":%.6g,\"unit\":\"%s\"}\n", metric, value, unit);
+    fflush(results);
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted samples
+static double percentile(const double *sorted, uint32_t count, double q) {
+    return sorted[(uint32_t)((count - 1) * q + 0.5)];
+}
+
+static void bench_sha256() {
+    uint32_t state[8] = {0};
+    uint8_t block[64];
+    uint64_t blocks = 0;
+
+    memset(block, 0xA5, sizeof(block));
+    double start = now_seconds();
+    double elapsed;
+    do {
+        for (int i = 0; i < 4096; i++) {
+            sha256_compress(state, block);
+            block[0] ^= (uint8_t)state[0];
+        }
+        blocks += 4096;
+        elapsed = now_seconds() - start;
+    } while (elapsed < BENCH_SECONDS);
+    report("sha256_compress", NULL, 0, "throughput", blocks * 64 / elapsed / 1e6, "MB/s");
+
+    // The multi-buffer kernel, one block per lane
+    const Sha256Kernel *kernel = sha256_mb_kernel();
+    uint32_t states[SHA256_MB_MAX_LANES][8];
+    const uint8_t *lanes[SHA256_MB_MAX_LANES];
+    memset(states, 0, sizeof(states));
+    for (size_t i = 0; i < SHA256_MB_MAX_LANES; i++) lanes[i] = block;
+
+    blocks = 0;
+    start = now_seconds();
+    do {
+        for (int i = 0; i < 1024; i++) {
+            sha256_mb_compress(states, lanes, kernel->lanes);
+        }
+        blocks += 1024 * kernel->lanes;
+        elapsed = now_seconds() - start;
+    } while (elapsed < BENCH_SECONDS);
+    report("sha256_mb_compress", "lanes", kernel->lanes, "throughput", blocks * 64 / elapsed / 1e6, "MB/s");
+}
+
+static void synthetic_block(Block *block, uint32_t hash_version, uint32_t id) {
+    memset(block, 0, sizeof(*block));
+    block->block_id = id;
+    block->hash_version = hash_version;
+    block->timestamp = 1700000000 + id;
+    if (hash_version >= HASH_VERSION_BATCH) {
+        block->batch.event_count = 100;
+        block->batch.first_event = id * 100;
+        memset(block->batch.merkle_root, 0x5A, sizeof(block->batch.merkle_root));
+    } else {
+        block->payload.event_type = CLAIM_SUBMISSION;
+        snprintf(block->payload.policy_id, sizeof(block->payload.policy_id), "POL%06u", id % 1000);
+        snprintf(block->payload.member_id, sizeof(block->payload.member_id), "MEM%07u", id % 10000);
+        strcpy(block->payload.provider_id, "PRV0042");
+        block->payload.amount = 125.50;
+        strcpy(block->payload.diagnosis_code, "J45");
+        strcpy(block->payload.notes, "Synthetic benchmark event");
+    }
+}
+
+static void bench_calculate_hash() {
+    uint32_t versions[] = { HASH_VERSION_CURRENT, HASH_VERSION_BATCH };
+    Block block;
+    char hash[65];
+
+    for (int v = 0; v < 2; v++) {
+        synthetic_block(&block, versions[v], 1);
+        uint64_t hashes = 0;
+        double start = now_seconds();
+        double elapsed;
+        do {
+            for (int i = 0; i < 1024; i++) {
+                block.nonce++;
+                block_calculate_hash(&block, hash);
+            }
+            hashes += 1024;
+            elapsed = now_seconds() - start;
+        } while (elapsed < BENCH_SECONDS);
+        report("calculate_hash", "hash_version", versions[v], "rate", hashes / elapsed, "hashes/s");
+    }
+}
+
+// Latency of whole mines at each difficulty, on distinct blocks so every
+// sample searches a fresh nonce space
+static void bench_mine() {
+    double samples[MINE_SAMPLES];
+
+    for (uint32_t difficulty = 0; difficulty <= MINE_MAX_DIFFICULTY; difficulty += 4) {
+        PowTarget target;
+        Block block;
+        uint32_t count = 0;
+        double sum = 0.0;
+        double budget_start = now_seconds();
+
+        pow_target_from_bits(&target, difficulty);
+        fprintf(stderr, "mine_block: difficulty %u\n", difficulty);
+        while (count < MINE_SAMPLES && (count < 3 || now_seconds() - budget_start < MINE_BUDGET_SECONDS)) {
+            synthetic_block(&block, HASH_VERSION_CURRENT, count + 1);
+            block.difficulty = difficulty;
+            double start = now_seconds();
+            if (!miner_mine_block(&block, &target)) break;
+            samples[count] = (now_seconds() - start) * 1e3;
+            sum += samples[count++];
+        }
+        if (count == 0) continue;
+
+        qsort(samples, count, sizeof(double), compare_doubles);
+        report("mine_block", "difficulty", difficulty, "samples", count, "count");
+        report("mine_block", "difficulty", difficulty, "mean", sum / count, "ms");
+        report("mine_block", "difficulty", difficulty, "p50", percentile(samples, count, 0.50), "ms");
+        report("mine_block", "difficulty", difficulty, "p90", percentile(samples, count, 0.90), "ms");
+        report("mine_block", "difficulty", difficulty, "p99", percentile(samples, count, 0.99), "ms");
+        report("mine_block", "difficulty", difficulty, "max", samples[count - 1], "ms");
+    }
+}
+
+// Block times under retargeting, from difficulty 0 towards a short goal;
+// only the second half of the blocks, once the controller has settled,
+// is reported
+static void bench_retarget() {
+    double samples[RETARGET_BLOCKS / 2];
+    uint32_t count = 0;
+    double sum = 0.0;
+    InsurancePayload payload;
+
+    fprintf(stderr, "retarget: goal %.0f ms\n", RETARGET_GOAL_SECONDS * 1e3);
+    blockchain_init(0);
+    blockchain_set_block_time(RETARGET_GOAL_SECONDS);
+    memset(&payload, 0, sizeof(payload));
+    payload.event_type = PREMIUM_PAYMENT;
+    strcpy(payload.policy_id, "POL000001");
+    strcpy(payload.member_id, "MEM0000001");
+    payload.amount = 100.0;
+    for (uint32_t i = 0; i < RETARGET_BLOCKS; i++) {
+        double start = now_seconds();
+        if (blockchain_submit_event(&payload, NULL) != 1) break;
+        if (i >= RETARGET_BLOCKS / 2) {
+            samples[count] = (now_seconds() - start) * 1e3;
+            sum += samples[count++];
+        }
+    }
+    uint32_t difficulty = blockchain_get_instance()->difficulty;
+    blockchain_cleanup();
+    if (count == 0) return;
+
+    qsort(samples, count, sizeof(double), compare_doubles);
+    report("retarget", "goal_ms", RETARGET_GOAL_SECONDS * 1e3, "mean", sum / count, "ms");
+    report("retarget", "goal_ms", RETARGET_GOAL_SECONDS * 1e3, "p50", percentile(samples, count, 0.50), "ms");
+    report("retarget", "goal_ms", RETARGET_GOAL_SECONDS * 1e3, "p90", percentile(samples, count, 0.90), "ms");
+    report("retarget", "goal_ms", RETARGET_GOAL_SECONDS * 1e3, "difficulty", difficulty, "bits");
+}
+
+// Chain of `blocks` single-event blocks at difficulty 0, so building it
+// costs one hash per block and the other benches dominate
+static int build_chain(uint32_t blocks) {
+    InsurancePayload payload;
+    static const EventType types[] = {
+        ENROLLMENT, PREMIUM_PAYMENT, PREAUTH_REQUEST, CLAIM_SUBMISSION, CLAIM_DECISION
+    };
+
+    blockchain_init(0);
+    blockchain_set_block_time(0);
+    miner_set_threads(1);
+    for (uint32_t i = 1; i < blocks; i++) {
+        memset(&payload, 0, sizeof(payload));
+        payload.event_type = types[i % 5];
+        snprintf(payload.policy_id, sizeof(payload.policy_id), "POL%06u", i % 1000);
+        snprintf(payload.member_id, sizeof(payload.member_id), "MEM%07u", i % 10000);
+        snprintf(payload.provider_id, sizeof(payload.provider_id), "PRV%04u", i % 100);
+        payload.amount = (i % 1000) + 0.5;
+        strcpy(payload.diagnosis_code, "J45");
+        strcpy(payload.notes, "Synthetic benchmark event");
+
+        if (blockchain_submit_event(&payload, NULL) != 1) {
+            miner_set_threads(0);
+            return 0;
+        }
+    }
+    miner_set_threads(0);
+    return 1;
+}
+
+static void bench_chain(uint32_t blocks, const char *path) {
+    fprintf(stderr, "chain: %u blocks\n", blocks);
+
+    double start = now_seconds();
+    if (!build_chain(blocks)) {
+        fprintf(stderr, "Error: Could not build a %u-block chain\n", blocks);
+        blockchain_cleanup();
+        return;
+    }
+    double elapsed = now_seconds() - start;
+    report("build", "blocks", blocks, "throughput", blocks / elapsed, "blocks/s");
+    report("build", "blocks", blocks, "memory", blockchain_resident_bytes() / 1e6, "MB");
+
+    start = now_seconds();
+    int valid = blockchain_verify();
+    elapsed = now_seconds() - start;
+    if (valid) report("verify", "blocks", blocks, "throughput", blocks / elapsed, "blocks/s");
+
+    // Formatting the newest 20 blocks should not depend on chain length
+    start = now_seconds();
+    for (int i = 0; i < 100; i++) {
+        blockchain_view_range(blocks > 20 ? blocks - 20 : 0, blocks);
+    }
+    elapsed = now_seconds() - start;
+    report("view_tail", "blocks", blocks, "latency", elapsed / 100 * 1e3, "ms");
+
+    // Filtered sum, then a group-by, over the query columns
+    const char *queries[][2] = {
+        { "query_filter", "type=CLAIM_SUBMISSION diagnosis=J45" },
+        { "query_group", "by=provider" }
+    };
+    for (int q = 0; q < 2; q++) {
+        start = now_seconds();
+        for (int i = 0; i < 10; i++) {
+            blockchain_query_args(queries[q][1]);
+        }
+        elapsed = now_seconds() - start;
+        report(queries[q][0], "blocks", blocks, "throughput", blocks * 10.0 / elapsed, "rows/s");
+    }
+
+    store_remove(path);
+    start = now_seconds();
+    blockchain_save(path);
+    elapsed = now_seconds() - start;
+    double megabytes = store_disk_bytes(path) / 1e6;
+    report("save", "blocks", blocks, "throughput", megabytes / elapsed, "MB/s");
+    report("save", "blocks", blocks, "size", megabytes, "MB");
+
+    char packed[620];
+    snprintf(packed, sizeof(packed), "%s.z", path);
+    store_set_compression(1);
+    blockchain_save(packed);
+    store_set_compression(0);
+    report("save_compressed", "blocks", blocks, "size", store_disk_bytes(packed) / 1e6, "MB");
+    store_remove(packed);
+    blockchain_cleanup();
+
+    // Load maps the log and rebuilds the indexes from it
+    start = now_seconds();
+    blockchain_load(path);
+    elapsed = now_seconds() - start;
+    double load_seconds = elapsed;
+    if (blockchain_length() == blocks) {
+        report("load", "blocks", blocks, "throughput", megabytes / elapsed, "MB/s");
+
+        start = now_seconds();
+        valid = blockchain_verify();
+        elapsed = now_seconds() - start;
+        if (valid) report("verify_mapped", "blocks", blocks, "throughput", blocks / elapsed, "blocks/s");
+    } else {
+        fprintf(stderr, "Error: Loaded %u of %u blocks\n", blockchain_length(), blocks);
+    }
+    report("load", "blocks", blocks, "latency", load_seconds * 1e3, "ms");
+
+    // Snapshot the indexes, then cold start from the snapshot
+    start = now_seconds();
+    if (blockchain_snapshot()) {
+        elapsed = now_seconds() - start;
+        char snap[620];
+        struct stat st;
+        snprintf(snap, sizeof(snap), "%s.snap", path);
+        report("snapshot", "blocks", blocks, "latency", elapsed * 1e3, "ms");
+        if (stat(snap, &st) == 0) report("snapshot", "blocks", blocks, "size", st.st_size / 1e6, "MB");
+
+        blockchain_cleanup();
+        start = now_seconds();
+        blockchain_load(path);
+        elapsed = now_seconds() - start;
+        if (blockchain_length() == blocks) report("load_snapshot", "blocks", blocks, "latency", elapsed * 1e3, "ms");
+    }
+    // Bounded memory: tail views are served by the block cache, random
+    // reads across the chain mostly go to the log
+    if (blockchain_length() == blocks && blockchain_set_block_cache(CACHE_BLOCKS)) {
+        MetricsSnapshot before, after;
+        Block block;
+        uint64_t seed = 88172645463325252ull;
+
+        metrics_snapshot(&before);
+        start = now_seconds();
+        for (int i = 0; i < 100; i++) {
+            blockchain_view_range(blocks > 20 ? blocks - 20 : 0, blocks);
+        }
+        elapsed = now_seconds() - start;
+        report("view_tail_cached", "blocks", blocks, "latency", elapsed / 100 * 1e3, "ms");
+
+        start = now_seconds();
+        for (int i = 0; i < CACHE_READS; i++) {
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+            blockchain_read_block((uint32_t)(seed % blocks), &block);
+        }
+        elapsed = now_seconds() - start;
+        report("read_random_cached", "blocks", blocks, "latency", elapsed / CACHE_READS * 1e6, "us");
+
+        metrics_snapshot(&after);
+        uint64_t hits = after.counters[METRIC_CACHE_HITS] - before.counters[METRIC_CACHE_HITS];
+        uint64_t misses = after.counters[METRIC_CACHE_MISSES] - before.counters[METRIC_CACHE_MISSES];
+        if (hits + misses > 0) report("block_cache", "blocks", blocks, "hit_rate", 100.0 * hits / (hits + misses), "%");
+        report("block_cache", "blocks", blocks, "memory", blockchain_resident_bytes() / 1e6, "MB");
+        blockchain_set_block_cache(0);
+    }
+    blockchain_cleanup();
+    snapshot_remove(path);
+    store_remove(path);
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t default_sizes[] = { 1000, 100000, 1000000 };
+    uint32_t sizes[16];
+    uint32_t size_count = 0;
+    const char *out_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            out_path = argv[++i];
+        } else if (size_count < 16 && atol(argv[i]) > 0) {
+            sizes[size_count++] = (uint32_t)atol(argv[i]);
+        } else {
+            fprintf(stderr, "Usage: %s [-o results.jsonl] [blocks ...]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (size_count == 0) {
+        memcpy(sizes, default_sizes, sizeof(default_sizes));
+        size_count = 3;
+    }
+
+    results = out_path ? fopen(out_path, "w") : stdout;
+    if (!results) {
+        fprintf(stderr, "Error: Could not open %s\n", out_path);
+        return 1;
+    }
+
+    // The engine's own reports would interleave with the results
+    FILE *quiet = fopen("/dev/null", "w");
+    blockchain_set_output(quiet);
+
+    // Snapshots are measured on their own; loads otherwise replay everything
+    snapshot_set_interval(0);
+
+    const char *tmp = getenv("TMPDIR");
+    char dir[512];
+    snprintf(dir, sizeof(dir), "%s/ib-bench-XXXXXX", tmp && tmp[0] ? tmp : "/tmp");
+    if (!mkdtemp(dir)) {
+        fprintf(stderr, "Error: Could not create a scratch directory\n");
+        return 1;
+    }
+    char path[600];
+    snprintf(path, sizeof(path), "%s/chain.dat", dir);
+
+    fprintf(results, "{\"bench\":\"meta\",\"kernel\":\"%s\",\"lanes\":%zu,\"threads\":%u,\"time\":%lld}\n",
+            sha256_mb_kernel()->name, sha256_mb_kernel()->lanes, miner_get_threads(), (long long)time(NULL));
+
+    fprintf(stderr, "sha256_compress\n");
+    bench_sha256();
+    fprintf(stderr, "calculate_hash\n");
+    bench_calculate_hash();
+    bench_mine();
+    bench_retarget();
+    for (uint32_t i = 0; i < size_count; i++) {
+        bench_chain(sizes[i], path);
+    }
+
+    rmdir(dir);
+    blockchain_set_output(NULL);
+    if (quiet) fclose(quiet);
+    if (results != stdout) fclose(results);
+    return 0;
+}
@@ -4,265 +4,1713 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "insurance_types.h"
+#include "blockchain.h"
 #include "sha256.h"
 #include "validation.h"
+#include "miner.h"
+#include "verify.h"
+#include "checkpoint.h"
+#include "storage.h"
+#include "index.h"
+#include "merkle.h"
+#include "metrics.h"
+#include "textbuf.h"
+#include "codec.h"
+#include "dict.h"
+#include "columns.h"
+#include "retarget.h"
+#include "snapshot.h"
+#include "cache.h"
+#include "claims.h"
+
+// Whole-file chain format, now only read to import into the segment log.
+// Files written before the format header existed start directly with the
+// difficulty word; anything else must begin with this magic
+#define CHAIN_FILE_MAGIC 0x46434249u  // "IBCF"
+#define CHAIN_FILE_VERSION 4
+
+// Formatting buffer for view and history, flushed whenever it fills
+#define VIEW_BUFFER_SIZE 65536
+#define VIEW_PAGE_SIZE 20
 
 static Blockchain *blockchain = NULL;
+static ChainStore *store = NULL;
+
+// Where the writer encodes each new record before linking it in
+static uint8_t *encode_buffer = NULL;
+static size_t encode_capacity = 0;
+
+// Events waiting to be sealed into the next batched block
+static InsurancePayload *pending = NULL;
+static uint32_t pending_count = 0;
+static uint32_t pending_capacity = 0;
+static time_t pending_since = 0;
+
+// Seal a batch at batch_size events or once its oldest event is
+// batch_wait seconds old (0 = no time limit). A batch size of 1 mines
+// every event into its own single-payload block, as before
+static uint32_t batch_size = 1;
+static uint32_t batch_wait = 0;
+
+// One writer (whoever mines) and any number of readers. The writer mines
+// without the lock and takes it only to link a block in or touch the log,
+// so readers never wait for a proof of work
+static pthread_rwlock_t chain_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+// Height covered by the attached log's newest snapshot
+static uint32_t snapshot_height = 0;
+
+// Where this thread's reports go; stdout unless redirected
+static __thread FILE *output = NULL;
+
+static FILE* out() {
+    return output ? output : stdout;
+}
+
+static Blockchain* chain_new(uint32_t difficulty) {
+    Blockchain *chain = (Blockchain*)calloc(1, sizeof(Blockchain));
+    if (!chain) return NULL;
+    chain->difficulty = difficulty;
+    return chain;
+}
+
+// Slot for block `height` in the page table, allocating its page on
+// first use. Pages never move, so record refs stay valid as it grows
+static RecordRef* record_slot(uint32_t height) {
+    uint32_t page = height / BLOCK_PAGE_SIZE;
+    
+    if (page >= blockchain->page_slots) {
+        uint32_t slots = blockchain->page_slots ? blockchain->page_slots : 16;
+        while (slots <= page) slots *= 2;
+        RecordRef **pages = (RecordRef**)realloc(blockchain->pages, slots * sizeof(RecordRef*));
+        if (!pages) return NULL;
+        memset(pages + blockchain->page_slots, 0, (slots - blockchain->page_slots) * sizeof(RecordRef*));
+        blockchain->pages = pages;
+        blockchain->page_slots = slots;
+    }
+    if (!blockchain->pages[page]) {
+        blockchain->pages[page] = (RecordRef*)malloc(BLOCK_PAGE_SIZE * sizeof(RecordRef));
+        if (!blockchain->pages[page]) return NULL;
+    }
+    return &blockchain->pages[page][height % BLOCK_PAGE_SIZE];
+}
+
+// Copy a record into the arena, starting a new chunk when it does not fit
+static const uint8_t* arena_copy(const uint8_t *record, uint32_t length) {
+    if (blockchain->arena_free < length) {
+        size_t size = length > RECORD_CHUNK_SIZE ? length : RECORD_CHUNK_SIZE;
+        uint8_t **chunks = (uint8_t**)realloc(blockchain->chunks, (blockchain->chunk_count + 1) * sizeof(uint8_t*));
+        if (!chunks) return NULL;
+        blockchain->chunks = chunks;
+        uint8_t *chunk = (uint8_t*)malloc(size);
+        if (!chunk) return NULL;
+        blockchain->chunks[blockchain->chunk_count++] = chunk;
+        blockchain->arena_next = chunk;
+        blockchain->arena_free = size;
+        blockchain->arena_bytes += size;
+    }
+    uint8_t *copy = blockchain->arena_next;
+    memcpy(copy, record, length);
+    blockchain->arena_next += length;
+    blockchain->arena_free -= length;
+    return copy;
+}
+
+// Keep block `height`'s record in memory. Called with the write lock
+// held once readers may be about
+static int link_record(uint32_t height, const uint8_t *record, uint32_t length) {
+    RecordRef *slot = record_slot(height);
+    const uint8_t *copy = slot ? arena_copy(record, length) : NULL;
+    if (!copy) return 0;
+    slot->data = copy;
+    slot->length = length;
+    return 1;
+}
 
-// Calculate hash of a block
-static void calculate_hash(Block *block, char *output) {
-    SHA256_CTX ctx;
-    uint8_t hash[SHA256_BLOCK_SIZE];
-    char data[2048];
-    
-    snprintf(data, sizeof(data), "%u%ld%s%s%d%s%.2f%s%s%s%u",
-             block->block_id,
-             block->timestamp,
-             block->payload.policy_id,
-             block->payload.member_id,
-             block->payload.event_type,
-             block->payload.provider_id,
-             block->payload.amount,
-             block->payload.diagnosis_code,
-             block->payload.notes,
-             block->prev_hash,
-             block->nonce);
-    
-    sha256_init(&ctx);
-    sha256_update(&ctx, (uint8_t*)data, strlen(data));
-    sha256_final(&ctx, hash);
-    bytes_to_hex(hash, SHA256_BLOCK_SIZE, output);
-}
-
-// Proof of Work Mining
-static int mine_block(Block *block, uint32_t difficulty) {
-    char target[65] = {0};
-    for (uint32_t i = 0; i < difficulty; i++) {
-        target[i] = '0';
-    }
-    
-    block->nonce = 0;
-    do {
-        block->nonce++;
-        calculate_hash(block, block->hash);
-    } while (strncmp(block->hash, target, difficulty) != 0);
+// Encode a block and a batch's events into encode_buffer, interning their
+// IDs; returns the record length, 0 when out of memory
+static uint32_t encode_record(const Block *block, const InsurancePayload *events) {
+    uint32_t count = block->hash_version >= HASH_VERSION_BATCH ? block->batch.event_count : 0;
+    size_t needed = CODEC_RECORD_MAX(count);
     
+    if (needed > encode_capacity) {
+        uint8_t *grown = (uint8_t*)realloc(encode_buffer, needed);
+        if (!grown) return 0;
+        encode_buffer = grown;
+        encode_capacity = needed;
+    }
+    size_t length = codec_encode_block(block, encode_buffer);
+    for (uint32_t i = 0; length > 0 && i < count; i++) {
+        size_t size = codec_encode_event(&events[i], encode_buffer + length);
+        length = size ? length + size : 0;
+    }
+    return (uint32_t)length;
+}
+
+// Block h's record: in place from memory or the mapped log, or read into
+// record's buffer. In bounded-memory mode a saved block comes from the
+// block cache, or from the log and then into the cache
+static int read_record(uint32_t height, StoreRecord *record) {
+    if (!blockchain || height >= blockchain->length) return 0;
+    if (height < blockchain->mapped) {
+        if (cache_capacity() == 0) return store_read(store, height, record);
+        if (cache_get(height, record)) return 1;
+        if (!store_read(store, height, record)) return 0;
+        cache_put(height, record->data, record->length);
+        return 1;
+    }
+    const RecordRef *ref = &blockchain->pages[height / BLOCK_PAGE_SIZE][height % BLOCK_PAGE_SIZE];
+    record->data = ref->data;
+    record->length = ref->length;
     return 1;
 }
 
+static int fetch_block(void *ctx, uint32_t height, Block *block) {
+    (void)ctx;
+    return blockchain_read_block(height, block);
+}
+
+// All of a batch's events; the record must end right after the last one
+static int fetch_events(void *ctx, uint32_t height, InsurancePayload *events, uint32_t count) {
+    StoreRecord record = { 0 };
+    Block block;
+    const uint8_t *cursor = NULL;
+    (void)ctx;
+    
+    if (read_record(height, &record)) {
+        const uint8_t *end = record.data + record.length;
+        cursor = codec_decode_block(record.data, end, &block);
+        if (cursor && block.batch.event_count != count) cursor = NULL;
+        for (uint32_t i = 0; cursor && i < count; i++) {
+            cursor = codec_decode_event(cursor, end, &events[i]);
+        }
+        if (cursor != end) cursor = NULL;
+    }
+    store_release(&record);
+    return cursor != NULL;
+}
+
+// Hash of the newest block, or all zeros for an empty chain
+static void tip_hash(uint8_t hash[]) {
+    Block tip;
+    if (blockchain->length > 0 && blockchain_read_block(blockchain->length - 1, &tip)) {
+        memcpy(hash, tip.hash, SHA256_BLOCK_SIZE);
+    } else {
+        memset(hash, 0, SHA256_BLOCK_SIZE);
+    }
+}
+
+// Hex for display; the genesis block's all-zero link shows as "0"
+static void format_hash(const uint8_t hash[], char *hex) {
+    static const uint8_t zeros[SHA256_BLOCK_SIZE];
+    if (memcmp(hash, zeros, SHA256_BLOCK_SIZE) == 0) {
+        strcpy(hex, "0");
+    } else {
+        bytes_to_hex(hash, SHA256_BLOCK_SIZE, hex);
+    }
+}
+
+// Copy the mapped records into memory so the log can be closed
+static int unmap_blocks() {
+    StoreRecord record = { 0 };
+    int ok = 1;
+    
+    for (uint32_t height = 0; ok && height < blockchain->mapped; height++) {
+        ok = store_read(store, height, &record) && link_record(height, record.data, record.length);
+    }
+    store_release(&record);
+    if (ok) blockchain->mapped = 0;
+    return ok;
+}
+
+// In bounded-memory mode, once the log holds every block, drop the
+// records kept in memory: from here on they are read back through the
+// block cache. The newest chunk goes too with `all` set, otherwise it
+// stays to take the next blocks. The caller holds the write lock
+static void release_saved_records(int all) {
+    if (!store || cache_capacity() == 0 || store_count(store) != blockchain->length) return;
+    if (blockchain->chunk_count <= (all ? 0u : 1u)) return;
+    
+    uint32_t kept = all ? 0 : 1;
+    for (uint32_t i = 0; i + kept < blockchain->chunk_count; i++) {
+        free(blockchain->chunks[i]);
+    }
+    if (kept) {
+        blockchain->chunks[0] = blockchain->chunks[blockchain->chunk_count - 1];
+        blockchain->arena_bytes = blockchain->arena_free + (size_t)(blockchain->arena_next - blockchain->chunks[0]);
+    } else {
+        blockchain->arena_next = NULL;
+        blockchain->arena_free = 0;
+        blockchain->arena_bytes = 0;
+    }
+    blockchain->chunk_count = kept;
+    blockchain->mapped = blockchain->length;
+    for (uint32_t page = 0; page < blockchain->page_slots && page < blockchain->mapped / BLOCK_PAGE_SIZE; page++) {
+        free(blockchain->pages[page]);
+        blockchain->pages[page] = NULL;
+    }
+}
+
+// Add one event of a block to the claim index, the ID indexes and the
+// query columns. The claim index goes first: it decides whether the
+// event closes a preauth the ID totals count as open
+static void index_event(const Block *block, const InsurancePayload *event) {
+    int closed_preauth = 0;
+    
+    if (!claims_add_event(event, block->block_id, block->timestamp, &closed_preauth)) {
+        fprintf(out(), "Error: Could not add block %u to the claim index\n", block->block_id);
+    }
+    index_add_event(event, block->block_id, closed_preauth);
+    if (!columns_add_event(event, block->timestamp)) {
+        fprintf(out(), "Error: Could not add block %u to the query columns\n", block->block_id);
+    }
+}
+
+static void index_events(const Block *block, const InsurancePayload *events) {
+    uint32_t count = blockchain_block_event_count(block);
+    for (uint32_t i = 0; i < count; i++) {
+        index_event(block, &events[i]);
+    }
+}
+
+// Rebuild the ID indexes, query columns, claims and event count in one
+// pass over the chain, or bring them up to date from block `from` when
+// they already cover the blocks before it
+static void rebuild_indexes(uint32_t from) {
+    BlockIterator it;
+    const Block *block;
+    InsurancePayload event;
+    
+    if (from == 0) {
+        index_reset();
+        columns_reset();
+        claims_reset();
+        blockchain->event_count = 0;
+    }
+    blockchain_iter_init(&it, from, blockchain->length);
+    while ((block = blockchain_iter_next(&it))) {
+        while (blockchain_iter_event(&it, &event) > 0) {
+            index_event(block, &event);
+        }
+        if (block->hash_version >= HASH_VERSION_BATCH) {
+            blockchain->event_count = block->batch.first_event + block->batch.event_count;
+        }
+    }
+    blockchain_iter_close(&it);
+}
+
 // Initialize blockchain with genesis block
 void blockchain_init(uint32_t difficulty) {
-    blockchain = (Blockchain*)malloc(sizeof(Blockchain));
-    blockchain->head = NULL;
-    blockchain->tail = NULL;
-    blockchain->length = 0;
-    blockchain->difficulty = difficulty;
+    Block genesis;
+    
+    blockchain = chain_new(difficulty);
+    dict_reset();
+    retarget_reset();
+    cache_clear();
+    snapshot_height = 0;
     
     // Create genesis block
-    Block *genesis = (Block*)malloc(sizeof(Block));
-    genesis->block_id = 0;
-    genesis->timestamp = time(NULL);
-    strcpy(genesis->payload.policy_id, "GENESIS");
-    strcpy(genesis->payload.member_id, "SYSTEM");
-    genesis->payload.event_type = ENROLLMENT;
-    strcpy(genesis->payload.provider_id, "SYSTEM");
-    genesis->payload.amount = 0.0;
-    strcpy(genesis->payload.diagnosis_code, "N/A");
-    strcpy(genesis->payload.notes, "Genesis Block - Health Insurance Blockchain");
-    strcpy(genesis->prev_hash, "0");
-    genesis->nonce = 0;
-    genesis->next = NULL;
-    
-    mine_block(genesis, difficulty);
-    
-    blockchain->head = genesis;
-    blockchain->tail = genesis;
+    memset(&genesis, 0, sizeof(genesis));
+    genesis.block_id = 0;
+    genesis.hash_version = HASH_VERSION_CURRENT;
+    genesis.difficulty = difficulty;
+    genesis.timestamp = time(NULL);
+    strcpy(genesis.payload.policy_id, "GENESIS");
+    strcpy(genesis.payload.member_id, "SYSTEM");
+    genesis.payload.event_type = ENROLLMENT;
+    strcpy(genesis.payload.provider_id, "SYSTEM");
+    genesis.payload.amount = 0.0;
+    strcpy(genesis.payload.diagnosis_code, "N/A");
+    strcpy(genesis.payload.notes, "Genesis Block - Health Insurance Blockchain");
+    genesis.nonce = 0;
+    
+    PowTarget target;
+    pow_target_from_bits(&target, difficulty);
+    miner_mine_block(&genesis, &target);
+    
+    uint32_t length = encode_record(&genesis, NULL);
+    if (length == 0 || !link_record(0, encode_buffer, length)) {
+        fprintf(out(), "Error: Out of memory\n");
+        return;
+    }
     blockchain->length = 1;
+    index_reset();
+    columns_reset();
+    claims_reset();
+    index_events(&genesis, &genesis.payload);
+}
+
+// Header fields shared by every new block; nothing is mined yet
+static void start_block(Block *new_block, uint32_t hash_version) {
+    memset(new_block, 0, sizeof(*new_block));
+    new_block->block_id = blockchain->length;
+    new_block->hash_version = hash_version;
+    new_block->difficulty = blockchain->difficulty;
+    new_block->timestamp = time(NULL);
+    // In bounded-memory mode a persist on another thread may release the
+    // records the tip is read from
+    pthread_rwlock_rdlock(&chain_lock);
+    tip_hash(new_block->prev_hash);
+    pthread_rwlock_unlock(&chain_lock);
+    new_block->nonce = 0;
+}
+
+// Mine a started block, encode it with its events (the batch's, or its
+// own payload) and link the record in under the write lock. Nothing is
+// written to the log here; with verbose set, progress is printed as before
+static int finish_block(Block *new_block, const InsurancePayload *events, int verbose) {
+    if (verbose) {
+        fprintf(out(), "Mining block %u with %u thread(s)...\n", new_block->block_id, miner_get_threads());
+    }
+    PowTarget target;
+    pow_target_from_bits(&target, new_block->difficulty);
+    uint64_t start = metrics_start();
+    if (!miner_mine_block(new_block, &target)) {
+        return 0;
+    }
+    retarget_record(new_block->difficulty, (metrics_start() - start) / 1e9);
+    if (verbose) {
+        char hash[65];
+        format_hash(new_block->hash, hash);
+        fprintf(out(), "Block mined! Hash: %s\n", hash);
+    }
+    
+    uint32_t length = encode_record(new_block, events);
+    pthread_rwlock_wrlock(&chain_lock);
+    if (length == 0 || !link_record(blockchain->length, encode_buffer, length)) {
+        pthread_rwlock_unlock(&chain_lock);
+        fprintf(out(), "Error: Out of memory\n");
+        return 0;
+    }
+    blockchain->difficulty = retarget_next(new_block->difficulty);
+    blockchain->length++;
+    if (new_block->hash_version >= HASH_VERSION_BATCH) {
+        blockchain->event_count += new_block->batch.event_count;
+        pending_count = 0;  // the pending events are this batch
+    }
+    index_events(new_block, events);
+    pthread_rwlock_unlock(&chain_lock);
+    return 1;
+}
+
+// Seal the pending events into one batched block: their Merkle root goes
+// into the header and only the header is mined, so the proof of work is
+// paid once per batch. The events are encoded into the block's record
+static int seal_pending(Block *new_block, int verbose) {
+    const InsurancePayload **events = (const InsurancePayload**)malloc(pending_count * sizeof(*events));
+    
+    if (!events) {
+        fprintf(out(), "Error: Out of memory\n");
+        return 0;
+    }
+    start_block(new_block, HASH_VERSION_BATCH);
+    for (uint32_t i = 0; i < pending_count; i++) {
+        events[i] = &pending[i];
+    }
+    new_block->batch.event_count = pending_count;
+    new_block->batch.first_event = blockchain->event_count;
+    merkle_root(events, pending_count, new_block->batch.merkle_root);
+    free(events);
+    
+    if (verbose) {
+        fprintf(out(), "Sealing %u event(s) into block %u\n", pending_count, new_block->block_id);
+    }
+    return finish_block(new_block, pending, verbose);
+}
+
+static int batch_due() {
+    return pending_count >= batch_size || pending_count >= MAX_BATCH_EVENTS ||
+           (batch_wait > 0 && time(NULL) - pending_since >= (time_t)batch_wait);
+}
+
+// Take one event. Returns 1 when a block was mined (a copy goes to sealed
+// if given), 0 when the event waits for its batch to fill, -1 on error
+static int submit_event(const InsurancePayload *payload, int verbose, Block *sealed) {
+    Block new_block;
+    int mined;
+    
+    if (!blockchain) {
+        fprintf(out(), "Error: Blockchain not initialized\n");
+        return -1;
+    }
+    
+    if (batch_size <= 1 && pending_count == 0) {
+        start_block(&new_block, HASH_VERSION_CURRENT);
+        new_block.payload = *payload;
+        mined = finish_block(&new_block, &new_block.payload, verbose);
+    } else {
+        if (pending_count == pending_capacity) {
+            uint32_t capacity = pending_capacity ? pending_capacity * 2 : 64;
+            InsurancePayload *grown = (InsurancePayload*)realloc(pending, capacity * sizeof(InsurancePayload));
+            if (!grown) {
+                fprintf(out(), "Error: Out of memory\n");
+                return -1;
+            }
+            pending = grown;
+            pending_capacity = capacity;
+        }
+        if (pending_count == 0) pending_since = time(NULL);
+        pending[pending_count] = *payload;
+        pthread_rwlock_wrlock(&chain_lock);
+        pending_count++;
+        pthread_rwlock_unlock(&chain_lock);
+        if (!batch_due()) return 0;
+        mined = seal_pending(&new_block, verbose);
+    }
+    
+    if (!mined) return -1;
+    if (sealed) *sealed = new_block;
+    return 1;
 }
 
 // Add new block to blockchain
 int blockchain_add_block(InsurancePayload payload) {
-    if (!blockchain) {
-        printf("Error: Blockchain not initialized\n");
+    uint64_t start = metrics_start();
+    Block sealed;
+    int mined = submit_event(&payload, 1, &sealed);
+    if (mined == 0) {
+        fprintf(out(), "Event queued for the next block (%u/%u pending)\n", pending_count, batch_size);
+    } else if (mined > 0) {
+        // Once attached to a log every block is appended as it is mined; a
+        // failed append is retried by the next save
+        blockchain_persist_block(sealed.block_id);
+    }
+    metrics_finish(METRIC_ADD_BLOCK, start);
+    return mined >= 0;
+}
+
+// Take an event without touching the log, for pipelines that persist on
+// another thread; see submit_event for the result
+int blockchain_submit_event(const InsurancePayload *payload, Block *sealed) {
+    return submit_event(payload, 0, sealed);
+}
+
+// Seal whatever is pending into a block now. Returns 1 when a block was
+// mined (copied to sealed if given), 0 when nothing was pending
+int blockchain_seal_batch(Block *sealed, int verbose) {
+    Block new_block;
+    
+    if (!blockchain || pending_count == 0) return 0;
+    if (!seal_pending(&new_block, verbose)) return -1;
+    if (sealed) *sealed = new_block;
+    return 1;
+}
+
+// Seal and persist a partial batch whose time limit has passed
+void blockchain_seal_if_due() {
+    Block sealed;
+    if (blockchain && pending_count > 0 && batch_due() && blockchain_seal_batch(&sealed, 1) > 0) {
+        blockchain_persist_block(sealed.block_id);
+    }
+}
+
+// Events per block and seconds a partial batch may wait
+void blockchain_set_batching(uint32_t max_events, uint32_t max_wait_seconds) {
+    batch_size = max_events < 1 ? 1 : (max_events > MAX_BATCH_EVENTS ? MAX_BATCH_EVENTS : max_events);
+    batch_wait = max_wait_seconds;
+}
+
+uint32_t blockchain_pending_events() {
+    return pending_count;
+}
+
+// Append block `height`'s record, events included, to the attached log
+// if it is the next block there. The caller holds the write lock
+static int persist_locked(uint32_t height) {
+    if (!store || height >= blockchain->length || height < blockchain->mapped ||
+        store_count(store) != height) {
         return 0;
     }
+    const RecordRef *ref = &blockchain->pages[height / BLOCK_PAGE_SIZE][height % BLOCK_PAGE_SIZE];
+    return store_append(store, ref->data, ref->length);
+}
+
+// Capture a snapshot of the indexes for the log, to be written in the
+// background. Only a fully saved chain is captured, so the snapshot never
+// covers blocks the log could lose. The caller keeps writers off
+static int snapshot_locked() {
+    SnapshotInfo info;
     
-    Block *new_block = (Block*)malloc(sizeof(Block));
-    new_block->block_id = blockchain->length;
-    new_block->timestamp = time(NULL);
-    new_block->payload = payload;
-    strcpy(new_block->prev_hash, blockchain->tail->hash);
-    new_block->nonce = 0;
-    new_block->next = NULL;
+    if (!store || blockchain->length == 0 || store_count(store) != blockchain->length) return 0;
+    memset(&info, 0, sizeof(info));
+    info.height = blockchain->length;
+    info.event_count = blockchain->event_count;
+    tip_hash(info.tip_hash);
+    if (!snapshot_capture(store_path(store), &info)) return 0;
+    snapshot_height = info.height;
+    return 1;
+}
+
+// Snapshot every snapshot_interval() appended blocks
+static void snapshot_if_due() {
+    uint32_t interval = snapshot_interval();
+    if (interval > 0 && store && store_count(store) >= snapshot_height + interval) {
+        snapshot_locked();
+    }
+}
+
+// Append a mined block to the log. In bounded-memory mode this also
+// releases the saved records, so it runs under the write lock; it may
+// run alongside blockchain_submit_event, which reads the tip under the
+// read lock
+int blockchain_persist_block(uint32_t height) {
+    pthread_rwlock_wrlock(&chain_lock);
+    int ok = persist_locked(height);
+    if (ok) {
+        snapshot_if_due();
+        release_saved_records(0);
+    }
+    pthread_rwlock_unlock(&chain_lock);
+    return ok;
+}
+
+// Snapshot the indexes now and wait for the file to be written. The chain
+// must be saved first
+int blockchain_snapshot() {
+    if (!blockchain || !store) {
+        fprintf(out(), "Error: Save the blockchain before taking a snapshot\n");
+        return 0;
+    }
+    snapshot_wait();
+    pthread_rwlock_rdlock(&chain_lock);
+    int captured = snapshot_locked();
+    uint32_t height = blockchain->length;
+    int saved = store_count(store) == height;
+    pthread_rwlock_unlock(&chain_lock);
+    if (!captured) {
+        fprintf(out(), saved ? "Error: Could not capture a snapshot\n"
+                             : "Error: Save the blockchain before taking a snapshot\n");
+        return 0;
+    }
+    if (!snapshot_wait()) {
+        fprintf(out(), "Error: Could not write the snapshot\n");
+        return 0;
+    }
+    fprintf(out(), "Snapshot written at height %u\n", height);
+    return 1;
+}
+
+// Whether blocks are persisted as they are mined, i.e. a log is attached
+int blockchain_is_attached() {
+    return store != NULL;
+}
+
+// Attach the log at filename so blocks are persisted as they are mined.
+// A chain already there is loaded, as long as this session has added
+// nothing that loading would discard; otherwise a new log is started.
+// Returns 0 when the log could not be attached
+int blockchain_attach(const char *filename) {
+    if (store && strcmp(store_path(store), filename) == 0) return 1;
+    if (store_exists(filename) || access(filename, F_OK) == 0) {
+        if (blockchain && (blockchain->length > 1 || pending_count > 0)) {
+            fprintf(out(), "Error: %s holds a chain this session has not loaded; load it first\n", filename);
+            return 0;
+        }
+        if (!blockchain_load(filename)) return 0;
+    }
+    if (!store) blockchain_save(filename);
+    return store && strcmp(store_path(store), filename) == 0;
+}
+
+// Set the leading zero bits required for the next block
+void blockchain_set_difficulty(uint32_t zero_bits) {
+    if (blockchain) blockchain->difficulty = zero_bits;
+}
+
+// Retarget the difficulty after every block so mining one takes about
+// `seconds`; 0 keeps whatever difficulty is set
+void blockchain_set_block_time(double seconds) {
+    retarget_set_goal(seconds);
+}
+
+// Bounded-memory mode: keep only the unsaved tip, the indexes and an LRU
+// cache of up to `blocks` saved records, reading the rest from the log by
+// height. 0 turns it off; records are then read from the mapped log
+int blockchain_set_block_cache(uint32_t blocks) {
+    pthread_rwlock_wrlock(&chain_lock);
+    int ok = cache_set_capacity(blocks);
+    if (ok && store) ok = store_set_mapped(store, blocks == 0);
+    if (ok && blockchain) release_saved_records(1);
+    pthread_rwlock_unlock(&chain_lock);
+    if (!ok) {
+        fprintf(out(), "Error: Could not set up a block cache of %u block(s)\n", blocks);
+    }
+    return ok;
+}
+
+// Verify blocks after the checkpoint (or all of them), then record a new
+// checkpoint at the tip when a chain file is given
+static int check_chain(const char *filename, int since_checkpoint) {
+    if (!blockchain || blockchain->length == 0) {
+        fprintf(out(), "Error: Empty blockchain\n");
+        return 0;
+    }
     
-    printf("Mining block %u...\n", new_block->block_id);
-    mine_block(new_block, blockchain->difficulty);
-    printf("Block mined! Hash: %s\n", new_block->hash);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
     
-    blockchain->tail->next = new_block;
-    blockchain->tail = new_block;
-    blockchain->difficulty = (blockchain->difficulty +1)%6;
-    blockchain->length++;
+    uint32_t count = blockchain->length;
+    Block anchor_block;
+    
+    uint32_t begin = 0;
+    uint8_t digest[SHA256_BLOCK_SIZE];
+    checkpoint_digest_init(digest);
+    
+    Checkpoint checkpoint;
+    if (since_checkpoint) {
+        if (!checkpoint_load(filename, &checkpoint)) {
+            fprintf(out(), "No valid checkpoint found; running full verification\n");
+        } else if (checkpoint.height >= count ||
+                   !blockchain_read_block(checkpoint.height, &anchor_block) ||
+                   memcmp(anchor_block.hash, checkpoint.hash, SHA256_BLOCK_SIZE) != 0) {
+            fprintf(out(), "Checkpoint at block %u does not match the chain; running full verification\n", checkpoint.height);
+        } else {
+            // Cheap confirmation: the checkpointed block itself still holds
+            VerifyResult anchor = verify_blocks(fetch_block, fetch_events, NULL, checkpoint.height, checkpoint.height + 1, 1);
+            if (anchor.status != VERIFY_OK) {
+                fprintf(out(), "Integrity check failed at checkpoint block %u: %s\n", anchor.block_num,
+                               verify_status_to_string(anchor.status));
+                return 0;
+            }
+            // Blocks below it are trusted as the checkpoint recorded them
+            begin = checkpoint.height + 1;
+            memcpy(digest, checkpoint.running_digest, SHA256_BLOCK_SIZE);
+        }
+    }
+    
+    VerifyResult result = verify_blocks(fetch_block, fetch_events, NULL, begin, count, miner_get_threads());
+    if (result.status != VERIFY_OK) {
+        fprintf(out(), "Integrity check failed at block %u: %s\n", result.block_num,
+                       verify_status_to_string(result.status));
+        return 0;
+    }
     
+    if (filename) {
+        BlockIterator it;
+        const Block *block;
+        blockchain_iter_init(&it, begin, count);
+        while ((block = blockchain_iter_next(&it))) {
+            checkpoint_digest_extend(digest, block->hash);
+            memcpy(checkpoint.hash, block->hash, SHA256_BLOCK_SIZE);
+        }
+        blockchain_iter_close(&it);
+        checkpoint.height = count - 1;
+        memcpy(checkpoint.running_digest, digest, SHA256_BLOCK_SIZE);
+        checkpoint.created = time(NULL);
+        checkpoint_save(filename, &checkpoint);
+    }
+    
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    uint32_t checked = count - begin;
+    if (begin > 0) {
+        if (checked > 0) {
+            fprintf(out(), "Blockchain verified successfully! Blocks %u-%u are valid.\n", begin, count - 1);
+        } else {
+            fprintf(out(), "Blockchain verified successfully! No blocks since the checkpoint.\n");
+        }
+        fprintf(out(), "Rehashed %u block(s) after checkpoint at block %u; blocks 0-%u were trusted to it\n",
+                checked, begin - 1, begin - 1);
+    } else {
+        fprintf(out(), "Blockchain verified successfully! All %u blocks are valid.\n", blockchain->length);
+    }
+    fprintf(out(), "Verified in %.3f s (%.0f blocks/s)\n", seconds, seconds > 0 ? checked / seconds : 0.0);
     return 1;
 }
 
+static int verify_chain(const char *filename, int since_checkpoint) {
+    uint64_t start = metrics_start();
+    int valid = check_chain(filename, since_checkpoint);
+    metrics_add(METRIC_VERIFY_RUNS, 1);
+    metrics_finish(METRIC_VERIFY, start);
+    return valid;
+}
+
 // Verify blockchain integrity
 int blockchain_verify() {
-    if (!blockchain || !blockchain->head) {
-        printf("Error: Empty blockchain\n");
-        return 0;
+    return verify_chain(NULL, 0);
+}
+
+// Full verification for audits; checkpoints the tip in filename's .ckpt
+int blockchain_verify_full(const char *filename) {
+    return verify_chain(filename, 0);
+}
+
+// Rehash only the blocks appended since the last checkpoint
+int blockchain_verify_since_checkpoint(const char *filename) {
+    return verify_chain(filename, 1);
+}
+
+static void append_masked(TextBuffer *buf, const char *text, int show_first, int show_last) {
+    char *at = textbuf_reserve(buf, strlen(text) + 1);
+    textbuf_commit(buf, mask_string(text, at, show_first, show_last));
+}
+
+static void print_event(TextBuffer *buf, const InsurancePayload *event) {
+    textbuf_printf(buf, "Policy ID: %s\nMember ID: ", event->policy_id);
+    append_masked(buf, event->member_id, 3, 2);
+    textbuf_printf(buf, " (masked)\nEvent Type: %s\nProvider ID: %s\nAmount: $",
+                   event_type_to_string(event->event_type), event->provider_id);
+    textbuf_commit(buf, mask_amount(event->amount, textbuf_reserve(buf, 32)));
+    textbuf_append(buf, " (masked)\nDiagnosis Code: ");
+    append_masked(buf, event->diagnosis_code, 1, 1);
+    textbuf_printf(buf, " (masked)\nNotes: %s\n", event->notes);
+}
+
+static int event_matches(const InsurancePayload *event, IndexField field, const char *id) {
+    switch (field) {
+        case INDEX_POLICY: return strcmp(event->policy_id, id) == 0;
+        case INDEX_MEMBER: return strcmp(event->member_id, id) == 0;
+        case INDEX_PROVIDER: return strcmp(event->provider_id, id) == 0;
+        default: return 1;
+    }
+}
+
+// Format the iterator's current block with sensitive fields masked. For a
+// batch, only the events whose `field` equals id are listed when id is given
+static void print_block(TextBuffer *buf, BlockIterator *it, IndexField field, const char *id) {
+    const Block *current = &it->block;
+    char prev_hash[65], hash[65];
+    
+    textbuf_printf(buf, "--- Block %u ---\nTimestamp: ", current->block_id);
+    textbuf_time(buf, current->timestamp);
+    if (current->hash_version < HASH_VERSION_BATCH) {
+        print_event(buf, &current->payload);
+    } else {
+        char root[65];
+        InsurancePayload event;
+        bytes_to_hex(current->batch.merkle_root, SHA256_BLOCK_SIZE, root);
+        textbuf_printf(buf, "Events: %u\nMerkle Root: %s\n", current->batch.event_count, root);
+        for (uint32_t i = 0; i < current->batch.event_count; i++) {
+            if (blockchain_iter_event(it, &event) <= 0) {
+                textbuf_printf(buf, "[Events %u-%u unreadable]\n", i + 1, current->batch.event_count);
+                break;
+            }
+            if (!id || event_matches(&event, field, id)) {
+                textbuf_printf(buf, "[Event %u]\n", i + 1);
+                print_event(buf, &event);
+            }
+        }
+    }
+    format_hash(current->prev_hash, prev_hash);
+    format_hash(current->hash, hash);
+    textbuf_printf(buf, "Previous Hash: %s\nHash: %s\nNonce: %u\n\n", prev_hash, hash, current->nonce);
+}
+
+// View blocks [from, to) with masked sensitive data. Only the requested
+// blocks are touched, so a short range costs the same on any chain length
+void blockchain_view_range(uint32_t from, uint32_t to) {
+    char storage[VIEW_BUFFER_SIZE];
+    TextBuffer buf;
+    
+    if (!blockchain || blockchain->length == 0) {
+        fprintf(out(), "Blockchain is empty\n");
+        return;
     }
+    if (to > blockchain->length) to = blockchain->length;
+    if (from > to) from = to;
     
-    Block *current = blockchain->head->next;
-    int block_num = 1;
+    textbuf_init(&buf, storage, sizeof(storage), out());
+    textbuf_printf(&buf, "\n=== HEALTH INSURANCE BLOCKCHAIN ===\n");
+    textbuf_printf(&buf, "Total Blocks: %u | Difficulty: %u bits\n", blockchain->length, blockchain->difficulty);
+    if (from > 0 || to < blockchain->length) {
+        textbuf_printf(&buf, "Showing blocks %u-%u\n", from, to > from ? to - 1 : from);
+    }
+    if (pending_count > 0) {
+        textbuf_printf(&buf, "Pending Events: %u (not yet in a block)\n", pending_count);
+    }
+    textbuf_printf(&buf, "Security: Sensitive data masked in display\n\n");
     
-    while (current) {
-        char calculated_hash[65];
-        calculate_hash(current, calculated_hash);
-        
-        if (strcmp(current->hash, calculated_hash) != 0) {
-            printf("Integrity check failed at block %d: Hash mismatch\n", block_num);
+    BlockIterator it;
+    blockchain_iter_init(&it, from, to);
+    while (blockchain_iter_next(&it)) {
+        print_block(&buf, &it, INDEX_FIELD_COUNT, NULL);
+    }
+    blockchain_iter_close(&it);
+    textbuf_flush(&buf);
+}
+
+// View blockchain with masked sensitive data
+void blockchain_view() {
+    blockchain_view_range(0, UINT32_MAX);
+}
+
+static int parse_height(const char *text, uint32_t *value) {
+    char *end;
+    unsigned long parsed = strtoul(text, &end, 10);
+    if (*text == '\0' || *text == '-' || *end != '\0' || parsed > UINT32_MAX) return 0;
+    *value = (uint32_t)parsed;
+    return 1;
+}
+
+// Parse view options and show the range they select:
+//   --from H / --to H   heights, inclusive
+//   --tail N            the newest N blocks
+//   --page N            page N (from 1) of --page-size blocks, default 20
+// Returns 0 after printing usage when the options are malformed
+int blockchain_view_args(const char *args) {
+    char copy[128];
+    char *save = NULL;
+    uint32_t from = 0, to = UINT32_MAX, tail = 0, page = 0, page_size = VIEW_PAGE_SIZE;
+    int has_tail = 0;
+    
+    snprintf(copy, sizeof(copy), "%s", args);
+    for (char *opt = strtok_r(copy, " \t", &save); opt; opt = strtok_r(NULL, " \t", &save)) {
+        char *value = strtok_r(NULL, " \t", &save);
+        uint32_t n = 0;
+        if (!value || !parse_height(value, &n)) opt = "";
+        if (strcmp(opt, "--from") == 0) {
+            from = n;
+        } else if (strcmp(opt, "--to") == 0) {
+            to = n == UINT32_MAX ? n : n + 1;
+        } else if (strcmp(opt, "--tail") == 0) {
+            tail = n;
+            has_tail = 1;
+        } else if (strcmp(opt, "--page") == 0 && n > 0) {
+            page = n;
+        } else if (strcmp(opt, "--page-size") == 0 && n > 0) {
+            page_size = n;
+        } else {
+            fprintf(out(), "Usage: view [--from H] [--to H] | --tail N | --page N [--page-size K]\n");
             return 0;
         }
-        
-        Block *prev = blockchain->head;
-        for (int i = 0; i < block_num - 1; i++) {
-            prev = prev->next;
+    }
+    
+    uint32_t length = blockchain_length();
+    if (has_tail) {
+        from = tail < length ? length - tail : 0;
+        to = length;
+    } else if (page > 0) {
+        uint64_t first = (uint64_t)(page - 1) * page_size;
+        uint32_t pages = length ? (length + page_size - 1) / page_size : 0;
+        from = first < length ? (uint32_t)first : length;
+        to = first + page_size < length ? (uint32_t)(first + page_size) : length;
+        fprintf(out(), "Page %u of %u (%u blocks per page)\n", page, pages, page_size);
+    }
+    blockchain_view_range(from, to);
+    return 1;
+}
+
+// Show every event carrying an ID, found through the index
+void blockchain_history(IndexField field, const char *id) {
+    char storage[VIEW_BUFFER_SIZE];
+    TextBuffer buf;
+    
+    if (!blockchain) {
+        fprintf(out(), "Error: Blockchain not initialized\n");
+        return;
+    }
+    
+    const PostingList *postings = index_lookup(field, id);
+    const AccountTotals *totals = index_totals(field, id);
+    
+    textbuf_init(&buf, storage, sizeof(storage), out());
+    textbuf_printf(&buf, "\n=== HISTORY: %s ", index_field_to_string(field));
+    if (field == INDEX_MEMBER) {
+        append_masked(&buf, id, 3, 2);
+    } else {
+        textbuf_append(&buf, id);
+    }
+    textbuf_printf(&buf, " ===\nEvents: %u\n\n", totals ? totals->events : 0);
+    BlockIterator it;
+    blockchain_iter_init(&it, 0, 0);
+    for (uint32_t i = 0; postings && i < postings->count; i++) {
+        blockchain_iter_seek(&it, postings->heights[i], postings->heights[i] + 1);
+        if (blockchain_iter_next(&it)) print_block(&buf, &it, field, id);
+    }
+    blockchain_iter_close(&it);
+    textbuf_flush(&buf);
+}
+
+static void format_cents(int64_t cents, char *out, size_t size) {
+    snprintf(out, size, "%s%lld.%02lld", cents < 0 ? "-" : "",
+             (long long)(cents < 0 ? -cents : cents) / 100, (long long)(cents < 0 ? -cents : cents) % 100);
+}
+
+// Running totals for one policy, read from the index in O(1)
+void blockchain_summary(const char *policy_id) {
+    if (!blockchain) {
+        fprintf(out(), "Error: Blockchain not initialized\n");
+        return;
+    }
+    
+    const AccountTotals *totals = index_totals(INDEX_POLICY, policy_id);
+    if (!totals) {
+        fprintf(out(), "No events recorded for policy %s\n", policy_id);
+        return;
+    }
+    
+    char premiums[32], claimed[32], approved[32];
+    format_cents(totals->premiums_paid, premiums, sizeof(premiums));
+    format_cents(totals->claimed, claimed, sizeof(claimed));
+    format_cents(totals->approved, approved, sizeof(approved));
+    
+    fprintf(out(), "\n=== SUMMARY: policy %s ===\n", policy_id);
+    fprintf(out(), "Events: %u\n", totals->events);
+    fprintf(out(), "Premiums Paid: $%s\n", premiums);
+    fprintf(out(), "Claimed: $%s\n", claimed);
+    fprintf(out(), "Approved: $%s\n", approved);
+    fprintf(out(), "Open Preauths: %u\n\n", totals->open_preauths);
+}
+
+static void print_summary_row(const char *key, const PostingList *postings, const AccountTotals *totals, void *ctx) {
+    char shown[64];
+    char premiums[32], claimed[32], approved[32];
+    (void)postings;
+    
+    if (*(const IndexField*)ctx == INDEX_MEMBER) {
+        mask_string(key, shown, 3, 2);
+    } else {
+        snprintf(shown, sizeof(shown), "%s", key);
+    }
+    format_cents(totals->premiums_paid, premiums, sizeof(premiums));
+    format_cents(totals->claimed, claimed, sizeof(claimed));
+    format_cents(totals->approved, approved, sizeof(approved));
+    fprintf(out(), "%-31s %7u %14s %14s %14s %6u\n", shown, totals->events, premiums, claimed, approved,
+                   totals->open_preauths);
+}
+
+// Totals for every policy and member; costs one row per ID, not per block
+void blockchain_summary_all() {
+    if (!blockchain) {
+        fprintf(out(), "Error: Blockchain not initialized\n");
+        return;
+    }
+    
+    IndexField fields[] = { INDEX_POLICY, INDEX_MEMBER };
+    for (int i = 0; i < 2; i++) {
+        fprintf(out(), "\n=== %s SUMMARY (%u) ===\n", i == 0 ? "POLICY" : "MEMBER", index_key_count(fields[i]));
+        fprintf(out(), "%-31s %7s %14s %14s %14s %6s\n", i == 0 ? "Policy ID" : "Member ID (masked)", "Events",
+                       "Premiums", "Claimed", "Approved", "Open");
+        index_foreach(fields[i], print_summary_row, &fields[i]);
+    }
+    fprintf(out(), "\n");
+}
+
+static const char *query_fields[DICT_FIELD_COUNT] = { "policy", "member", "provider", "diagnosis" };
+
+// Midnight (local time) starting a YYYY-MM-DD date
+static int parse_date(const char *text, int64_t *value) {
+    struct tm tm;
+    char extra;
+    
+    memset(&tm, 0, sizeof(tm));
+    if (sscanf(text, "%d-%d-%d%c", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &extra) != 3) return 0;
+    if (tm.tm_mon < 1 || tm.tm_mon > 12 || tm.tm_mday < 1 || tm.tm_mday > 31) return 0;
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+    time_t t = mktime(&tm);
+    if (t == (time_t)-1) return 0;
+    *value = (int64_t)t;
+    return 1;
+}
+
+typedef struct {
+    uint32_t key;
+    ColumnTotals totals;
+} QueryRow;
+
+static int compare_query_rows(const void *a, const void *b) {
+    const QueryRow *x = (const QueryRow*)a;
+    const QueryRow *y = (const QueryRow*)b;
+    if (x->totals.cents != y->totals.cents) return x->totals.cents > y->totals.cents ? -1 : 1;
+    return x->key < y->key ? -1 : x->key > y->key;
+}
+
+static void print_query_groups(ColumnGroup group, ColumnTotals *groups, uint32_t group_count) {
+    QueryRow *rows = (QueryRow*)malloc((group_count ? group_count : 1) * sizeof(QueryRow));
+    uint32_t count = 0;
+    
+    if (!rows) {
+        fprintf(out(), "Error: Out of memory\n");
+        return;
+    }
+    for (uint32_t key = 0; key < group_count; key++) {
+        if (groups[key].events == 0) continue;
+        rows[count].key = key;
+        rows[count].totals = groups[key];
+        count++;
+    }
+    qsort(rows, count, sizeof(QueryRow), compare_query_rows);
+    
+    static const char *headings[] = {
+        "", "Event Type", "Policy ID", "Member ID (masked)", "Provider ID", "Diagnosis Code"
+    };
+    fprintf(out(), "\n%-31s %9s %16s\n", headings[group], "Events", "Amount");
+    for (uint32_t i = 0; i < count; i++) {
+        char shown[64], amount[32];
+        const char *key;
+        if (group == COLUMN_GROUP_TYPE) {
+            key = event_type_to_string((EventType)rows[i].key);
+        } else {
+            key = dict_string((DictField)(group - COLUMN_GROUP_POLICY), rows[i].key, NULL);
+            if (!key) key = "?";
+            if (!*key) key = "(none)";
+        }
+        if (group == COLUMN_GROUP_MEMBER && rows[i].key != 0) {
+            mask_string(key, shown, 3, 2);
+        } else {
+            snprintf(shown, sizeof(shown), "%s", key);
         }
-        if (strcmp(current->prev_hash, prev->hash) != 0) {
-            printf("Integrity check failed at block %d: Chain linkage broken\n", block_num);
+        format_cents(rows[i].totals.cents, amount, sizeof(amount));
+        fprintf(out(), "%-31s %9llu %16s\n", shown, (unsigned long long)rows[i].totals.events, amount);
+    }
+    free(rows);
+}
+
+// Count and sum events straight from the query columns:
+//   type=T policy=ID member=ID provider=ID diagnosis=CODE   filters
+//   from=YYYY-MM-DD to=YYYY-MM-DD                           block dates, to exclusive
+//   by=type|policy|member|provider|diagnosis                one row per value
+// or write the columns to a file with --export <file>. Returns 0 after
+// printing usage when the options are malformed
+int blockchain_query_args(const char *args) {
+    char copy[512];
+    char *save = NULL;
+    ColumnQuery query;
+    int unknown = 0;
+    
+    if (!blockchain) {
+        fprintf(out(), "Error: Blockchain not initialized\n");
+        return 1;
+    }
+    
+    snprintf(copy, sizeof(copy), "%s", args);
+    char *opt = strtok_r(copy, " \t", &save);
+    if (opt && strcmp(opt, "--export") == 0) {
+        char *path = strtok_r(NULL, " \t", &save);
+        if (!path || strtok_r(NULL, " \t", &save)) {
+            fprintf(out(), "Usage: query --export <file>\n");
             return 0;
         }
-        
-        char target[65] = {0};
-        for (uint32_t i = 0; i < blockchain->difficulty; i++) {
-            target[i] = '0';
+        if (!columns_export(path)) {
+            fprintf(out(), "Error: Could not export the query columns to %s\n", path);
+            return 1;
+        }
+        fprintf(out(), "Exported %u events to %s\n", columns_rows(), path);
+        return 1;
+    }
+    
+    columns_query_init(&query);
+    for (; opt; opt = strtok_r(NULL, " \t", &save)) {
+        char *value = strchr(opt, '=');
+        int valid = 1;
+        if (!value || value[1] == '\0') {
+            opt = "";
+        } else {
+            *value++ = '\0';
         }
         
-        current = current->next;
-        block_num++;
+        int field = -1;
+        for (int i = 0; i < DICT_FIELD_COUNT; i++) {
+            if (strcmp(opt, query_fields[i]) == 0) field = i;
+        }
+        if (field >= 0) {
+            uint32_t key = dict_find((DictField)field, value, strlen(value));
+            if (key == DICT_NONE) unknown = 1;
+            query.keys[field] = key;
+        } else if (strcmp(opt, "type") == 0) {
+            EventType type = string_to_event_type(value);
+            valid = strcmp(event_type_to_string(type), value) == 0;
+            query.event_type = type;
+        } else if (strcmp(opt, "from") == 0) {
+            valid = parse_date(value, &query.from);
+        } else if (strcmp(opt, "to") == 0) {
+            valid = parse_date(value, &query.to);
+        } else if (strcmp(opt, "by") == 0) {
+            query.group = COLUMN_GROUP_NONE;
+            if (strcmp(value, "type") == 0) query.group = COLUMN_GROUP_TYPE;
+            for (int i = 0; i < DICT_FIELD_COUNT; i++) {
+                if (strcmp(value, query_fields[i]) == 0) query.group = (ColumnGroup)(COLUMN_GROUP_POLICY + i);
+            }
+            valid = query.group != COLUMN_GROUP_NONE;
+        } else {
+            valid = 0;
+        }
+        if (!valid) {
+            fprintf(out(), "Usage: query [type=T] [policy|member|provider|diagnosis=ID] [from=DATE] [to=DATE] "
+                           "[by=type|policy|member|provider|diagnosis] | --export <file>\n");
+            return 0;
+        }
     }
     
-    printf("Blockchain verified successfully! All %u blocks are valid.\n", blockchain->length);
+    ColumnTotals total = { 0, 0 };
+    ColumnTotals *groups = NULL;
+    uint32_t group_count = 0;
+    if (!unknown && !columns_query(&query, &total, &groups, &group_count)) {
+        fprintf(out(), "Error: Out of memory\n");
+        return 1;
+    }
+    
+    char amount[32];
+    format_cents(total.cents, amount, sizeof(amount));
+    fprintf(out(), "\n=== QUERY (%u events scanned) ===\n", columns_rows());
+    fprintf(out(), "Events: %llu\n", (unsigned long long)total.events);
+    fprintf(out(), "Total Amount: $%s\n", amount);
+    if (groups) print_query_groups(query.group, groups, group_count);
+    fprintf(out(), "\n");
+    free(groups);
     return 1;
 }
 
-// View blockchain with masked sensitive data
-void blockchain_view() {
-    if (!blockchain || !blockchain->head) {
-        printf("Blockchain is empty\n");
-        return;
+// Upper bounds, in days, of the aging report's buckets; one more bucket
+// catches the rest
+static const uint32_t aging_days[] = { 30, 60, 90, 180 };
+#define AGING_BUCKETS (sizeof(aging_days) / sizeof(aging_days[0]) + 1)
+
+typedef struct {
+    TextBuffer *buf;
+    int64_t now;
+    ClaimTotals aging[AGING_BUCKETS];
+} ClaimReport;
+
+// What an open claim stands to cost: the claim, or the preauth estimate
+static int64_t open_amount(const Claim *claim) {
+    return claim->state == CLAIM_PREAUTHORIZED ? claim->requested : claim->claimed;
+}
+
+static uint32_t claim_age_days(const Claim *claim, int64_t now) {
+    return claim->opened < now ? (uint32_t)((now - claim->opened) / 86400) : 0;
+}
+
+static void print_open_claim(const Claim *claim, void *ctx) {
+    ClaimReport *report = (ClaimReport*)ctx;
+    const char *ids[DICT_FIELD_COUNT];
+    char member[64], diagnosis[32], amount[32], opened[16];
+    time_t when = (time_t)claim->opened;
+    struct tm tm;
+    
+    for (int field = 0; field < DICT_FIELD_COUNT; field++) {
+        ids[field] = dict_string((DictField)field, claim->keys[field], NULL);
+        if (!ids[field]) ids[field] = "?";
     }
+    mask_string(ids[DICT_MEMBER], member, 3, 2);
+    mask_string(ids[DICT_DIAGNOSIS], diagnosis, 1, 1);
+    format_cents(open_amount(claim), amount, sizeof(amount));
+    strftime(opened, sizeof(opened), "%Y-%m-%d", localtime_r(&when, &tm));
+    textbuf_printf(report->buf, "%-16s %-18s %-16s %-10s %-13s %12s %10s %6u\n", ids[DICT_POLICY], member,
+                   ids[DICT_PROVIDER], diagnosis, claim_state_to_string((ClaimState)claim->state), amount, opened,
+                   claim_age_days(claim, report->now));
+}
+
+static void age_open_claim(const Claim *claim, void *ctx) {
+    ClaimReport *report = (ClaimReport*)ctx;
+    uint32_t days = claim_age_days(claim, report->now);
+    size_t bucket = 0;
     
-    printf("\n=== HEALTH INSURANCE BLOCKCHAIN ===\n");
-    printf("Total Blocks: %u | Difficulty: %u\n", blockchain->length, blockchain->difficulty);
-    printf("Security: Sensitive data masked in display\n\n");
+    while (bucket < AGING_BUCKETS - 1 && days > aging_days[bucket]) bucket++;
+    report->aging[bucket].count++;
+    report->aging[bucket].claimed += open_amount(claim);
+}
+
+// Claims linked from preauths, submissions and decisions:
+//   claims          claims and amounts in each state
+//   claims open     every open claim, oldest first
+//   claims aging    open claims by age in days
+// The last two cost time in the number of open claims. Returns 0 after
+// printing usage when the arguments are malformed
+int blockchain_claims_args(const char *args) {
+    char storage[VIEW_BUFFER_SIZE];
+    char report_name[16] = "";
+    char extra[2];
+    TextBuffer buf;
+    ClaimReport report;
     
-    Block *current = blockchain->head;
-    while (current) {
-        char masked_member_id[64];
-        char masked_diagnosis[32];
-        char masked_amount[32];
-        
-        mask_string(current->payload.member_id, masked_member_id, 3, 2);
-        mask_string(current->payload.diagnosis_code, masked_diagnosis, 1, 1);
-        mask_amount(current->payload.amount, masked_amount);
-        
-        printf("--- Block %u ---\n", current->block_id);
-        printf("Timestamp: %s", ctime(&current->timestamp));
-        printf("Policy ID: %s\n", current->payload.policy_id);
-        printf("Member ID: %s (masked)\n", masked_member_id);
-        printf("Event Type: %s\n", event_type_to_string(current->payload.event_type));
-        printf("Provider ID: %s\n", current->payload.provider_id);
-        printf("Amount: $%s (masked)\n", masked_amount);
-        printf("Diagnosis Code: %s (masked)\n", masked_diagnosis);
-        printf("Notes: %s\n", current->payload.notes);
-        printf("Previous Hash: %s\n", current->prev_hash);
-        printf("Hash: %s\n", current->hash);
-        printf("Nonce: %u\n\n", current->nonce);
-        
-        current = current->next;
+    if (!blockchain) {
+        fprintf(out(), "Error: Blockchain not initialized\n");
+        return 1;
     }
+    int words = sscanf(args, "%15s %1s", report_name, extra);
+    if (words > 1 || (words == 1 && strcmp(report_name, "open") != 0 && strcmp(report_name, "aging") != 0)) {
+        fprintf(out(), "Usage: claims [open | aging]\n");
+        return 0;
+    }
+    
+    memset(&report, 0, sizeof(report));
+    report.buf = &buf;
+    report.now = (int64_t)time(NULL);
+    textbuf_init(&buf, storage, sizeof(storage), out());
+    if (words <= 0) {
+        ClaimTotals totals[CLAIM_STATE_COUNT];
+        claims_totals(totals);
+        textbuf_printf(&buf, "\n=== CLAIMS (%u open) ===\n", claims_open_count());
+        textbuf_printf(&buf, "%-16s %9s %16s %16s\n", "State", "Claims", "Claimed", "Approved");
+        for (int state = 0; state < CLAIM_STATE_COUNT; state++) {
+            char claimed[32], approved[32];
+            format_cents(totals[state].claimed, claimed, sizeof(claimed));
+            format_cents(totals[state].approved, approved, sizeof(approved));
+            textbuf_printf(&buf, "%-16s %9llu %16s %16s\n", claim_state_to_string((ClaimState)state),
+                           (unsigned long long)totals[state].count, claimed, approved);
+        }
+        textbuf_printf(&buf, "Decisions without an open claim: %llu\n", (unsigned long long)claims_unmatched());
+    } else if (strcmp(report_name, "open") == 0) {
+        textbuf_printf(&buf, "\n=== OPEN CLAIMS (%u) ===\n", claims_open_count());
+        textbuf_printf(&buf, "%-16s %-18s %-16s %-10s %-13s %12s %10s %6s\n", "Policy ID", "Member (masked)",
+                       "Provider ID", "Diagnosis", "State", "Amount", "Opened", "Days");
+        claims_foreach_open(print_open_claim, &report);
+    } else {
+        claims_foreach_open(age_open_claim, &report);
+        textbuf_printf(&buf, "\n=== CLAIM AGING (%u open) ===\n", claims_open_count());
+        textbuf_printf(&buf, "%-16s %9s %16s\n", "Age (days)", "Claims", "Amount");
+        for (size_t bucket = 0; bucket < AGING_BUCKETS; bucket++) {
+            char range[16], amount[32];
+            if (bucket < AGING_BUCKETS - 1) {
+                snprintf(range, sizeof(range), "%u-%u", bucket ? aging_days[bucket - 1] + 1 : 0, aging_days[bucket]);
+            } else {
+                snprintf(range, sizeof(range), "over %u", aging_days[bucket - 1]);
+            }
+            format_cents(report.aging[bucket].claimed, amount, sizeof(amount));
+            textbuf_printf(&buf, "%-16s %9llu %16s\n", range, (unsigned long long)report.aging[bucket].count, amount);
+        }
+    }
+    textbuf_append(&buf, "\n");
+    textbuf_flush(&buf);
+    return 1;
 }
 
-// Save blockchain to file
-void blockchain_save(const char *filename) {
-    FILE *fp = fopen(filename, "wb");
-    if (!fp) {
-        printf("Error: Could not open file for writing\n");
-        return;
+// Files before version 4 do not record per-block difficulty. It followed a
+// fixed rotation: genesis and block 1 share the initial difficulty, each
+// later block is one hex digit (4 bits) harder mod 24, and the stored
+// value is the difficulty the next block would have used
+static uint32_t legacy_block_difficulty(uint32_t stored, uint32_t length, uint32_t index) {
+    int64_t initial = (int64_t)stored - 4 * (int64_t)(length - 1);
+    int64_t steps = index > 0 ? index - 1 : 0;
+    return (uint32_t)((((initial + 4 * steps) % 24) + 24) % 24);
+}
+
+// Read one block of a whole-file chain. Returns 0 on a short read
+static int read_legacy_block(FILE *fp, uint32_t version, Block *block) {
+    char prev_hash[65], hash[65];
+    
+    memset(block, 0, sizeof(*block));
+    block->hash_version = HASH_VERSION_TEXT;
+    if (fread(&block->block_id, sizeof(uint32_t), 1, fp) != 1 ||
+        (version >= 2 && fread(&block->hash_version, sizeof(uint32_t), 1, fp) != 1) ||
+        (version >= 4 && fread(&block->difficulty, sizeof(uint32_t), 1, fp) != 1) ||
+        fread(&block->timestamp, sizeof(time_t), 1, fp) != 1 ||
+        fread(&block->payload, sizeof(InsurancePayload), 1, fp) != 1 ||
+        fread(prev_hash, sizeof(char), 65, fp) != 65 || fread(hash, sizeof(char), 65, fp) != 65 ||
+        fread(&block->nonce, sizeof(uint32_t), 1, fp) != 1) {
+        return 0;
     }
     
-    fwrite(&blockchain->difficulty, sizeof(uint32_t), 1, fp);
-    fwrite(&blockchain->length, sizeof(uint32_t), 1, fp);
+    // Hashes were stored as hex; genesis linked to "0", i.e. all zeros
+    prev_hash[64] = hash[64] = '\0';
+    if (!hex_to_bytes(prev_hash, block->prev_hash, SHA256_BLOCK_SIZE)) memset(block->prev_hash, 0, SHA256_BLOCK_SIZE);
+    if (!hex_to_bytes(hash, block->hash, SHA256_BLOCK_SIZE)) memset(block->hash, 0, SHA256_BLOCK_SIZE);
+    return 1;
+}
+
+// Read a whole-file chain written before the segment log existed. Every
+// block is read before the current chain is replaced, so a truncated or
+// damaged file fails the load and leaves the chain as it was
+static int load_chain_file(const char *filename) {
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) return 0;
+    
+    uint32_t magic = 0;
+    uint32_t version = 1;
+    if (fread(&magic, sizeof(uint32_t), 1, fp) != 1) {
+        fprintf(out(), "Error: %s is empty or unreadable\n", filename);
+        fclose(fp);
+        return 0;
+    }
+    if (magic == CHAIN_FILE_MAGIC) {
+        if (fread(&version, sizeof(uint32_t), 1, fp) != 1 || version > CHAIN_FILE_VERSION) {
+            fprintf(out(), "Error: %s uses unsupported format version %u\n", filename, version);
+            fclose(fp);
+            return 0;
+        }
+    } else {
+        // Legacy file: the first word was the difficulty
+        rewind(fp);
+    }
     
-    Block *current = blockchain->head;
-    while (current) {
-        fwrite(&current->block_id, sizeof(uint32_t), 1, fp);
-        fwrite(&current->timestamp, sizeof(time_t), 1, fp);
-        fwrite(&current->payload, sizeof(InsurancePayload), 1, fp);
-        fwrite(current->prev_hash, sizeof(char), 65, fp);
-        fwrite(current->hash, sizeof(char), 65, fp);
-        fwrite(&current->nonce, sizeof(uint32_t), 1, fp);
-        current = current->next;
+    uint32_t difficulty, stored;
+    long start = -1, file_size = -1;
+    if (fread(&difficulty, sizeof(uint32_t), 1, fp) == 1 && fread(&stored, sizeof(uint32_t), 1, fp) == 1) {
+        start = ftell(fp);
+        if (fseek(fp, 0, SEEK_END) == 0) file_size = ftell(fp);
+    }
+    size_t block_size = sizeof(uint32_t) * (version >= 4 ? 4 : version >= 2 ? 3 : 2) + sizeof(time_t) +
+                        sizeof(InsurancePayload) + 2 * 65;
+    if (start < 0 || file_size < start || fseek(fp, start, SEEK_SET) != 0 ||
+        (uint64_t)stored * block_size != (uint64_t)(file_size - start)) {
+        fprintf(out(), "Error: %s is truncated or damaged\n", filename);
+        fclose(fp);
+        return 0;
+    }
+    if (version < 3) {
+        // Older files count difficulty in hex digits
+        difficulty *= 4;
     }
     
+    Block *blocks = (Block*)malloc((stored ? stored : 1) * sizeof(Block));
+    uint32_t read = 0;
+    while (blocks && read < stored && read_legacy_block(fp, version, &blocks[read])) {
+        if (version < 4) blocks[read].difficulty = legacy_block_difficulty(difficulty, stored, read);
+        read++;
+    }
+    metrics_add(METRIC_BYTES_LOADED, (uint64_t)ftell(fp));
     fclose(fp);
-    printf("Blockchain saved to %s\n", filename);
+    if (!blocks || read < stored) {
+        fprintf(out(), blocks ? "Error: %s is truncated at block %u\n" : "Error: Out of memory reading %s\n",
+                filename, read);
+        free(blocks);
+        return 0;
+    }
+    
+    blockchain_cleanup();
+    blockchain = chain_new(difficulty);
+    dict_reset();
+    for (uint32_t i = 0; i < stored; i++) {
+        uint32_t length = encode_record(&blocks[i], NULL);
+        if (length == 0 || !link_record(i, encode_buffer, length)) {
+            fprintf(out(), "Error: Out of memory reading block %u\n", i);
+            free(blocks);
+            blockchain_cleanup();
+            return 0;
+        }
+        blockchain->length++;
+    }
+    free(blocks);
+    return 1;
 }
 
-// Load blockchain from file
-void blockchain_load(const char *filename) {
-    FILE *fp = fopen(filename, "rb");
-    if (!fp) {
-        printf("No existing blockchain found. Starting fresh.\n");
+// Append every block the log does not hold yet
+static uint32_t append_unsaved_blocks() {
+    uint32_t appended = 0;
+    
+    for (uint32_t height = store_count(store); height < blockchain->length; height++) {
+        if (!persist_locked(height)) break;
+        appended++;
+    }
+    return appended;
+}
+
+// First save of this chain to filename. The whole chain goes to a log
+// built beside it, <filename>.new, which is synced and only then renamed
+// into place, so a crash part way leaves nothing under filename. A log
+// already there is never replaced, nor a whole-file chain the log would
+// hide, unless it is the one being imported: it must be loaded first. The
+// caller holds the write lock
+static int attach_new_log(const char *filename, int importing) {
+    char work[520];
+    
+    if (store_exists(filename) || (!importing && access(filename, F_OK) == 0)) {
+        fprintf(out(), "Error: %s holds a chain this session has not loaded; load it first\n", filename);
+        return 0;
+    }
+    if (store && !unmap_blocks()) {
+        fprintf(out(), "Error: Could not read blocks from %s\n", store_path(store));
+        return 0;
+    }
+    snprintf(work, sizeof(work), "%s.new", filename);
+    store_remove(work);
+    ChainStore *previous = store;
+    store = store_open(work, 1);
+    if (!store) {
+        store = previous;
+        fprintf(out(), "Error: Could not open file for writing\n");
+        return 0;
+    }
+    
+    append_unsaved_blocks();
+    if (store_count(store) != blockchain->length || !store_sync(store) || !store_rename(store, filename)) {
+        store_close(store);
+        store_remove(work);
+        store = previous;
+        fprintf(out(), "Error: Could not write the chain to %s\n", filename);
+        return 0;
+    }
+    store_close(previous);
+    snapshot_remove(filename);
+    snapshot_height = 0;
+    cache_clear();
+    if (cache_capacity() > 0) store_set_mapped(store, 0);
+    return 1;
+}
+
+static void save_chain(const char *filename) {
+    if (!blockchain) {
+        fprintf(out(), "Error: Blockchain not initialized\n");
         return;
     }
     
-    blockchain = (Blockchain*)malloc(sizeof(Blockchain));
-    fread(&blockchain->difficulty, sizeof(uint32_t), 1, fp);
-    fread(&blockchain->length, sizeof(uint32_t), 1, fp);
-    
-    Block *prev = NULL;
-    for (uint32_t i = 0; i < blockchain->length; i++) {
-        Block *block = (Block*)malloc(sizeof(Block));
-        fread(&block->block_id, sizeof(uint32_t), 1, fp);
-        fread(&block->timestamp, sizeof(time_t), 1, fp);
-        fread(&block->payload, sizeof(InsurancePayload), 1, fp);
-        fread(block->prev_hash, sizeof(char), 65, fp);
-        fread(block->hash, sizeof(char), 65, fp);
-        fread(&block->nonce, sizeof(uint32_t), 1, fp);
-        block->next = NULL;
+    // A partial batch is sealed rather than left behind in memory
+    blockchain_seal_batch(NULL, 1);
+    
+    pthread_rwlock_wrlock(&chain_lock);
+    uint32_t before = 0;
+    if (!store || strcmp(store_path(store), filename) != 0) {
+        if (!attach_new_log(filename, 0)) {
+            pthread_rwlock_unlock(&chain_lock);
+            return;
+        }
+    } else {
+        before = store_count(store);
+    }
+    
+    append_unsaved_blocks();
+    uint32_t appended = store_count(store) - before;
+    int saved = store_sync(store) && store_count(store) == blockchain->length;
+    if (saved) {
+        snapshot_if_due();
+        release_saved_records(1);
+    }
+    pthread_rwlock_unlock(&chain_lock);
+    if (!saved) {
+        fprintf(out(), "Error: Blockchain only partially saved to %s\n", filename);
+        return;
+    }
+    fprintf(out(), "Blockchain saved to %s (%u new block(s))\n", filename, appended);
+}
+
+// Save blockchain to file
+void blockchain_save(const char *filename) {
+    uint64_t start = metrics_start();
+    save_chain(filename);
+    metrics_finish(METRIC_SAVE, start);
+}
+
+// Restore the indexes, columns and event count from the newest snapshot
+// that still matches the chain. Returns the height it covers, 0 when
+// there is none and everything must be rebuilt
+static uint32_t restore_snapshot(const char *filename) {
+    for (uint32_t generation = 0; generation < SNAPSHOT_GENERATIONS; generation++) {
+        Snapshot snapshot;
+        Block block;
+        if (!snapshot_read(filename, generation, &snapshot)) continue;
         
-        if (i == 0) {
-            blockchain->head = block;
-        } else {
-            prev->next = block;
+        uint32_t height = snapshot.info.height;
+        int usable = height > 0 && height <= blockchain->length && blockchain_read_block(height - 1, &block) &&
+                     memcmp(block.hash, snapshot.info.tip_hash, SHA256_BLOCK_SIZE) == 0;
+        index_reset();
+        columns_reset();
+        claims_reset();
+        if (usable && snapshot_restore(&snapshot)) {
+            blockchain->event_count = snapshot.info.event_count;
+            snapshot_free(&snapshot);
+            return height;
         }
-        prev = block;
+        snapshot_free(&snapshot);
+        index_reset();
+        columns_reset();
+        claims_reset();
+    }
+    return 0;
+}
+
+// Load blockchain from file. Returns 0 when a chain exists there but
+// could not be loaded; finding none is not an error
+int blockchain_load(const char *filename) {
+    // Loading replaces the chain, which would drop an open batch
+    if (pending_count > 0) {
+        fprintf(out(), "Error: %u event(s) wait in an open batch; save to seal them before loading\n", pending_count);
+        return 0;
+    }
+    if (!store_exists(filename)) {
+        if (access(filename, F_OK) != 0) {
+            fprintf(out(), "No existing blockchain found. Starting fresh.\n");
+            return 1;
+        }
+        if (!load_chain_file(filename)) {
+            fprintf(out(), "Error: Could not read %s\n", filename);
+            return 0;
+        }
+        rebuild_indexes(0);
+        
+        // One-time import of the old whole-file format into the log; the
+        // file is only moved aside once the log holds every block
+        char imported[520];
+        snprintf(imported, sizeof(imported), "%s.imported", filename);
+        pthread_rwlock_wrlock(&chain_lock);
+        int attached = attach_new_log(filename, 1);
+        pthread_rwlock_unlock(&chain_lock);
+        if (!attached) return 0;
+        if (rename(filename, imported) == 0) {
+            fprintf(out(), "Imported %u blocks from legacy file (kept as %s)\n", blockchain->length, imported);
+        }
+        return 1;
     }
-    blockchain->tail = prev;
     
-    fclose(fp);
-    printf("Blockchain loaded from %s (%u blocks)\n", filename, blockchain->length);
+    // Logs from before the compact format are rewritten once
+    if (store_needs_upgrade(filename) && !store_upgrade(filename)) {
+        fprintf(out(), "Error: Could not upgrade %s\n", filename);
+        return 0;
+    }
+    
+    ChainStore *opened = store_open(filename, 0);
+    if (!opened) {
+        fprintf(out(), "Error: Could not open %s\n", filename);
+        return 0;
+    }
+    
+    blockchain_cleanup();
+    store = opened;
+    blockchain = chain_new(0);
+    
+    // Nothing is copied here: blocks are decoded from the mapped log
+    // whenever they are needed
+    blockchain->mapped = store_count(store);
+    blockchain->length = blockchain->mapped;
+    
+    Block tip;
+    if (blockchain->length > 0 && blockchain_read_block(blockchain->length - 1, &tip)) {
+        blockchain->difficulty = tip.difficulty;
+    }
+    retarget_reset();
+    
+    snapshot_height = restore_snapshot(filename);
+    rebuild_indexes(snapshot_height);
+    
+    // The load reads through the mapping, which is dropped here so those
+    // pages leave the process
+    if (cache_capacity() > 0) store_set_mapped(store, 0);
+    metrics_add(METRIC_BYTES_LOADED, store_disk_bytes(filename));
+    fprintf(out(), "Blockchain loaded from %s (%u blocks)\n", filename, blockchain->length);
+    if (snapshot_height > 0) {
+        fprintf(out(), "Indexes restored from the snapshot at height %u; replayed %u block(s)\n",
+                snapshot_height, blockchain->length - snapshot_height);
+    }
+    return 1;
 }
 
 // Cleanup blockchain memory
 void blockchain_cleanup() {
     if (!blockchain) return;
     
-    Block *current = blockchain->head;
-    while (current) {
-        Block *temp = current;
-        current = current->next;
-        free(temp);
+    snapshot_wait();  // its writer has its own copy, but finish before exiting
+    cache_clear();
+    for (uint32_t i = 0; i < blockchain->page_slots; i++) {
+        free(blockchain->pages[i]);
+    }
+    free(blockchain->pages);
+    for (uint32_t i = 0; i < blockchain->chunk_count; i++) {
+        free(blockchain->chunks[i]);
     }
+    free(blockchain->chunks);
     free(blockchain);
+    free(encode_buffer);
+    encode_buffer = NULL;
+    encode_capacity = 0;
+    index_reset();
+    claims_reset();
+    if (pending_count > 0) {
+        fprintf(out(), "Discarded %u unsealed event(s)\n", pending_count);
+        pending_count = 0;
+    }
     blockchain = NULL;
+    store_close(store);
+    store = NULL;
+}
+
+// Send this thread's reports to fp, or back to stdout when fp is NULL
+void blockchain_set_output(FILE *fp) {
+    output = fp;
+}
+
+// Hold off the writer while reading; view, history, summary and verify
+// may then run on any number of threads at once
+void blockchain_read_lock() {
+    pthread_rwlock_rdlock(&chain_lock);
+}
+
+void blockchain_read_unlock() {
+    pthread_rwlock_unlock(&chain_lock);
 }
 
 Blockchain* blockchain_get_instance() {
     return blockchain;
-}
\ No newline at end of file
+}
+
+uint32_t blockchain_length() {
+    return blockchain ? blockchain->length : 0;
+}
+
+// Bytes held in memory for the chain's records: the arena, the page table
+// and the block cache
+size_t blockchain_resident_bytes() {
+    if (!blockchain) return 0;
+    CacheStatus cache;
+    cache_status(&cache);
+    size_t bytes = blockchain->arena_bytes + blockchain->page_slots * sizeof(RecordRef*) + dict_bytes() +
+                   columns_bytes() + cache.bytes;
+    for (uint32_t i = 0; i < blockchain->page_slots; i++) {
+        if (blockchain->pages[i]) bytes += BLOCK_PAGE_SIZE * sizeof(RecordRef);
+    }
+    return bytes;
+}
+
+// O(1) lookup by height, decoding the header from memory or the mapped log
+int blockchain_read_block(uint32_t height, Block *block) {
+    StoreRecord record = { 0 };
+    int ok = read_record(height, &record) && codec_decode_block(record.data, record.data + record.length, block);
+    store_release(&record);
+    return ok;
+}
+
+uint32_t blockchain_block_event_count(const Block *block) {
+    return block->hash_version >= HASH_VERSION_BATCH ? block->batch.event_count : 1;
+}
+
+// Iterate blocks [from, to), clamped to the chain length
+void blockchain_iter_init(BlockIterator *it, uint32_t from, uint32_t to) {
+    memset(it, 0, sizeof(*it));
+    blockchain_iter_seek(it, from, to);
+}
+
+// Move to blocks [from, to), keeping the iterator's buffer
+void blockchain_iter_seek(BlockIterator *it, uint32_t from, uint32_t to) {
+    uint32_t length = blockchain_length();
+    it->end = to < length ? to : length;
+    it->height = from;
+    it->events_left = 0;
+}
+
+// Decode the next block; it and its events stay valid until the next call
+const Block* blockchain_iter_next(BlockIterator *it) {
+    if (it->height >= it->end) return NULL;
+    uint32_t height = it->height++;
+    
+    const uint8_t *events = NULL;
+    const uint8_t *end = NULL;
+    if (read_record(height, &it->record)) {
+        end = it->record.data + it->record.length;
+        events = codec_decode_block(it->record.data, end, &it->block);
+    }
+    if (!events) {
+        fprintf(out(), "Error: Block %u is unreadable\n", height);
+        it->events_left = 0;
+        return NULL;
+    }
+    it->events = events;
+    it->events_end = end;
+    it->events_left = blockchain_block_event_count(&it->block);
+    return &it->block;
+}
+
+// Next event of the current block: its own payload, or the next of its
+// batch. Returns 1 with an event, 0 after the last, -1 if one is damaged
+int blockchain_iter_event(BlockIterator *it, InsurancePayload *event) {
+    if (it->events_left == 0) return 0;
+    it->events_left--;
+    if (it->block.hash_version < HASH_VERSION_BATCH) {
+        *event = it->block.payload;
+        return 1;
+    }
+    it->events = codec_decode_event(it->events, it->events_end, event);
+    if (!it->events) {
+        it->events_left = 0;
+        return -1;
+    }
+    return 1;
+}
+
+void blockchain_iter_close(BlockIterator *it) {
+    store_release(&it->record);
+}
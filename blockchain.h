@@ -4,16 +4,63 @@
 #ifndef BLOCKCHAIN_H
 #define BLOCKCHAIN_H
 
+#include <stdio.h>
 #include <stdint.h>
 #include "insurance_types.h"
+#include "index.h"
+#include "storage.h"
+
+// Cursor over blocks [height, end), decoding one record at a time
+typedef struct {
+    uint32_t height;
+    uint32_t end;
+    Block block;                // the block last returned
+    StoreRecord record;         // its record, when it had to be read
+    const uint8_t *events;      // its next encoded event
+    const uint8_t *events_end;
+    uint32_t events_left;
+} BlockIterator;
 
 void blockchain_init(uint32_t difficulty);
 int blockchain_add_block(InsurancePayload payload);
+int blockchain_submit_event(const InsurancePayload *payload, Block *sealed);
+int blockchain_seal_batch(Block *sealed, int verbose);
+void blockchain_seal_if_due();
+void blockchain_set_batching(uint32_t max_events, uint32_t max_wait_seconds);
+uint32_t blockchain_pending_events();
+int blockchain_persist_block(uint32_t height);
+int blockchain_snapshot();
+int blockchain_is_attached();
+int blockchain_attach(const char *filename);
+void blockchain_set_difficulty(uint32_t zero_bits);
+void blockchain_set_block_time(double seconds);
+int blockchain_set_block_cache(uint32_t blocks);
 int blockchain_verify();
+int blockchain_verify_full(const char *filename);
+int blockchain_verify_since_checkpoint(const char *filename);
 void blockchain_view();
+void blockchain_view_range(uint32_t from, uint32_t to);
+int blockchain_view_args(const char *args);
+void blockchain_history(IndexField field, const char *id);
+void blockchain_summary(const char *policy_id);
+void blockchain_summary_all();
+int blockchain_query_args(const char *args);
+int blockchain_claims_args(const char *args);
 void blockchain_save(const char *filename);
-void blockchain_load(const char *filename);
+int blockchain_load(const char *filename);
 void blockchain_cleanup();
+void blockchain_set_output(FILE *fp);
+void blockchain_read_lock();
+void blockchain_read_unlock();
 Blockchain* blockchain_get_instance();
+uint32_t blockchain_length();
+size_t blockchain_resident_bytes();
+int blockchain_read_block(uint32_t height, Block *block);
+uint32_t blockchain_block_event_count(const Block *block);
+void blockchain_iter_init(BlockIterator *it, uint32_t from, uint32_t to);
+void blockchain_iter_seek(BlockIterator *it, uint32_t from, uint32_t to);
+const Block* blockchain_iter_next(BlockIterator *it);
+int blockchain_iter_event(BlockIterator *it, InsurancePayload *event);
+void blockchain_iter_close(BlockIterator *it);
 
 #endif // BLOCKCHAIN_H
\ No newline at end of file
@@ -0,0 +1,221 @@
+// LRU Block Record Cache
+// ============================================================================
+//
+// In bounded-memory mode the chain keeps no record it has already saved;
+// blocks below the tip are read back from the log by height. This cache
+// keeps the compact records of the most recently read blocks, up to a
+// fixed number of them, so repeated views and lookups of the same blocks
+// do not go back to the disk.
+//
+// Entries live in one array sized to the capacity. A chained hash table
+// over the heights finds them, and a doubly linked list through the same
+// array orders them from most to least recently used; once the array is
+// full, a new record takes the least recently used entry and its buffer.
+// Records are immutable, so a hit hands out a copy and the entry may be
+// evicted as soon as the lock is dropped. Hits and misses are counted in
+// the runtime metrics.
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "cache.h"
+#include "metrics.h"
+
+#define NO_ENTRY UINT32_MAX
+
+typedef struct {
+    uint32_t height;    // NO_ENTRY while the entry holds nothing
+    uint32_t length;
+    uint8_t *data;
+    size_t size;        // allocated for data
+    uint32_t newer;     // LRU list
+    uint32_t older;
+    uint32_t chain;     // next entry in the same bucket
+} CacheEntry;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static CacheEntry *entries = NULL;
+static uint32_t *buckets = NULL;
+static uint32_t bucket_mask = 0;
+static uint32_t capacity = 0;
+static uint32_t used = 0;      // entries handed out so far
+static uint32_t held = 0;      // of those, entries holding a record
+static uint32_t newest = NO_ENTRY;
+static uint32_t oldest = NO_ENTRY;
+static size_t data_bytes = 0;
+
+static uint32_t bucket_of(uint32_t height) {
+    return (height * 2654435761u) & bucket_mask;
+}
+
+static uint32_t find(uint32_t height) {
+    uint32_t i = buckets[bucket_of(height)];
+    while (i != NO_ENTRY && entries[i].height != height) i = entries[i].chain;
+    return i;
+}
+
+static void unlink_lru(uint32_t i) {
+    CacheEntry *entry = &entries[i];
+    if (entry->newer != NO_ENTRY) entries[entry->newer].older = entry->older; else newest = entry->older;
+    if (entry->older != NO_ENTRY) entries[entry->older].newer = entry->newer; else oldest = entry->newer;
+}
+
+static void push_newest(uint32_t i) {
+    entries[i].newer = NO_ENTRY;
+    entries[i].older = newest;
+    if (newest != NO_ENTRY) entries[newest].newer = i;
+    newest = i;
+    if (oldest == NO_ENTRY) oldest = i;
+}
+
+static void unlink_bucket(uint32_t i) {
+    uint32_t *link = &buckets[bucket_of(entries[i].height)];
+    while (*link != NO_ENTRY && *link != i) link = &entries[*link].chain;
+    if (*link == i) *link = entries[i].chain;
+}
+
+static void drop_entries() {
+    for (uint32_t i = 0; i < used; i++) {
+        free(entries[i].data);
+        entries[i].data = NULL;
+        entries[i].size = 0;
+    }
+    if (buckets) memset(buckets, 0xff, (bucket_mask + 1) * sizeof(uint32_t));
+    used = 0;
+    held = 0;
+    newest = NO_ENTRY;
+    oldest = NO_ENTRY;
+    data_bytes = 0;
+}
+
+// Hold up to `blocks` records, dropping everything cached; 0 turns the
+// cache off. Returns 0 when out of memory, leaving it off
+int cache_set_capacity(uint32_t blocks) {
+    pthread_mutex_lock(&cache_lock);
+    drop_entries();
+    free(entries);
+    free(buckets);
+    entries = NULL;
+    buckets = NULL;
+    bucket_mask = 0;
+    capacity = 0;
+
+    int ok = 1;
+    if (blocks > 0) {
+        uint32_t slots = 16;
+        while (slots < blocks && slots < (1u << 31)) slots *= 2;
+        entries = (CacheEntry*)calloc(blocks, sizeof(CacheEntry));
+        buckets = (uint32_t*)malloc(slots * sizeof(uint32_t));
+        if (entries && buckets) {
+            capacity = blocks;
+            bucket_mask = slots - 1;
+            memset(buckets, 0xff, slots * sizeof(uint32_t));
+        } else {
+            free(entries);
+            free(buckets);
+            entries = NULL;
+            buckets = NULL;
+            ok = 0;
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return ok;
+}
+
+uint32_t cache_capacity() {
+    return capacity;
+}
+
+// Copy block `height`'s record into record's buffer when cached
+int cache_get(uint32_t height, StoreRecord *record) {
+    int hit = 0;
+
+    pthread_mutex_lock(&cache_lock);
+    uint32_t i = capacity ? find(height) : NO_ENTRY;
+    if (i != NO_ENTRY) {
+        uint32_t length = entries[i].length;
+        if (length > record->capacity) {
+            uint8_t *grown = (uint8_t*)realloc(record->buffer, length);
+            if (grown) {
+                record->buffer = grown;
+                record->capacity = length;
+            }
+        }
+        if (length <= record->capacity) {
+            memcpy(record->buffer, entries[i].data, length);
+            record->data = record->buffer;
+            record->length = length;
+            unlink_lru(i);
+            push_newest(i);
+            hit = 1;
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+    metrics_add(hit ? METRIC_CACHE_HITS : METRIC_CACHE_MISSES, 1);
+    return hit;
+}
+
+// Keep a copy of block `height`'s record, evicting the least recently
+// used one when the cache is full
+void cache_put(uint32_t height, const uint8_t *data, uint32_t length) {
+    pthread_mutex_lock(&cache_lock);
+    if (capacity == 0 || find(height) != NO_ENTRY) {
+        pthread_mutex_unlock(&cache_lock);
+        return;
+    }
+
+    uint32_t i;
+    if (used < capacity) {
+        i = used++;
+        entries[i].height = NO_ENTRY;
+    } else {
+        i = oldest;
+        unlink_lru(i);
+        if (entries[i].height != NO_ENTRY) {
+            unlink_bucket(i);
+            held--;
+        }
+        entries[i].height = NO_ENTRY;
+    }
+    if (entries[i].size < length) {
+        uint8_t *grown = (uint8_t*)realloc(entries[i].data, length);
+        if (grown) {
+            data_bytes += length - entries[i].size;
+            entries[i].data = grown;
+            entries[i].size = length;
+        }
+    }
+    // An entry that could not grow stays empty, next in line for reuse
+    if (entries[i].size >= length) {
+        memcpy(entries[i].data, data, length);
+        entries[i].height = height;
+        entries[i].length = length;
+        entries[i].chain = buckets[bucket_of(height)];
+        buckets[bucket_of(height)] = i;
+        push_newest(i);
+        held++;
+    } else {
+        entries[i].older = NO_ENTRY;
+        entries[i].newer = oldest;
+        if (oldest != NO_ENTRY) entries[oldest].older = i;
+        oldest = i;
+        if (newest == NO_ENTRY) newest = i;
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// Forget every record, e.g. when another chain is loaded
+void cache_clear() {
+    pthread_mutex_lock(&cache_lock);
+    drop_entries();
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void cache_status(CacheStatus *status) {
+    pthread_mutex_lock(&cache_lock);
+    status->capacity = capacity;
+    status->blocks = held;
+    status->bytes = data_bytes + (size_t)capacity * sizeof(CacheEntry) +
+                    (capacity ? (size_t)(bucket_mask + 1) * sizeof(uint32_t) : 0);
+    pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,27 @@
+// LRU Block Record Cache
+// ============================================================================
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "storage.h"
+
+// Largest block cache that may be configured
+#define CACHE_MAX_BLOCKS (1u << 24)
+
+typedef struct {
+    uint32_t capacity;  // blocks; 0 when the cache is off
+    uint32_t blocks;    // records held
+    size_t bytes;       // allocated for them and the tables
+} CacheStatus;
+
+int cache_set_capacity(uint32_t blocks);
+uint32_t cache_capacity();
+int cache_get(uint32_t height, StoreRecord *record);
+void cache_put(uint32_t height, const uint8_t *data, uint32_t length);
+void cache_clear();
+void cache_status(CacheStatus *status);
+
+#endif // CACHE_H
@@ -0,0 +1,106 @@
+// Verification Checkpoints
+// ============================================================================
+//
+// A checkpoint lives next to the chain file as <chain>.ckpt. It is sealed
+// with a SHA-256 over its own fields so a damaged record is rejected
+// instead of letting an incremental verify skip blocks. The seal has no
+// key and anyone editing the file can recompute it, so it does not prove
+// the blocks before the checkpoint untouched; only a full verification
+// rehashes those.
+
+#include <stdio.h>
+#include <string.h>
+#include "checkpoint.h"
+
+#define CHECKPOINT_MAGIC 0x544b4349u  // "ICKT"
+#define CHECKPOINT_VERSION 2  // 2: the block hash is kept raw
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    Checkpoint checkpoint;
+    uint8_t seal[SHA256_BLOCK_SIZE];
+} CheckpointRecord;
+
+static void checkpoint_path(const char *chain_file, char *path, size_t size) {
+    snprintf(path, size, "%s.ckpt", chain_file);
+}
+
+static void seal_record(const CheckpointRecord *record, uint8_t seal[]) {
+    SHA256_CTX ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, (const uint8_t*)&record->magic, sizeof(record->magic));
+    sha256_update(&ctx, (const uint8_t*)&record->version, sizeof(record->version));
+    sha256_update(&ctx, (const uint8_t*)&record->checkpoint, sizeof(record->checkpoint));
+    sha256_final(&ctx, seal);
+}
+
+void checkpoint_digest_init(uint8_t digest[]) {
+    memset(digest, 0, SHA256_BLOCK_SIZE);
+}
+
+// digest = SHA-256(digest || raw block hash)
+void checkpoint_digest_extend(uint8_t digest[], const uint8_t block_hash[]) {
+    SHA256_CTX ctx;
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, digest, SHA256_BLOCK_SIZE);
+    sha256_update(&ctx, block_hash, SHA256_BLOCK_SIZE);
+    sha256_final(&ctx, digest);
+}
+
+// Returns 1 with a valid checkpoint, 0 if none exists or it fails its seal
+int checkpoint_load(const char *chain_file, Checkpoint *checkpoint) {
+    char path[512];
+    CheckpointRecord record;
+    uint8_t seal[SHA256_BLOCK_SIZE];
+
+    checkpoint_path(chain_file, path, sizeof(path));
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return 0;
+
+    size_t read = fread(&record, sizeof(record), 1, fp);
+    fclose(fp);
+    if (read != 1 || record.magic != CHECKPOINT_MAGIC || record.version != CHECKPOINT_VERSION) {
+        printf("Warning: Ignoring unreadable checkpoint %s\n", path);
+        return 0;
+    }
+
+    seal_record(&record, seal);
+    if (memcmp(seal, record.seal, SHA256_BLOCK_SIZE) != 0) {
+        printf("Warning: Checkpoint %s failed its seal check\n", path);
+        return 0;
+    }
+
+    *checkpoint = record.checkpoint;
+    return 1;
+}
+
+// Written to a temporary file and renamed so a crash never leaves a torn record
+int checkpoint_save(const char *chain_file, const Checkpoint *checkpoint) {
+    char path[512];
+    char tmp_path[520];
+    CheckpointRecord record;
+
+    memset(&record, 0, sizeof(record));
+    record.magic = CHECKPOINT_MAGIC;
+    record.version = CHECKPOINT_VERSION;
+    record.checkpoint = *checkpoint;
+    seal_record(&record, record.seal);
+
+    checkpoint_path(chain_file, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *fp = fopen(tmp_path, "wb");
+    if (!fp) {
+        printf("Error: Could not write checkpoint %s\n", path);
+        return 0;
+    }
+    int ok = fwrite(&record, sizeof(record), 1, fp) == 1;
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok || rename(tmp_path, path) != 0) {
+        printf("Error: Could not write checkpoint %s\n", path);
+        remove(tmp_path);
+        return 0;
+    }
+    return 1;
+}
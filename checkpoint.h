@@ -0,0 +1,24 @@
+// Verification Checkpoints
+// ============================================================================
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+#include <time.h>
+#include "sha256.h"
+
+// State of the chain as of the last successful verification
+typedef struct {
+    uint32_t height;                              // last verified block
+    uint8_t hash[SHA256_BLOCK_SIZE];              // that block's hash
+    uint8_t running_digest[SHA256_BLOCK_SIZE];    // over block hashes 0..height
+    time_t created;
+} Checkpoint;
+
+void checkpoint_digest_init(uint8_t digest[]);
+void checkpoint_digest_extend(uint8_t digest[], const uint8_t block_hash[]);
+int checkpoint_load(const char *chain_file, Checkpoint *checkpoint);
+int checkpoint_save(const char *chain_file, const Checkpoint *checkpoint);
+
+#endif // CHECKPOINT_H
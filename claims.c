@@ -0,0 +1,331 @@
+// Claim Lifecycle Index
+// ============================================================================
+//
+// Preauths, claim submissions and decisions are separate events; this
+// index links them into claims as the events are indexed. A claim is
+// keyed by its policy, member, provider and diagnosis code:
+//
+//   PREAUTH_REQUEST    opens a claim as PREAUTHORIZED, unless its notes
+//                      already record a decision (as the summaries count)
+//   CLAIM_SUBMISSION   moves the oldest PREAUTHORIZED claim of its key to
+//                      SUBMITTED, or opens a new SUBMITTED claim
+//   CLAIM_DECISION     decides the oldest open claim of its key: APPROVED,
+//                      DENIED or PARTIAL from its notes, or else from the
+//                      approved amount against the claimed one
+//
+// Only open claims are kept, in a pool whose slots are reused once a
+// claim is decided; decided claims are folded into per-state totals.
+// Open claims form one list in the order they were opened, so listing or
+// aging them costs time in the number open, not the chain length. A hash
+// table over the keys chains each bucket's claims oldest first, so a
+// decision finds its claim in the first match of one short chain.
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "claims.h"
+
+#define NO_CLAIM UINT32_MAX
+#define CLAIMS_INITIAL_SLOTS 64
+
+typedef struct {
+    Claim claim;
+    uint32_t newer;     // open list, oldest first; free list through newer
+    uint32_t older;
+    uint32_t chain;     // next claim in the same bucket
+} ClaimSlot;
+
+static struct {
+    ClaimSlot *slots;
+    uint32_t capacity;
+    uint32_t open;
+    uint32_t free;      // first reusable slot
+    uint32_t oldest;
+    uint32_t newest;
+    uint32_t *buckets;
+    uint32_t bucket_mask;
+    ClaimTotals totals[CLAIM_STATE_COUNT];
+    uint64_t unmatched;  // decisions with no open claim to decide
+} claims = { NULL, 0, 0, NO_CLAIM, NO_CLAIM, NO_CLAIM, NULL, 0, { { 0, 0, 0 } }, 0 };
+
+static int64_t to_cents(double amount) {
+    amount *= 100.0;
+    return (int64_t)(amount + (amount < 0 ? -0.5 : 0.5));
+}
+
+static uint32_t bucket_of(const uint32_t keys[]) {
+    uint32_t hash = 2166136261u;
+    for (int field = 0; field < DICT_FIELD_COUNT; field++) {
+        hash = (hash ^ keys[field]) * 16777619u;
+    }
+    return (hash ^ (hash >> 15)) & claims.bucket_mask;
+}
+
+// Append slot i to the end of its bucket's chain, keeping it oldest first
+static void chain_append(uint32_t i) {
+    uint32_t *link = &claims.buckets[bucket_of(claims.slots[i].claim.keys)];
+    while (*link != NO_CLAIM) link = &claims.slots[*link].chain;
+    claims.slots[i].chain = NO_CLAIM;
+    *link = i;
+}
+
+static void chain_remove(uint32_t i) {
+    uint32_t *link = &claims.buckets[bucket_of(claims.slots[i].claim.keys)];
+    while (*link != NO_CLAIM && *link != i) link = &claims.slots[*link].chain;
+    if (*link == i) *link = claims.slots[i].chain;
+}
+
+// Rehash into twice as many buckets, walking the open list so every
+// chain stays oldest first
+static int grow_buckets() {
+    uint32_t count = claims.buckets ? (claims.bucket_mask + 1) * 2 : CLAIMS_INITIAL_SLOTS;
+    uint32_t *buckets = (uint32_t*)malloc(count * sizeof(uint32_t));
+    if (!buckets) return 0;
+    memset(buckets, 0xff, count * sizeof(uint32_t));
+    free(claims.buckets);
+    claims.buckets = buckets;
+    claims.bucket_mask = count - 1;
+    for (uint32_t i = claims.oldest; i != NO_CLAIM; i = claims.slots[i].newer) {
+        chain_append(i);
+    }
+    return 1;
+}
+
+static int grow_slots() {
+    uint32_t capacity = claims.capacity ? claims.capacity * 2 : CLAIMS_INITIAL_SLOTS;
+    ClaimSlot *slots = (ClaimSlot*)realloc(claims.slots, capacity * sizeof(ClaimSlot));
+    if (!slots) return 0;
+    for (uint32_t i = claims.capacity; i < capacity; i++) {
+        slots[i].newer = i + 1 < capacity ? i + 1 : claims.free;
+    }
+    claims.free = claims.capacity;
+    claims.slots = slots;
+    claims.capacity = capacity;
+    return 1;
+}
+
+// Open a claim at the new end of the open list
+static int open_claim(const Claim *claim) {
+    if (claims.free == NO_CLAIM && !grow_slots()) return 0;
+    if ((!claims.buckets || claims.open > claims.bucket_mask) && !grow_buckets()) return 0;
+
+    uint32_t i = claims.free;
+    claims.free = claims.slots[i].newer;
+    claims.slots[i].claim = *claim;
+    claims.slots[i].older = claims.newest;
+    claims.slots[i].newer = NO_CLAIM;
+    if (claims.newest != NO_CLAIM) claims.slots[claims.newest].newer = i;
+    claims.newest = i;
+    if (claims.oldest == NO_CLAIM) claims.oldest = i;
+    chain_append(i);
+    claims.open++;
+
+    ClaimTotals *totals = &claims.totals[claim->state];
+    totals->count++;
+    totals->claimed += claim->state == CLAIM_PREAUTHORIZED ? claim->requested : claim->claimed;
+    return 1;
+}
+
+// Unlink slot i from the open list and its bucket, and reuse it
+static void close_slot(uint32_t i) {
+    ClaimSlot *slot = &claims.slots[i];
+    chain_remove(i);
+    if (slot->older != NO_CLAIM) claims.slots[slot->older].newer = slot->newer; else claims.oldest = slot->newer;
+    if (slot->newer != NO_CLAIM) claims.slots[slot->newer].older = slot->older; else claims.newest = slot->older;
+    slot->newer = claims.free;
+    claims.free = i;
+    claims.open--;
+}
+
+// Oldest open claim with these keys, and in `state` unless that is
+// CLAIM_STATE_COUNT
+static uint32_t find_open(const uint32_t keys[], ClaimState state) {
+    if (!claims.buckets) return NO_CLAIM;
+    uint32_t i = claims.buckets[bucket_of(keys)];
+    for (; i != NO_CLAIM; i = claims.slots[i].chain) {
+        const Claim *claim = &claims.slots[i].claim;
+        if (memcmp(claim->keys, keys, sizeof(claim->keys)) == 0 &&
+            (state == CLAIM_STATE_COUNT || claim->state == (uint32_t)state)) {
+            return i;
+        }
+    }
+    return NO_CLAIM;
+}
+
+static int decided_in_notes(const char *notes, ClaimState *state) {
+    if (strncasecmp(notes, "APPROVED", 8) == 0) *state = CLAIM_APPROVED;
+    else if (strncasecmp(notes, "DENIED", 6) == 0) *state = CLAIM_DENIED;
+    else if (strncasecmp(notes, "PARTIAL", 7) == 0) *state = CLAIM_PARTIAL;
+    else return 0;
+    return 1;
+}
+
+// Move an open claim's totals from its current state to `state`
+static void move_totals(Claim *claim, ClaimState state, int64_t approved) {
+    ClaimTotals *from = &claims.totals[claim->state];
+    ClaimTotals *to = &claims.totals[state];
+    from->count--;
+    from->claimed -= claim->state == CLAIM_PREAUTHORIZED ? claim->requested : claim->claimed;
+    to->count++;
+    to->claimed += state == CLAIM_PREAUTHORIZED ? claim->requested : claim->claimed;
+    to->approved += approved;
+    claim->state = state;
+}
+
+// Apply one event of block `height`; heights must not decrease. Its IDs
+// must have been interned. Returns 0 when out of memory
+int claims_add_event(const InsurancePayload *event, uint32_t height, time_t timestamp, int *closed_preauth) {
+    const char *fields[DICT_FIELD_COUNT] = {
+        event->policy_id, event->member_id, event->provider_id, event->diagnosis_code
+    };
+    const size_t widths[DICT_FIELD_COUNT] = {
+        sizeof(event->policy_id), sizeof(event->member_id), sizeof(event->provider_id), sizeof(event->diagnosis_code)
+    };
+    ClaimState decision;
+    Claim claim;
+
+    *closed_preauth = 0;
+    if (event->event_type != PREAUTH_REQUEST && event->event_type != CLAIM_SUBMISSION &&
+        event->event_type != CLAIM_DECISION) {
+        return 1;
+    }
+    memset(&claim, 0, sizeof(claim));
+    for (int field = 0; field < DICT_FIELD_COUNT; field++) {
+        claim.keys[field] = dict_find((DictField)field, fields[field], strnlen(fields[field], widths[field]));
+        if (claim.keys[field] == DICT_NONE) return 0;
+    }
+    int64_t cents = to_cents(event->amount);
+
+    if (event->event_type == PREAUTH_REQUEST) {
+        if (decided_in_notes(event->notes, &decision)) return 1;
+        claim.state = CLAIM_PREAUTHORIZED;
+        claim.opened_height = height;
+        claim.opened = (int64_t)timestamp;
+        claim.requested = cents;
+        return open_claim(&claim);
+    }
+
+    if (event->event_type == CLAIM_SUBMISSION) {
+        uint32_t i = find_open(claim.keys, CLAIM_PREAUTHORIZED);
+        if (i == NO_CLAIM) {
+            claim.state = CLAIM_SUBMITTED;
+            claim.opened_height = height;
+            claim.opened = (int64_t)timestamp;
+            claim.claimed = cents;
+            return open_claim(&claim);
+        }
+        claims.slots[i].claim.claimed = cents;
+        move_totals(&claims.slots[i].claim, CLAIM_SUBMITTED, 0);
+        *closed_preauth = 1;
+        return 1;
+    }
+
+    uint32_t i = find_open(claim.keys, CLAIM_STATE_COUNT);
+    if (i == NO_CLAIM) {
+        claims.unmatched++;
+        return 1;
+    }
+    Claim *open = &claims.slots[i].claim;
+    if (open->state == CLAIM_PREAUTHORIZED) {
+        // Decided straight from the preauth: the estimate is what was asked
+        open->claimed = open->requested;
+        move_totals(open, CLAIM_SUBMITTED, 0);
+        *closed_preauth = 1;
+    }
+    if (!decided_in_notes(event->notes, &decision)) {
+        decision = cents <= 0 ? CLAIM_DENIED : (cents < open->claimed ? CLAIM_PARTIAL : CLAIM_APPROVED);
+    }
+    move_totals(open, decision, cents);
+    close_slot(i);
+    return 1;
+}
+
+// Visit every open claim, oldest first
+void claims_foreach_open(ClaimVisitor visit, void *ctx) {
+    for (uint32_t i = claims.oldest; i != NO_CLAIM; i = claims.slots[i].newer) {
+        visit(&claims.slots[i].claim, ctx);
+    }
+}
+
+uint32_t claims_open_count() {
+    return claims.open;
+}
+
+// Claims and amounts in each state; open states count what they hold now
+void claims_totals(ClaimTotals totals[CLAIM_STATE_COUNT]) {
+    memcpy(totals, claims.totals, sizeof(claims.totals));
+}
+
+uint64_t claims_unmatched() {
+    return claims.unmatched;
+}
+
+// Bytes claims_snapshot_save will write
+size_t claims_snapshot_size() {
+    return sizeof(uint32_t) + sizeof(uint64_t) + sizeof(claims.totals) + (size_t)claims.open * sizeof(Claim);
+}
+
+// The open count, unmatched decisions and per-state totals, then every
+// open claim, oldest first
+uint8_t* claims_snapshot_save(uint8_t *out) {
+    memcpy(out, &claims.open, sizeof(uint32_t));
+    out += sizeof(uint32_t);
+    memcpy(out, &claims.unmatched, sizeof(uint64_t));
+    out += sizeof(uint64_t);
+    memcpy(out, claims.totals, sizeof(claims.totals));
+    out += sizeof(claims.totals);
+    for (uint32_t i = claims.oldest; i != NO_CLAIM; i = claims.slots[i].newer) {
+        memcpy(out, &claims.slots[i].claim, sizeof(Claim));
+        out += sizeof(Claim);
+    }
+    return out;
+}
+
+// Restore what claims_snapshot_save wrote into an empty index. NULL when
+// the bytes are malformed or memory runs out; claims_reset cleans up
+const uint8_t* claims_snapshot_load(const uint8_t *in, const uint8_t *end) {
+    uint32_t open;
+    ClaimTotals totals[CLAIM_STATE_COUNT];
+
+    if ((size_t)(end - in) < sizeof(open) + sizeof(uint64_t) + sizeof(totals)) return NULL;
+    memcpy(&open, in, sizeof(open));
+    in += sizeof(open);
+    memcpy(&claims.unmatched, in, sizeof(uint64_t));
+    in += sizeof(uint64_t);
+    memcpy(totals, in, sizeof(totals));
+    in += sizeof(totals);
+    if ((size_t)(end - in) / sizeof(Claim) < open) return NULL;
+
+    // Opening counts each claim again, so only the decided totals are taken
+    for (uint32_t i = 0; i < open; i++) {
+        Claim claim;
+        memcpy(&claim, in, sizeof(Claim));
+        in += sizeof(Claim);
+        if (claim.state > CLAIM_SUBMITTED || !open_claim(&claim)) return NULL;
+    }
+    for (int state = CLAIM_APPROVED; state < CLAIM_STATE_COUNT; state++) {
+        claims.totals[state] = totals[state];
+    }
+    return in;
+}
+
+// Drop every claim, e.g. before a rebuild
+void claims_reset() {
+    free(claims.slots);
+    free(claims.buckets);
+    memset(&claims, 0, sizeof(claims));
+    claims.free = NO_CLAIM;
+    claims.oldest = NO_CLAIM;
+    claims.newest = NO_CLAIM;
+}
+
+const char* claim_state_to_string(ClaimState state) {
+    switch (state) {
+        case CLAIM_PREAUTHORIZED: return "PREAUTHORIZED";
+        case CLAIM_SUBMITTED: return "SUBMITTED";
+        case CLAIM_APPROVED: return "APPROVED";
+        case CLAIM_DENIED: return "DENIED";
+        case CLAIM_PARTIAL: return "PARTIAL";
+        default: return "UNKNOWN";
+    }
+}
@@ -0,0 +1,54 @@
+// Claim Lifecycle Index
+// ============================================================================
+
+#ifndef CLAIMS_H
+#define CLAIMS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "insurance_types.h"
+#include "dict.h"
+
+// Where a claim stands. The first two are open, the rest decided
+typedef enum {
+    CLAIM_PREAUTHORIZED,  // preauth requested, no claim submitted yet
+    CLAIM_SUBMITTED,
+    CLAIM_APPROVED,
+    CLAIM_DENIED,
+    CLAIM_PARTIAL,
+    CLAIM_STATE_COUNT
+} ClaimState;
+
+// One open claim, keyed by the dictionary IDs of its policy, member,
+// provider and diagnosis code. Amounts are in cents
+typedef struct {
+    uint32_t keys[DICT_FIELD_COUNT];
+    uint32_t state;             // ClaimState
+    uint32_t opened_height;     // block of the preauth or submission
+    int64_t opened;             // and its timestamp
+    int64_t requested;          // preauth estimate
+    int64_t claimed;
+} Claim;
+
+// Claims in one state, with what was claimed and (once decided) approved
+typedef struct {
+    uint64_t count;
+    int64_t claimed;
+    int64_t approved;
+} ClaimTotals;
+
+typedef void (*ClaimVisitor)(const Claim *claim, void *ctx);
+
+int claims_add_event(const InsurancePayload *event, uint32_t height, time_t timestamp, int *closed_preauth);
+void claims_foreach_open(ClaimVisitor visit, void *ctx);
+uint32_t claims_open_count();
+void claims_totals(ClaimTotals totals[CLAIM_STATE_COUNT]);
+uint64_t claims_unmatched();
+size_t claims_snapshot_size();
+uint8_t* claims_snapshot_save(uint8_t *out);
+const uint8_t* claims_snapshot_load(const uint8_t *in, const uint8_t *end);
+void claims_reset();
+const char* claim_state_to_string(ClaimState state);
+
+#endif // CLAIMS_H
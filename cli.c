@@ -4,10 +4,102 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include "insurance_types.h"
 #include "cli.h"
 #include "blockchain.h"
 #include "validation.h"
+#include "miner.h"
+#include "storage.h"
+#include "import.h"
+#include "metrics.h"
+#include "retarget.h"
+#include "background.h"
+#include "snapshot.h"
+#include "cache.h"
+
+// Block cache occupancy and hit rate, to tune its size by
+static void print_cache_status() {
+    CacheStatus cache;
+    MetricsSnapshot metrics;
+
+    cache_status(&cache);
+    if (cache.capacity == 0) {
+        printf("Block cache off; saved blocks are read from the mapped log\n");
+        return;
+    }
+    metrics_snapshot(&metrics);
+    uint64_t hits = metrics.counters[METRIC_CACHE_HITS];
+    uint64_t misses = metrics.counters[METRIC_CACHE_MISSES];
+    printf("Block cache: %u of %u block(s), %.1f KB; %llu hit(s), %llu miss(es), %.1f%% hit rate\n",
+           cache.blocks, cache.capacity, cache.bytes / 1024.0, (unsigned long long)hits,
+           (unsigned long long)misses, hits + misses ? 100.0 * hits / (hits + misses) : 0.0);
+}
+
+// Read the remainder of the command line, without the newline
+static void read_args(char *args, size_t size) {
+    if (!fgets(args, size, stdin)) {
+        args[0] = '\0';
+        return;
+    }
+    args[strcspn(args, "\n")] = 0;
+}
+
+// What a command needs from the chain while it runs
+typedef enum {
+    HOLD_NONE,     // queues events or waits on the miner
+    HOLD_READ,     // only reads; runs alongside the background miner
+    HOLD_WRITER    // writes; the background miner drains and stands aside
+} CommandHold;
+
+// Mine the event now, or in async mode hand it to the background miner
+static void add_event(InsurancePayload payload) {
+    if (!background_active()) {
+        blockchain_add_block(payload);
+        return;
+    }
+    uint64_t ticket = background_submit(&payload);
+    if (ticket == 0) {
+        printf("Error: Could not queue the event\n");
+        return;
+    }
+    printf("Queued as ticket %llu\n", (unsigned long long)ticket);
+}
+
+static CommandHold command_hold(const char *command) {
+    const char *reads[] = { "view", "history", "summary", "query", "claims", "verify", "stats", "pending", "help" };
+    const char *unlocked[] = { "enroll", "pay", "preauth", "claim", "wait", "async" };
+    for (size_t i = 0; i < sizeof(reads) / sizeof(reads[0]); i++) {
+        if (strcmp(command, reads[i]) == 0) return HOLD_READ;
+    }
+    for (size_t i = 0; i < sizeof(unlocked) / sizeof(unlocked[0]); i++) {
+        if (strcmp(command, unlocked[i]) == 0) return HOLD_NONE;
+    }
+    return HOLD_WRITER;
+}
+
+static void take_hold(CommandHold hold) {
+    if (hold == HOLD_READ) blockchain_read_lock();
+    if (hold == HOLD_WRITER) background_pause();
+}
+
+static void release_hold(CommandHold hold) {
+    if (hold == HOLD_READ) blockchain_read_unlock();
+    if (hold == HOLD_WRITER) background_resume();
+}
+
+static void print_pending() {
+    BackgroundStatus status;
+    background_status(&status);
+    printf("\n=== PENDING ===\n");
+    printf("Async Mining: %s\n", status.running ? "on" : "off");
+    printf("Tickets Issued: %llu\n", (unsigned long long)status.issued);
+    printf("Committed Through: %llu\n", (unsigned long long)status.committed);
+    printf("Queued for the Miner: %u\n", status.queued);
+    printf("In the Open Batch: %u\n", blockchain_pending_events());
+    printf("Failed: %u\n", status.failed);
+    printf("Committed Blocks: %u\n\n", blockchain_length());
+}
 
 void cli_enroll() {
     InsurancePayload payload = {0};
@@ -32,7 +124,7 @@ void cli_enroll() {
     fgets(payload.notes, 255, stdin);
     payload.notes[strcspn(payload.notes, "\n")] = 0;
     
-    blockchain_add_block(payload);
+    add_event(payload);
 }
 
 void cli_pay() {
@@ -53,7 +145,7 @@ void cli_pay() {
     strcpy(payload.diagnosis_code, "N/A");
     strcpy(payload.notes, "Premium payment received");
     
-    blockchain_add_block(payload);
+    add_event(payload);
 }
 
 void cli_preauth() {
@@ -82,7 +174,7 @@ void cli_preauth() {
     fgets(payload.notes, 255, stdin);
     payload.notes[strcspn(payload.notes, "\n")] = 0;
     
-    blockchain_add_block(payload);
+    add_event(payload);
 }
 
 void cli_help() {
@@ -95,10 +187,36 @@ void cli_help() {
     printf("  preauth      - Submit pre-authorization request\n");
     printf("  claim submit - Submit insurance claim\n");
     printf("  claim decide - Record claim decision\n");
+    printf("  import <file> - Bulk import CSV or JSON Lines events\n");
     printf("  view         - Display entire blockchain (sensitive data masked)\n");
-    printf("  verify       - Verify blockchain integrity\n");
+    printf("  view --from H --to H | --tail N | --page N [--page-size K] - Display part of it\n");
+    printf("  history policy|member|provider <id> - Show every event for an ID (masked)\n");
+    printf("  summary <policy> | --all - Premium, claim and preauth totals\n");
+    printf("  query [type=T] [policy|member|provider|diagnosis=ID] [from=DATE] [to=DATE] [by=FIELD]\n");
+    printf("               - Count and sum events, optionally grouped by type or an ID\n");
+    printf("  query --export <file> - Write the columnar event snapshot to a file\n");
+    printf("  claims [open | aging] - Claims by state, open claims oldest first, or open claims by age\n");
+    printf("  verify       - Verify blockchain integrity and checkpoint the tip\n");
+    printf("  verify --since-checkpoint - Rehash only blocks added since the last checkpoint\n");
+    printf("  verify --full             - Rehash every block (audit mode)\n");
     printf("  save         - Save blockchain to file\n");
     printf("  load         - Load blockchain from file\n");
+    printf("  snapshot [every <blocks>] - Snapshot the indexes now, or every n saved blocks (0 = off, now %u)\n",
+           snapshot_interval());
+    printf("  difficulty <bits> - Set leading zero bits for the next block\n");
+    printf("  blocktime <seconds> - Retarget difficulty to this mining time per block (0 = fixed, now %.2f)\n",
+           retarget_goal());
+    printf("  batch <events> [seconds] - Events per block, and max wait for a partial batch\n");
+    printf("  groupcommit <n> - fsync the log every n appended blocks\n");
+    printf("  compress on|off - Compress blocks appended to the log from now on\n");
+    printf("  threads <n>  - Set mining threads (0 = one per core, now %u)\n", miner_get_threads());
+    printf("  cache [<blocks>|off] - Bound memory: keep only this many saved blocks cached (now %u)\n",
+           cache_capacity());
+    printf("  async on|off - Mine in the background; events return a ticket at once (now %s)\n",
+           background_active() ? "on" : "off");
+    printf("  pending      - Show queued, batched and committed tickets\n");
+    printf("  wait <ticket> - Block until a ticket's event is in a block\n");
+    printf("  stats        - Show hash, block, I/O counters and latency histograms\n");
     printf("  help         - Show this help message\n");
     printf("  exit         - Exit program\n\n");
 }
@@ -107,14 +225,24 @@ void cli_run() {
     char command[64];
     
     printf("=== HEALTH INSURANCE BLOCKCHAIN SYSTEM ===\n");
-    printf("Initializing blockchain with difficulty 4...\n\n");
+    printf("Initializing blockchain with difficulty 16 bits...\n\n");
     
-    blockchain_init(4);
+    blockchain_init(16);
     cli_help();
     
+    // Each command holds the chain as command_hold says until the next
+    // prompt; `continue` in a branch below releases it the same way
+    CommandHold hold = HOLD_NONE;
     while (1) {
+        release_hold(hold);
+        hold = HOLD_NONE;
         printf("> ");
         if (scanf("%63s", command) != 1) break;
+        // Sealing takes the write lock, so a due batch is sealed before
+        // a read command takes the read lock
+        if (!background_active()) blockchain_seal_if_due();
+        hold = command_hold(command);
+        take_hold(hold);
         
         if (strcmp(command, "enroll") == 0) {
             cli_enroll();
@@ -132,25 +260,202 @@ void cli_run() {
             } else {
                 printf("Unknown claim subcommand. Use 'submit' or 'decide'\n");
             }
+        } else if (strcmp(command, "import") == 0) {
+            char args[512];
+            char path[512] = "";
+            read_args(args, sizeof(args));
+            if (sscanf(args, "%511s", path) != 1) {
+                printf("Usage: import <file>\n");
+                continue;
+            }
+            import_file(path, CHAIN_FILE);
         } else if (strcmp(command, "view") == 0) {
-            blockchain_view();
+            char args[128];
+            read_args(args, sizeof(args));
+            blockchain_view_args(args);
+        } else if (strcmp(command, "history") == 0) {
+            char args[96];
+            char kind[16] = "";
+            char id[64] = "";
+            IndexField field;
+            read_args(args, sizeof(args));
+            if (sscanf(args, "%15s %63s", kind, id) != 2 || !string_to_index_field(kind, &field)) {
+                printf("Usage: history policy|member|provider <id>\n");
+                continue;
+            }
+            blockchain_history(field, id);
+        } else if (strcmp(command, "summary") == 0) {
+            char args[64];
+            char target[32] = "";
+            read_args(args, sizeof(args));
+            if (sscanf(args, "%31s", target) != 1) {
+                printf("Usage: summary <policy> | --all\n");
+            } else if (strcmp(target, "--all") == 0) {
+                blockchain_summary_all();
+            } else {
+                blockchain_summary(target);
+            }
+        } else if (strcmp(command, "query") == 0) {
+            char args[512];
+            read_args(args, sizeof(args));
+            blockchain_query_args(args);
+        } else if (strcmp(command, "claims") == 0) {
+            char args[64];
+            read_args(args, sizeof(args));
+            blockchain_claims_args(args);
         } else if (strcmp(command, "verify") == 0) {
-            blockchain_verify();
+            char args[64];
+            char mode[32] = "";
+            read_args(args, sizeof(args));
+            sscanf(args, "%31s", mode);
+            if (mode[0] == '\0' || strcmp(mode, "--full") == 0) {
+                blockchain_verify_full(CHAIN_FILE);
+            } else if (strcmp(mode, "--since-checkpoint") == 0) {
+                blockchain_verify_since_checkpoint(CHAIN_FILE);
+            } else {
+                printf("Usage: verify [--full | --since-checkpoint]\n");
+            }
         } else if (strcmp(command, "save") == 0) {
-            blockchain_save("blockchain.dat");
+            blockchain_save(CHAIN_FILE);
         } else if (strcmp(command, "load") == 0) {
-            blockchain_load("blockchain.dat");
+            blockchain_load(CHAIN_FILE);
+        } else if (strcmp(command, "snapshot") == 0) {
+            char args[64];
+            char every[16] = "";
+            unsigned int blocks = 0;
+            read_args(args, sizeof(args));
+            int fields = sscanf(args, "%15s %u", every, &blocks);
+            if (fields <= 0) {
+                blockchain_snapshot();
+            } else if (fields == 2 && strcmp(every, "every") == 0) {
+                snapshot_set_interval(blocks);
+                printf(blocks ? "Snapshot every %u saved block(s)\n" : "Automatic snapshots off\n", blocks);
+            } else {
+                printf("Usage: snapshot [every <blocks>]\n");
+            }
+        } else if (strcmp(command, "difficulty") == 0) {
+            unsigned int bits;
+            // Harder targets are unlikely to be met within the 32-bit nonce
+            if (scanf("%u", &bits) != 1 || bits > RETARGET_MAX_BITS) {
+                printf("Usage: difficulty <bits> (0-%u)\n", RETARGET_MAX_BITS);
+                continue;
+            }
+            blockchain_set_difficulty(bits);
+            printf("Difficulty set to %u leading zero bits\n", bits);
+        } else if (strcmp(command, "blocktime") == 0) {
+            double seconds;
+            if (scanf("%lf", &seconds) != 1 || !isfinite(seconds) || seconds < 0) {
+                printf("Usage: blocktime <seconds> (0 = fixed difficulty)\n");
+                continue;
+            }
+            Blockchain *bc = blockchain_get_instance();
+            blockchain_set_block_time(seconds);
+            if (seconds > 0) {
+                printf("Retargeting difficulty to %g s per block\n", seconds);
+            } else if (bc) {
+                printf("Retargeting off; difficulty stays at %u bits\n", bc->difficulty);
+            }
+        } else if (strcmp(command, "batch") == 0) {
+            char args[64];
+            unsigned int events = 0;
+            unsigned int seconds = 0;
+            read_args(args, sizeof(args));
+            if (sscanf(args, "%u %u", &events, &seconds) < 1 || events == 0) {
+                printf("Usage: batch <events> [seconds] (1 = one event per block)\n");
+                continue;
+            }
+            blockchain_set_batching(events, seconds);
+            printf("Sealing blocks at %u event(s)", events);
+            if (seconds > 0) printf(" or after %u s", seconds);
+            printf("\n");
+            if (seconds > 0 && !background_active()) {
+                printf("The wait is checked when the next command is entered (or every second with async on)\n");
+            }
+        } else if (strcmp(command, "groupcommit") == 0) {
+            unsigned int blocks;
+            if (scanf("%u", &blocks) != 1 || blocks == 0) {
+                printf("Usage: groupcommit <n> (n >= 1)\n");
+                continue;
+            }
+            store_set_group_commit(blocks);
+            printf("Log fsync every %u block(s)\n", blocks);
+        } else if (strcmp(command, "compress") == 0) {
+            char mode[16];
+            if (scanf("%15s", mode) != 1 || (strcmp(mode, "on") != 0 && strcmp(mode, "off") != 0)) {
+                printf("Usage: compress on|off\n");
+                continue;
+            }
+            store_set_compression(strcmp(mode, "on") == 0);
+            printf("Log compression %s for new blocks\n", mode);
+        } else if (strcmp(command, "threads") == 0) {
+            unsigned int threads;
+            if (scanf("%u", &threads) != 1) {
+                printf("Usage: threads <n>\n");
+                continue;
+            }
+            miner_set_threads(threads);
+            printf("Mining with %u thread(s)\n", miner_get_threads());
+        } else if (strcmp(command, "cache") == 0) {
+            char args[64];
+            char size[16] = "";
+            read_args(args, sizeof(args));
+            if (sscanf(args, "%15s", size) == 1) {
+                char *end = size;
+                int off = strcmp(size, "off") == 0;
+                unsigned long blocks = off ? 0 : strtoul(size, &end, 10);
+                if (!off && (end == size || *end != '\0' || blocks == 0 || blocks > CACHE_MAX_BLOCKS)) {
+                    printf("Usage: cache <blocks>|off (at most %u blocks)\n", CACHE_MAX_BLOCKS);
+                    continue;
+                }
+                if (!blockchain_set_block_cache((uint32_t)blocks)) continue;
+            }
+            print_cache_status();
+        } else if (strcmp(command, "async") == 0) {
+            char mode[16];
+            if (scanf("%15s", mode) != 1 || (strcmp(mode, "on") != 0 && strcmp(mode, "off") != 0)) {
+                printf("Usage: async on|off\n");
+                continue;
+            }
+            if (strcmp(mode, "off") == 0) {
+                background_stop();
+                printf("Async mining off; events are mined as they are entered\n");
+            } else if (background_start()) {
+                printf("Async mining on; events are queued and return a ticket\n");
+            } else {
+                printf("Error: Could not start the background miner\n");
+            }
+        } else if (strcmp(command, "pending") == 0) {
+            print_pending();
+        } else if (strcmp(command, "wait") == 0) {
+            unsigned long long ticket;
+            char reason[128];
+            if (scanf("%llu", &ticket) != 1) {
+                printf("Usage: wait <ticket>\n");
+                continue;
+            }
+            int result = background_wait(ticket, reason, sizeof(reason));
+            if (result > 0) {
+                printf("Ticket %llu committed\n", ticket);
+            } else if (result == 0) {
+                printf("Ticket %llu failed: %s\n", ticket, reason);
+            } else {
+                printf("Unknown ticket %llu\n", ticket);
+            }
+        } else if (strcmp(command, "stats") == 0) {
+            metrics_print(stdout);
         } else if (strcmp(command, "help") == 0) {
             cli_help();
         } else if (strcmp(command, "exit") == 0) {
             printf("Saving blockchain before exit...\n");
-            blockchain_save("blockchain.dat");
+            blockchain_save(CHAIN_FILE);
             break;
         } else {
             printf("Unknown command. Type 'help' for available commands.\n");
         }
     }
     
+    release_hold(hold);
+    background_stop();
     blockchain_cleanup();
 }
 void cli_claim_submit() {
@@ -179,7 +484,7 @@ void cli_claim_submit() {
     fgets(payload.notes, 255, stdin);
     payload.notes[strcspn(payload.notes, "\n")] = 0;
     
-    blockchain_add_block(payload);
+    add_event(payload);
 }
 void cli_claim_decide() {
     InsurancePayload payload = {0};
@@ -206,5 +511,5 @@ void cli_claim_decide() {
     fgets(payload.notes, 255, stdin);
     payload.notes[strcspn(payload.notes, "\n")] = 0;
     
-    blockchain_add_block(payload);
+    add_event(payload);
 }
\ No newline at end of file
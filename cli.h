@@ -3,6 +3,8 @@
 #ifndef CLI_H
 #define CLI_H
 
+#define CHAIN_FILE "blockchain.dat"
+
 void cli_enroll();
 void cli_pay();
 void cli_preauth();
@@ -0,0 +1,338 @@
+// Compact Record Encoding
+// ============================================================================
+//
+// Blocks are held, in memory and in the log, as compact records instead of
+// the fixed-size Block struct: integers are LEB128 varints, IDs and
+// diagnosis codes are their dictionary IDs (see dict.c), notes keep only
+// their used bytes behind a length prefix, amounts are whole cents when
+// that is exact and hashes are 32 raw bytes. A batched block's record is
+// its header followed by its events. Decoding restores the strings and
+// zero-pads them again, so a decoded block hashes exactly like the one
+// that was encoded.
+//
+// codec_compress is a small LZ77 in the LZ4 block layout: each sequence
+// is a token (literal count, match length - 4), the literals, then a
+// 16-bit back reference. Batches repeat provider IDs, codes and notes
+// from event to event, which is where it pays off.
+
+#include <string.h>
+#include "codec.h"
+#include "dict.h"
+
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+
+static uint8_t *put_varint(uint8_t *out, uint64_t v) {
+    while (v >= 0x80) {
+        *out++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *out++ = (uint8_t)v;
+    return out;
+}
+
+// NULL when the varint runs past end or over 64 bits
+static const uint8_t *get_varint(const uint8_t *in, const uint8_t *end, uint64_t *v) {
+    *v = 0;
+    for (int shift = 0; in < end && shift < 64; shift += 7) {
+        uint8_t byte = *in++;
+        *v |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return in;
+    }
+    return NULL;
+}
+
+static const uint8_t *get_u32(const uint8_t *in, const uint8_t *end, uint32_t *v) {
+    uint64_t wide;
+    in = get_varint(in, end, &wide);
+    if (!in || wide > UINT32_MAX) return NULL;
+    *v = (uint32_t)wide;
+    return in;
+}
+
+static uint8_t *put_text(uint8_t *out, const char *field, size_t width) {
+    size_t len = strnlen(field, width);
+    out = put_varint(out, len);
+    memcpy(out, field, len);
+    return out + len;
+}
+
+// The field is zero-filled past its text, as the preimages expect
+static const uint8_t *get_text(const uint8_t *in, const uint8_t *end, char *field, size_t width) {
+    uint64_t len;
+    in = get_varint(in, end, &len);
+    if (!in || len > width || len > (uint64_t)(end - in)) return NULL;
+    memcpy(field, in, len);
+    memset(field + len, 0, width - len);
+    return in + len;
+}
+
+// A dictionary-encoded field; 0 when its string cannot be interned
+static uint8_t *put_key(uint8_t *out, DictField dict, const char *field, size_t width) {
+    uint32_t id = dict_intern(dict, field, strnlen(field, width));
+    return id != DICT_NONE ? put_varint(out, id) : NULL;
+}
+
+static const uint8_t *get_key(const uint8_t *in, const uint8_t *end, DictField dict, char *field, size_t width) {
+    uint32_t id;
+    size_t len;
+    const char *text;
+
+    in = get_u32(in, end, &id);
+    if (!in || !(text = dict_string(dict, id, &len)) || len > width) return NULL;
+    memcpy(field, text, len);
+    memset(field + len, 0, width - len);
+    return in;
+}
+
+// Whole cents are stored as a zigzag varint shifted left one bit; any
+// other amount sets the low bit and follows with its 8 raw bytes
+static uint8_t *put_amount(uint8_t *out, double amount) {
+    double scaled = amount * 100.0;
+    if (scaled > -9e15 && scaled < 9e15) {
+        int64_t cents = (int64_t)(scaled + (scaled < 0 ? -0.5 : 0.5));
+        double back = (double)cents / 100.0;
+        if (memcmp(&back, &amount, sizeof(double)) == 0) {
+            uint64_t zigzag = ((uint64_t)cents << 1) ^ (uint64_t)(cents >> 63);
+            return put_varint(out, zigzag << 1);
+        }
+    }
+    *out++ = 1;
+    memcpy(out, &amount, sizeof(double));
+    return out + sizeof(double);
+}
+
+static const uint8_t *get_amount(const uint8_t *in, const uint8_t *end, double *amount) {
+    uint64_t v;
+    in = get_varint(in, end, &v);
+    if (!in) return NULL;
+    if (v & 1) {
+        if (v != 1 || end - in < (ptrdiff_t)sizeof(double)) return NULL;
+        memcpy(amount, in, sizeof(double));
+        return in + sizeof(double);
+    }
+    v >>= 1;
+    int64_t cents = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+    *amount = (double)cents / 100.0;
+    return in;
+}
+
+static const uint8_t *get_hash(const uint8_t *in, const uint8_t *end, uint8_t *hash) {
+    if (end - in < 32) return NULL;
+    memcpy(hash, in, 32);
+    return in + 32;
+}
+
+// Encode one event, interning its IDs; 0 when the dictionary is full
+size_t codec_encode_event(const InsurancePayload *event, uint8_t *out) {
+    uint8_t *cursor = put_varint(out, (uint32_t)event->event_type);
+
+    cursor = put_amount(cursor, event->amount);
+    cursor = put_key(cursor, DICT_POLICY, event->policy_id, sizeof(event->policy_id));
+    if (cursor) cursor = put_key(cursor, DICT_MEMBER, event->member_id, sizeof(event->member_id));
+    if (cursor) cursor = put_key(cursor, DICT_PROVIDER, event->provider_id, sizeof(event->provider_id));
+    if (cursor) cursor = put_key(cursor, DICT_DIAGNOSIS, event->diagnosis_code, sizeof(event->diagnosis_code));
+    if (!cursor) return 0;
+    cursor = put_text(cursor, event->notes, sizeof(event->notes));
+    return (size_t)(cursor - out);
+}
+
+// Header, then the payload or, for a batch, its count, first event index
+// and Merkle root. A batch's events are encoded after this by the caller.
+// 0 when the payload cannot be encoded
+size_t codec_encode_block(const Block *block, uint8_t *out) {
+    int64_t timestamp = (int64_t)block->timestamp;
+    uint8_t *cursor = out;
+
+    cursor = put_varint(cursor, block->block_id);
+    cursor = put_varint(cursor, block->hash_version);
+    cursor = put_varint(cursor, block->difficulty);
+    cursor = put_varint(cursor, block->nonce);
+    cursor = put_varint(cursor, ((uint64_t)timestamp << 1) ^ (uint64_t)(timestamp >> 63));
+    memcpy(cursor, block->prev_hash, 32);
+    memcpy(cursor + 32, block->hash, 32);
+    cursor += 64;
+
+    if (block->hash_version >= HASH_VERSION_BATCH) {
+        cursor = put_varint(cursor, block->batch.event_count);
+        cursor = put_varint(cursor, block->batch.first_event);
+        memcpy(cursor, block->batch.merkle_root, 32);
+        return (size_t)(cursor + 32 - out);
+    }
+    size_t payload = codec_encode_event(&block->payload, cursor);
+    return payload ? (size_t)(cursor - out) + payload : 0;
+}
+
+// Version 2 logs kept every text field inline rather than interned
+static const uint8_t *get_field(const uint8_t *in, const uint8_t *end, int inline_text, DictField dict,
+                                char *field, size_t width) {
+    return inline_text ? get_text(in, end, field, width) : get_key(in, end, dict, field, width);
+}
+
+static const uint8_t *decode_event(const uint8_t *in, const uint8_t *end, InsurancePayload *event, int inline_text) {
+    uint32_t type;
+
+    memset(event, 0, sizeof(*event));
+    in = get_u32(in, end, &type);
+    if (!in) return NULL;
+    event->event_type = (EventType)type;
+    in = get_amount(in, end, &event->amount);
+    if (in) in = get_field(in, end, inline_text, DICT_POLICY, event->policy_id, sizeof(event->policy_id));
+    if (in) in = get_field(in, end, inline_text, DICT_MEMBER, event->member_id, sizeof(event->member_id));
+    if (in) in = get_field(in, end, inline_text, DICT_PROVIDER, event->provider_id, sizeof(event->provider_id));
+    if (in) in = get_field(in, end, inline_text, DICT_DIAGNOSIS, event->diagnosis_code, sizeof(event->diagnosis_code));
+    if (in) in = get_text(in, end, event->notes, sizeof(event->notes));
+    return in;
+}
+
+static const uint8_t *decode_block(const uint8_t *in, const uint8_t *end, Block *block, int inline_text) {
+    uint64_t timestamp;
+
+    memset(block, 0, sizeof(*block));
+    in = get_u32(in, end, &block->block_id);
+    if (in) in = get_u32(in, end, &block->hash_version);
+    if (in) in = get_u32(in, end, &block->difficulty);
+    if (in) in = get_u32(in, end, &block->nonce);
+    if (in) in = get_varint(in, end, &timestamp);
+    if (in) in = get_hash(in, end, block->prev_hash);
+    if (in) in = get_hash(in, end, block->hash);
+    if (!in) return NULL;
+    block->timestamp = (time_t)((int64_t)(timestamp >> 1) ^ -(int64_t)(timestamp & 1));
+
+    if (block->hash_version >= HASH_VERSION_BATCH) {
+        in = get_u32(in, end, &block->batch.event_count);
+        if (in) in = get_u32(in, end, &block->batch.first_event);
+        return in ? get_hash(in, end, block->batch.merkle_root) : NULL;
+    }
+    return decode_event(in, end, &block->payload, inline_text);
+}
+
+// Decode one event; returns where the next one starts, NULL if malformed
+// or naming an ID the dictionary does not hold
+const uint8_t* codec_decode_event(const uint8_t *in, const uint8_t *end, InsurancePayload *event) {
+    return decode_event(in, end, event, 0);
+}
+
+// Decode a record's header; for a batch the result points at its events
+const uint8_t* codec_decode_block(const uint8_t *in, const uint8_t *end, Block *block) {
+    return decode_block(in, end, block, 0);
+}
+
+// The same for records of a version 2 log, only read to upgrade it
+const uint8_t* codec_decode_event_v2(const uint8_t *in, const uint8_t *end, InsurancePayload *event) {
+    return decode_event(in, end, event, 1);
+}
+
+const uint8_t* codec_decode_block_v2(const uint8_t *in, const uint8_t *end, Block *block) {
+    return decode_block(in, end, block, 1);
+}
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t lz_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static uint8_t *put_length(uint8_t *out, size_t n) {
+    for (; n >= 255; n -= 255) *out++ = 255;
+    *out++ = (uint8_t)n;
+    return out;
+}
+
+// One sequence; match 0 ends the stream with literals only. NULL once
+// the output would reach limit
+static uint8_t *put_sequence(uint8_t *out, const uint8_t *limit, const uint8_t *literals, size_t count,
+                             size_t offset, size_t match) {
+    if ((size_t)(limit - out) <= count + count / 255 + match / 255 + 5) return NULL;
+
+    uint8_t *token = out++;
+    *token = (uint8_t)((count < 15 ? count : 15) << 4);
+    if (count >= 15) out = put_length(out, count - 15);
+    memcpy(out, literals, count);
+    out += count;
+    if (match == 0) return out;
+
+    *out++ = (uint8_t)offset;
+    *out++ = (uint8_t)(offset >> 8);
+    match -= LZ_MIN_MATCH;
+    *token |= (uint8_t)(match < 15 ? match : 15);
+    if (match >= 15) out = put_length(out, match - 15);
+    return out;
+}
+
+// Compress len bytes into out (room for len bytes). Returns the
+// compressed size, or 0 when it would not come out smaller
+size_t codec_compress(const uint8_t *in, size_t len, uint8_t *out) {
+    uint32_t table[1 << LZ_HASH_BITS];  // position + 1 of the last 4-byte run per hash
+    const uint8_t *end = in + len;
+    const uint8_t *anchor = in;
+    const uint8_t *ip = in;
+    uint8_t *op = out;
+
+    memset(table, 0, sizeof(table));
+    while (end - ip >= LZ_MIN_MATCH) {
+        uint32_t h = lz_hash(read32(ip));
+        const uint8_t *ref = table[h] ? in + table[h] - 1 : NULL;
+        table[h] = (uint32_t)(ip - in) + 1;
+        if (!ref || ip - ref > LZ_MAX_OFFSET || read32(ref) != read32(ip)) {
+            ip++;
+            continue;
+        }
+
+        size_t match = LZ_MIN_MATCH;
+        while (ip + match < end && ref[match] == ip[match]) match++;
+        op = put_sequence(op, out + len, anchor, (size_t)(ip - anchor), (size_t)(ip - ref), match);
+        if (!op) return 0;
+        ip += match;
+        anchor = ip;
+    }
+    op = put_sequence(op, out + len, anchor, (size_t)(end - anchor), 0, 0);
+    return op ? (size_t)(op - out) : 0;
+}
+
+static const uint8_t *get_length(const uint8_t *in, const uint8_t *end, size_t *n) {
+    uint8_t byte;
+    do {
+        if (in >= end) return NULL;
+        byte = *in++;
+        *n += byte;
+    } while (byte == 255);
+    return in;
+}
+
+// Expand a compressed record; 1 only when it yields exactly raw_len bytes
+int codec_decompress(const uint8_t *in, size_t len, uint8_t *out, size_t raw_len) {
+    const uint8_t *end = in + len;
+    uint8_t *op = out;
+    uint8_t *op_end = out + raw_len;
+
+    while (in < end) {
+        uint8_t token = *in++;
+        size_t count = token >> 4;
+        if (count == 15 && !(in = get_length(in, end, &count))) return 0;
+        if ((size_t)(end - in) < count || (size_t)(op_end - op) < count) return 0;
+        memcpy(op, in, count);
+        in += count;
+        op += count;
+        if (in == end) break;
+
+        if (end - in < 2) return 0;
+        size_t offset = (size_t)in[0] | (size_t)in[1] << 8;
+        in += 2;
+        size_t match = token & 15;
+        if (match == 15 && !(in = get_length(in, end, &match))) return 0;
+        match += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - out) || (size_t)(op_end - op) < match) return 0;
+
+        // Byte by byte: the reference may overlap what it produces
+        const uint8_t *ref = op - offset;
+        for (size_t i = 0; i < match; i++) op[i] = ref[i];
+        op += match;
+    }
+    return op == op_end;
+}
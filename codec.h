@@ -0,0 +1,28 @@
+// Compact Record Encoding
+// ============================================================================
+
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "insurance_types.h"
+
+// Worst-case encoded sizes: varints take up to 5 (32-bit) or 10 (64-bit)
+// bytes, a text field its used bytes plus a 2-byte length, an amount that
+// is not whole cents a tag and 8 raw bytes. Dictionary IDs take no more
+// than the inline text of version 2 records did
+#define CODEC_EVENT_MAX (5 + 9 + 5 * 2 + 32 * 3 + 16 + 256)
+#define CODEC_BLOCK_MAX (4 * 5 + 10 + 2 * 32 + CODEC_EVENT_MAX)
+#define CODEC_RECORD_MAX(events) (CODEC_BLOCK_MAX + (size_t)(events) * CODEC_EVENT_MAX)
+
+size_t codec_encode_block(const Block *block, uint8_t *out);
+size_t codec_encode_event(const InsurancePayload *event, uint8_t *out);
+const uint8_t* codec_decode_block(const uint8_t *in, const uint8_t *end, Block *block);
+const uint8_t* codec_decode_event(const uint8_t *in, const uint8_t *end, InsurancePayload *event);
+const uint8_t* codec_decode_block_v2(const uint8_t *in, const uint8_t *end, Block *block);
+const uint8_t* codec_decode_event_v2(const uint8_t *in, const uint8_t *end, InsurancePayload *event);
+size_t codec_compress(const uint8_t *in, size_t len, uint8_t *out);
+int codec_decompress(const uint8_t *in, size_t len, uint8_t *out, size_t raw_len);
+
+#endif // CODEC_H
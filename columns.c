@@ -0,0 +1,286 @@
+// Columnar Event Snapshot for Ad-hoc Queries
+// ============================================================================
+//
+// Every event of the chain, one row each, kept as parallel arrays: the
+// block's timestamp, the event type, the amount in cents and the
+// dictionary IDs of its policy, member, provider and diagnosis code.
+// Rows are appended in height order as blocks are linked in, next to the
+// ID indexes, so a query reads only the columns it filters or sums
+// instead of decoding every record.
+//
+// A scan works through SCAN_ROWS rows at a time: each filter ANDs its
+// comparison into a byte mask, then the mask selects what is counted and
+// summed. Every pass is a branch-free loop over one or two arrays, which
+// the compiler vectorizes, and the mask stays in L1 between passes.
+//
+// columns_export writes the snapshot to a file: a ColumnFileHeader, each
+// column in turn, then every dictionary as a count followed by its strings
+// (length byte and text) in ID order, starting at ID 1.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "columns.h"
+
+#define COLUMNS_MAGIC 0x4c434249u  // "IBCL"
+#define COLUMNS_VERSION 1
+#define SCAN_ROWS 4096
+#define ROW_BYTES (2 * sizeof(int64_t) + 1 + DICT_FIELD_COUNT * sizeof(uint32_t))
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t rows;
+} ColumnFileHeader;
+
+static struct {
+    int64_t *timestamps;
+    uint8_t *types;
+    int64_t *cents;
+    uint32_t *keys[DICT_FIELD_COUNT];
+    uint32_t rows;
+    uint32_t capacity;
+} columns;
+
+static int grow_columns() {
+    uint32_t capacity = columns.capacity ? columns.capacity * 2 : 1024;
+    int64_t *timestamps = (int64_t*)realloc(columns.timestamps, capacity * sizeof(int64_t));
+    if (!timestamps) return 0;
+    columns.timestamps = timestamps;
+    uint8_t *types = (uint8_t*)realloc(columns.types, capacity);
+    if (!types) return 0;
+    columns.types = types;
+    int64_t *cents = (int64_t*)realloc(columns.cents, capacity * sizeof(int64_t));
+    if (!cents) return 0;
+    columns.cents = cents;
+    for (int field = 0; field < DICT_FIELD_COUNT; field++) {
+        uint32_t *keys = (uint32_t*)realloc(columns.keys[field], capacity * sizeof(uint32_t));
+        if (!keys) return 0;
+        columns.keys[field] = keys;
+    }
+    columns.capacity = capacity;
+    return 1;
+}
+
+// Append one event as a row; its IDs must have been interned
+int columns_add_event(const InsurancePayload *event, time_t timestamp) {
+    const char *fields[DICT_FIELD_COUNT] = {
+        event->policy_id, event->member_id, event->provider_id, event->diagnosis_code
+    };
+    const size_t widths[DICT_FIELD_COUNT] = {
+        sizeof(event->policy_id), sizeof(event->member_id), sizeof(event->provider_id), sizeof(event->diagnosis_code)
+    };
+    uint32_t keys[DICT_FIELD_COUNT];
+
+    for (int field = 0; field < DICT_FIELD_COUNT; field++) {
+        keys[field] = dict_find((DictField)field, fields[field], strnlen(fields[field], widths[field]));
+        if (keys[field] == DICT_NONE) return 0;
+    }
+    if (columns.rows == columns.capacity && !grow_columns()) return 0;
+
+    double amount = event->amount * 100.0;
+    uint32_t row = columns.rows++;
+    columns.timestamps[row] = (int64_t)timestamp;
+    columns.types[row] = (uint8_t)event->event_type;
+    columns.cents[row] = (int64_t)(amount + (amount < 0 ? -0.5 : 0.5));
+    for (int field = 0; field < DICT_FIELD_COUNT; field++) {
+        columns.keys[field][row] = keys[field];
+    }
+    return 1;
+}
+
+// A query that matches every row, ungrouped
+void columns_query_init(ColumnQuery *query) {
+    query->event_type = COLUMN_ANY;
+    for (int field = 0; field < DICT_FIELD_COUNT; field++) {
+        query->keys[field] = COLUMN_ANY;
+    }
+    query->from = INT64_MIN;
+    query->to = INT64_MAX;
+    query->group = COLUMN_GROUP_NONE;
+}
+
+// mask[i] = 1 for rows [base, base + n) inside the time window
+static void scan_window(const ColumnQuery *query, uint32_t base, uint32_t n, uint8_t *mask) {
+    const int64_t *timestamps = columns.timestamps + base;
+    for (uint32_t i = 0; i < n; i++) {
+        mask[i] = (uint8_t)((timestamps[i] >= query->from) & (timestamps[i] < query->to));
+    }
+}
+
+static void scan_type(uint8_t type, uint32_t base, uint32_t n, uint8_t *mask) {
+    const uint8_t *types = columns.types + base;
+    for (uint32_t i = 0; i < n; i++) {
+        mask[i] &= (uint8_t)(types[i] == type);
+    }
+}
+
+static void scan_key(DictField field, uint32_t key, uint32_t base, uint32_t n, uint8_t *mask) {
+    const uint32_t *keys = columns.keys[field] + base;
+    for (uint32_t i = 0; i < n; i++) {
+        mask[i] &= (uint8_t)(keys[i] == key);
+    }
+}
+
+static void sum_selected(const uint8_t *mask, uint32_t base, uint32_t n, ColumnTotals *total) {
+    const int64_t *cents = columns.cents + base;
+    uint64_t events = 0;
+    int64_t sum = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        events += mask[i];
+        sum += cents[i] & -(int64_t)mask[i];
+    }
+    total->events += events;
+    total->cents += sum;
+}
+
+// Group keys of rows [base, base + n), as dictionary IDs or event types
+static void group_keys(ColumnGroup group, uint32_t base, uint32_t n, uint32_t *out) {
+    if (group == COLUMN_GROUP_TYPE) {
+        for (uint32_t i = 0; i < n; i++) out[i] = columns.types[base + i];
+    } else {
+        memcpy(out, columns.keys[group - COLUMN_GROUP_POLICY] + base, n * sizeof(uint32_t));
+    }
+}
+
+// Count and sum the matching rows. When grouped, *groups receives totals
+// indexed by event type or dictionary ID (*group_count of them), which
+// the caller frees. 0 when out of memory
+int columns_query(const ColumnQuery *query, ColumnTotals *total, ColumnTotals **groups, uint32_t *group_count) {
+    uint8_t mask[SCAN_ROWS];
+    uint32_t keys[SCAN_ROWS];
+    ColumnTotals *by_group = NULL;
+    uint32_t slots = 0;
+
+    memset(total, 0, sizeof(*total));
+    if (query->group != COLUMN_GROUP_NONE) {
+        slots = query->group == COLUMN_GROUP_TYPE ? 256 : dict_count((DictField)(query->group - COLUMN_GROUP_POLICY));
+        by_group = (ColumnTotals*)calloc(slots, sizeof(ColumnTotals));
+        if (!by_group) return 0;
+    }
+
+    for (uint32_t base = 0; base < columns.rows; base += SCAN_ROWS) {
+        uint32_t n = columns.rows - base < SCAN_ROWS ? columns.rows - base : SCAN_ROWS;
+        scan_window(query, base, n, mask);
+        if (query->event_type != COLUMN_ANY) scan_type((uint8_t)query->event_type, base, n, mask);
+        for (int field = 0; field < DICT_FIELD_COUNT; field++) {
+            if (query->keys[field] != COLUMN_ANY) scan_key((DictField)field, query->keys[field], base, n, mask);
+        }
+        sum_selected(mask, base, n, total);
+
+        if (by_group) {
+            const int64_t *cents = columns.cents + base;
+            group_keys(query->group, base, n, keys);
+            for (uint32_t i = 0; i < n; i++) {
+                by_group[keys[i]].events += mask[i];
+                by_group[keys[i]].cents += cents[i] & -(int64_t)mask[i];
+            }
+        }
+    }
+
+    if (groups) {
+        *groups = by_group;
+        *group_count = slots;
+    } else {
+        free(by_group);
+    }
+    return 1;
+}
+
+// Write the snapshot and the dictionaries its IDs refer to
+int columns_export(const char *path) {
+    ColumnFileHeader header = { COLUMNS_MAGIC, COLUMNS_VERSION, columns.rows };
+    FILE *fp = fopen(path, "wb");
+    if (!fp) return 0;
+
+    size_t rows = columns.rows;
+    int ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+             fwrite(columns.timestamps, sizeof(int64_t), rows, fp) == rows &&
+             fwrite(columns.types, 1, rows, fp) == rows &&
+             fwrite(columns.cents, sizeof(int64_t), rows, fp) == rows;
+    for (int field = 0; ok && field < DICT_FIELD_COUNT; field++) {
+        ok = fwrite(columns.keys[field], sizeof(uint32_t), rows, fp) == rows;
+    }
+    for (int field = 0; ok && field < DICT_FIELD_COUNT; field++) {
+        uint32_t count = dict_count((DictField)field) - 1;
+        ok = fwrite(&count, sizeof(count), 1, fp) == 1;
+        for (uint32_t id = 1; ok && id <= count; id++) {
+            size_t length;
+            const char *text = dict_string((DictField)field, id, &length);
+            uint8_t prefix = (uint8_t)length;
+            ok = fwrite(&prefix, 1, 1, fp) == 1 && fwrite(text, 1, length, fp) == length;
+        }
+    }
+    return fclose(fp) == 0 && ok;
+}
+
+// Bytes columns_snapshot_save will write
+size_t columns_snapshot_size() {
+    return sizeof(uint32_t) + (size_t)columns.rows * ROW_BYTES;
+}
+
+// The row count, then each column in the order of the export file
+uint8_t* columns_snapshot_save(uint8_t *out) {
+    size_t rows = columns.rows;
+    memcpy(out, &columns.rows, sizeof(uint32_t));
+    out += sizeof(uint32_t);
+    if (rows == 0) return out;
+    memcpy(out, columns.timestamps, rows * sizeof(int64_t));
+    out += rows * sizeof(int64_t);
+    memcpy(out, columns.types, rows);
+    out += rows;
+    memcpy(out, columns.cents, rows * sizeof(int64_t));
+    out += rows * sizeof(int64_t);
+    for (int field = 0; field < DICT_FIELD_COUNT; field++) {
+        memcpy(out, columns.keys[field], rows * sizeof(uint32_t));
+        out += rows * sizeof(uint32_t);
+    }
+    return out;
+}
+
+// Restore what columns_snapshot_save wrote into empty columns. NULL when
+// the bytes are malformed or memory runs out
+const uint8_t* columns_snapshot_load(const uint8_t *in, const uint8_t *end) {
+    uint32_t rows;
+    if ((size_t)(end - in) < sizeof(rows)) return NULL;
+    memcpy(&rows, in, sizeof(rows));
+    in += sizeof(rows);
+    if ((size_t)(end - in) / ROW_BYTES < rows) return NULL;
+    while (columns.capacity < rows) {
+        if (!grow_columns()) return NULL;
+    }
+    if (rows == 0) return in;
+
+    memcpy(columns.timestamps, in, rows * sizeof(int64_t));
+    in += (size_t)rows * sizeof(int64_t);
+    memcpy(columns.types, in, rows);
+    in += rows;
+    memcpy(columns.cents, in, rows * sizeof(int64_t));
+    in += (size_t)rows * sizeof(int64_t);
+    for (int field = 0; field < DICT_FIELD_COUNT; field++) {
+        memcpy(columns.keys[field], in, rows * sizeof(uint32_t));
+        in += (size_t)rows * sizeof(uint32_t);
+    }
+    columns.rows = rows;
+    return in;
+}
+
+uint32_t columns_rows() {
+    return columns.rows;
+}
+
+// Memory held by the columns
+size_t columns_bytes() {
+    return (size_t)columns.capacity * ROW_BYTES;
+}
+
+// Drop every row, e.g. before a rebuild
+void columns_reset() {
+    free(columns.timestamps);
+    free(columns.types);
+    free(columns.cents);
+    for (int field = 0; field < DICT_FIELD_COUNT; field++) {
+        free(columns.keys[field]);
+    }
+    memset(&columns, 0, sizeof(columns));
+}
@@ -0,0 +1,51 @@
+// Columnar Event Snapshot for Ad-hoc Queries
+// ============================================================================
+
+#ifndef COLUMNS_H
+#define COLUMNS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "insurance_types.h"
+#include "dict.h"
+
+// Matches any value
+#define COLUMN_ANY UINT32_MAX
+
+typedef enum {
+    COLUMN_GROUP_NONE,
+    COLUMN_GROUP_TYPE,
+    COLUMN_GROUP_POLICY,
+    COLUMN_GROUP_MEMBER,
+    COLUMN_GROUP_PROVIDER,
+    COLUMN_GROUP_DIAGNOSIS
+} ColumnGroup;
+
+// Events of a type (or COLUMN_ANY), with the given dictionary IDs (or
+// COLUMN_ANY), in blocks stamped within [from, to)
+typedef struct {
+    uint32_t event_type;
+    uint32_t keys[DICT_FIELD_COUNT];
+    int64_t from;
+    int64_t to;
+    ColumnGroup group;
+} ColumnQuery;
+
+typedef struct {
+    uint64_t events;
+    int64_t cents;
+} ColumnTotals;
+
+int columns_add_event(const InsurancePayload *event, time_t timestamp);
+void columns_query_init(ColumnQuery *query);
+int columns_query(const ColumnQuery *query, ColumnTotals *total, ColumnTotals **groups, uint32_t *group_count);
+int columns_export(const char *path);
+size_t columns_snapshot_size();
+uint8_t* columns_snapshot_save(uint8_t *out);
+const uint8_t* columns_snapshot_load(const uint8_t *in, const uint8_t *end);
+uint32_t columns_rows();
+size_t columns_bytes();
+void columns_reset();
+
+#endif // COLUMNS_H
@@ -0,0 +1,601 @@
+// Daemon Mode over a Unix Domain Socket
+// ============================================================================
+//
+// One process owns the chain and serves local clients on a socket. Each
+// request is a single line:
+//
+//   event <csv row | json object>    record an event (same fields as import)
+//   save                             seal a partial batch and sync the log
+//   batch <events> [seconds]         events per block, as in the CLI
+//   view [--from H] [--to H] | --tail N | --page N [--page-size K]
+//   verify [--since-checkpoint]
+//   history policy|member|provider <id>
+//   summary <policy> | --all
+//   query [type=T] [policy|member|provider|diagnosis=ID] [from=DATE] [to=DATE] [by=FIELD]
+//   query --export <file>
+//   claims [open | aging]
+//   stats
+//   quit
+//
+// Each response is a status line, "OK" or "ERR <reason>", then the
+// command's output, then a line holding a single ".". Output lines that
+// start with "." get a second one, as in SMTP.
+//
+// Writes go through one queue to a single writer thread that mines and
+// appends them in arrival order. Reads run on the client's own thread
+// under the chain's read lock, so any number of them proceed while the
+// writer is mining.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "daemon.h"
+#include "blockchain.h"
+#include "import.h"
+#include "queue.h"
+#include "metrics.h"
+
+#define DAEMON_MAX_CLIENTS 64
+#define DAEMON_QUEUE_DEPTH 256
+#define DAEMON_MAX_LINE 2048
+
+typedef enum {
+    JOB_EVENT,
+    JOB_SAVE,
+    JOB_BATCH
+} JobKind;
+
+// One write request, owned by the client thread waiting on it
+typedef struct {
+    JobKind kind;
+    InsurancePayload payload;
+    uint32_t batch_events;
+    uint32_t batch_seconds;
+    int ok;
+    char *output;
+    size_t output_size;
+    int done;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+} WriteJob;
+
+typedef struct {
+    const char *chain_file;
+    BoundedQueue writes;
+    pthread_mutex_t verify_lock;   // verify also rewrites the checkpoint
+    pthread_mutex_t clients_lock;
+    pthread_cond_t clients_gone;
+    int client_fds[DAEMON_MAX_CLIENTS];
+    uint32_t clients;
+} Server;
+
+typedef struct {
+    Server *server;
+    int fd;
+} Client;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void on_signal(int sig) {
+    (void)sig;
+    stopping = 1;
+}
+
+static int send_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        data += n;
+        len -= (size_t)n;
+    }
+    return 1;
+}
+
+// Status line, dot-stuffed body and the terminating "." in one send
+static int send_response(int fd, const char *error, const char *body, size_t len) {
+    char *buffer = NULL;
+    size_t size = 0;
+    FILE *fp = open_memstream(&buffer, &size);
+    if (!fp) return 0;
+
+    if (error) {
+        fprintf(fp, "ERR %s\n", error);
+    } else {
+        fprintf(fp, "OK\n");
+    }
+    int line_start = 1;
+    for (size_t i = 0; i < len; i++) {
+        if (line_start && body[i] == '.') fputc('.', fp);
+        fputc(body[i], fp);
+        line_start = body[i] == '\n';
+    }
+    if (!line_start) fputc('\n', fp);
+    fprintf(fp, ".\n");
+    fclose(fp);
+
+    int sent = send_all(fd, buffer, size);
+    free(buffer);
+    return sent;
+}
+
+static void run_job(Server *server, WriteJob *job) {
+    FILE *fp = open_memstream(&job->output, &job->output_size);
+    blockchain_set_output(fp);
+
+    switch (job->kind) {
+        case JOB_EVENT:
+            job->ok = blockchain_add_block(job->payload);
+            break;
+        case JOB_SAVE:
+            blockchain_save(server->chain_file);
+            job->ok = 1;
+            break;
+        case JOB_BATCH:
+            blockchain_set_batching(job->batch_events, job->batch_seconds);
+            if (fp) fprintf(fp, "Sealing blocks at %u event(s)\n", job->batch_events);
+            job->ok = 1;
+            break;
+    }
+
+    blockchain_set_output(NULL);
+    if (fp) fclose(fp);
+}
+
+// The only thread that mines or appends. It wakes at least once a second
+// so a partial batch still seals on time when no requests arrive
+static void* writer_thread(void *arg) {
+    Server *server = (Server*)arg;
+    void *item;
+
+    for (;;) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += 1;
+
+        int popped = queue_pop_until(&server->writes, &item, &deadline);
+        if (popped == 0) break;
+        blockchain_seal_if_due();
+        if (popped < 0) continue;
+
+        WriteJob *job = (WriteJob*)item;
+        run_job(server, job);
+        pthread_mutex_lock(&job->lock);
+        job->done = 1;
+        pthread_cond_signal(&job->finished);
+        pthread_mutex_unlock(&job->lock);
+    }
+    return NULL;
+}
+
+// Hand a write to the writer thread and wait for its result
+static void submit_write(Server *server, int fd, WriteJob *job) {
+    job->done = 0;
+    job->ok = 0;
+    job->output = NULL;
+    job->output_size = 0;
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->finished, NULL);
+
+    if (!queue_push(&server->writes, job)) {
+        send_response(fd, "server is shutting down", NULL, 0);
+    } else {
+        pthread_mutex_lock(&job->lock);
+        while (!job->done) pthread_cond_wait(&job->finished, &job->lock);
+        pthread_mutex_unlock(&job->lock);
+        send_response(fd, job->ok ? NULL : "write failed", job->output, job->output ? job->output_size : 0);
+    }
+
+    free(job->output);
+    pthread_mutex_destroy(&job->lock);
+    pthread_cond_destroy(&job->finished);
+}
+
+// Run a read on this thread under the read lock. Returns 0 with error
+// set when the request is malformed; ok is cleared, also with error set,
+// when the read itself fails
+static int run_read(Server *server, const char *command, const char *args, int *ok, const char **error) {
+    char kind[16] = "";
+    char id[64] = "";
+    IndexField field = INDEX_POLICY;
+
+    *ok = 1;
+    if (strcmp(command, "history") == 0 &&
+        (sscanf(args, "%15s %63s", kind, id) != 2 || !string_to_index_field(kind, &field))) {
+        *error = "usage: history policy|member|provider <id>";
+        return 0;
+    }
+    if (strcmp(command, "summary") == 0 && sscanf(args, "%63s", id) != 1) {
+        *error = "usage: summary <policy> | --all";
+        return 0;
+    }
+    if (strcmp(command, "verify") == 0 && args[0] && strcmp(args, "--since-checkpoint") != 0 &&
+        strcmp(args, "--full") != 0) {
+        *error = "usage: verify [--full | --since-checkpoint]";
+        return 0;
+    }
+
+    blockchain_read_lock();
+    if (strcmp(command, "view") == 0) {
+        if (!blockchain_view_args(args)) {
+            *ok = 0;
+            *error = "usage: view [--from H] [--to H] | --tail N | --page N [--page-size K]";
+        }
+    } else if (strcmp(command, "history") == 0) {
+        blockchain_history(field, id);
+    } else if (strcmp(command, "query") == 0) {
+        if (!blockchain_query_args(args)) {
+            *ok = 0;
+            *error = "usage: query [type=T] [policy|member|provider|diagnosis=ID] [from=DATE] [to=DATE] "
+                     "[by=FIELD] | --export <file>";
+        }
+    } else if (strcmp(command, "claims") == 0) {
+        if (!blockchain_claims_args(args)) {
+            *ok = 0;
+            *error = "usage: claims [open | aging]";
+        }
+    } else if (strcmp(command, "summary") == 0) {
+        if (strcmp(id, "--all") == 0) {
+            blockchain_summary_all();
+        } else {
+            blockchain_summary(id);
+        }
+    } else {
+        pthread_mutex_lock(&server->verify_lock);
+        if (strcmp(args, "--since-checkpoint") == 0) {
+            *ok = blockchain_verify_since_checkpoint(server->chain_file);
+        } else {
+            *ok = blockchain_verify_full(server->chain_file);
+        }
+        if (!*ok) *error = "verification failed";
+        pthread_mutex_unlock(&server->verify_lock);
+    }
+    blockchain_read_unlock();
+    return 1;
+}
+
+// Serve one request line. Returns 0 when the client asked to quit
+static int handle_request(Server *server, int fd, char *line) {
+    char *command = line;
+    char *args;
+
+    line[strcspn(line, "\r\n")] = '\0';
+    while (*command == ' ' || *command == '\t') command++;
+    args = command + strcspn(command, " \t");
+    if (*args) *args++ = '\0';
+    while (*args == ' ' || *args == '\t') args++;
+
+    if (strcmp(command, "quit") == 0) {
+        send_response(fd, NULL, NULL, 0);
+        return 0;
+    }
+
+    if (strcmp(command, "stats") == 0) {
+        char *output = NULL;
+        size_t size = 0;
+        FILE *fp = open_memstream(&output, &size);
+        if (!fp) {
+            send_response(fd, "out of memory", NULL, 0);
+            return 1;
+        }
+        metrics_print(fp);
+        fclose(fp);
+        send_response(fd, NULL, output, size);
+        free(output);
+        return 1;
+    }
+
+    if (strcmp(command, "view") == 0 || strcmp(command, "verify") == 0 ||
+        strcmp(command, "history") == 0 || strcmp(command, "summary") == 0 ||
+        strcmp(command, "query") == 0 || strcmp(command, "claims") == 0) {
+        char *output = NULL;
+        size_t size = 0;
+        const char *error = NULL;
+        int ok;
+        FILE *fp = open_memstream(&output, &size);
+        if (!fp) {
+            send_response(fd, "out of memory", NULL, 0);
+            return 1;
+        }
+
+        blockchain_set_output(fp);
+        int valid = run_read(server, command, args, &ok, &error);
+        blockchain_set_output(NULL);
+        fclose(fp);
+
+        if (!valid) {
+            send_response(fd, error, NULL, 0);
+        } else {
+            send_response(fd, ok ? NULL : error, output, size);
+        }
+        free(output);
+        return 1;
+    }
+
+    WriteJob job;
+    memset(&job, 0, sizeof(job));
+    if (strcmp(command, "event") == 0) {
+        char error[128];
+        if (!import_parse_event(args, &job.payload, error, sizeof(error))) {
+            send_response(fd, error, NULL, 0);
+            return 1;
+        }
+        job.kind = JOB_EVENT;
+    } else if (strcmp(command, "save") == 0) {
+        job.kind = JOB_SAVE;
+    } else if (strcmp(command, "batch") == 0) {
+        unsigned int events = 0;
+        unsigned int seconds = 0;
+        if (sscanf(args, "%u %u", &events, &seconds) < 1 || events == 0) {
+            send_response(fd, "usage: batch <events> [seconds]", NULL, 0);
+            return 1;
+        }
+        job.kind = JOB_BATCH;
+        job.batch_events = events;
+        job.batch_seconds = seconds;
+    } else {
+        send_response(fd, "unknown command", NULL, 0);
+        return 1;
+    }
+    submit_write(server, fd, &job);
+    return 1;
+}
+
+static void* client_thread(void *arg) {
+    Client *client = (Client*)arg;
+    Server *server = client->server;
+    FILE *in = fdopen(client->fd, "r");
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t len;
+
+    if (in) {
+        while ((len = getline(&line, &capacity, in)) > 0) {
+            if (len >= DAEMON_MAX_LINE) {
+                send_response(client->fd, "request too long", NULL, 0);
+                continue;
+            }
+            if (!handle_request(server, client->fd, line)) break;
+        }
+        free(line);
+    }
+
+    pthread_mutex_lock(&server->clients_lock);
+    for (uint32_t i = 0; i < DAEMON_MAX_CLIENTS; i++) {
+        if (server->client_fds[i] == client->fd) server->client_fds[i] = -1;
+    }
+    server->clients--;
+    pthread_cond_signal(&server->clients_gone);
+    pthread_mutex_unlock(&server->clients_lock);
+
+    if (in) {
+        fclose(in);
+    } else {
+        close(client->fd);
+    }
+    free(client);
+    return NULL;
+}
+
+// Start a detached thread for a new connection, or turn it away when the
+// server is full
+static void accept_client(Server *server, int fd) {
+    Client *client = (Client*)malloc(sizeof(Client));
+    pthread_t tid;
+    int slot = -1;
+
+    pthread_mutex_lock(&server->clients_lock);
+    for (int i = 0; i < DAEMON_MAX_CLIENTS && client; i++) {
+        if (server->client_fds[i] < 0) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot >= 0) {
+        server->client_fds[slot] = fd;
+        server->clients++;
+    }
+    pthread_mutex_unlock(&server->clients_lock);
+
+    if (slot < 0) {
+        send_response(fd, "server busy", NULL, 0);
+        close(fd);
+        free(client);
+        return;
+    }
+
+    client->server = server;
+    client->fd = fd;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&tid, &attr, client_thread, client) != 0) {
+        // No thread to serve it; release the slot as the thread would
+        pthread_mutex_lock(&server->clients_lock);
+        server->client_fds[slot] = -1;
+        server->clients--;
+        pthread_mutex_unlock(&server->clients_lock);
+        send_response(fd, "server busy", NULL, 0);
+        close(fd);
+        free(client);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+static int open_socket(const char *socket_path) {
+    struct sockaddr_un addr;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        printf("Error: Socket path %s is too long\n", socket_path);
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        printf("Error: Could not create socket\n");
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    // A socket file left by a previous run would make bind fail
+    unlink(socket_path);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, DAEMON_MAX_CLIENTS) != 0) {
+        printf("Error: Could not listen on %s: %s\n", socket_path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    // Owner only: the chain holds member data
+    chmod(socket_path, 0600);
+    return fd;
+}
+
+// Serve the chain in chain_file on socket_path until SIGINT or SIGTERM
+int daemon_run(const char *socket_path, const char *chain_file) {
+    Server server;
+    pthread_t writer;
+
+    memset(&server, 0, sizeof(server));
+    server.chain_file = chain_file;
+    for (int i = 0; i < DAEMON_MAX_CLIENTS; i++) server.client_fds[i] = -1;
+
+    blockchain_init(16);
+    // Serving a fresh chain would replace a log that failed to load
+    if (!blockchain_load(chain_file)) {
+        printf("Error: Not serving %s, which exists but could not be loaded\n", chain_file);
+        blockchain_cleanup();
+        return 0;
+    }
+    // Attach the log so every block is appended as it is mined
+    blockchain_save(chain_file);
+    if (!blockchain_is_attached()) {
+        blockchain_cleanup();
+        return 0;
+    }
+
+    int listen_fd = open_socket(socket_path);
+    if (listen_fd < 0 || !queue_init(&server.writes, DAEMON_QUEUE_DEPTH)) {
+        if (listen_fd >= 0) close(listen_fd);
+        blockchain_cleanup();
+        return 0;
+    }
+    pthread_mutex_init(&server.verify_lock, NULL);
+    pthread_mutex_init(&server.clients_lock, NULL);
+    pthread_cond_init(&server.clients_gone, NULL);
+
+    if (pthread_create(&writer, NULL, writer_thread, &server) != 0) {
+        printf("Error: Could not start the writer thread\n");
+        close(listen_fd);
+        unlink(socket_path);
+        queue_destroy(&server.writes);
+        blockchain_cleanup();
+        return 0;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("Serving %s on %s (pid %d)\n", chain_file, socket_path, (int)getpid());
+    fflush(stdout);
+
+    while (!stopping) {
+        struct pollfd pfd = { listen_fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 500) <= 0) continue;
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd >= 0) accept_client(&server, fd);
+    }
+
+    printf("Shutting down...\n");
+    close(listen_fd);
+    unlink(socket_path);
+
+    // Let each client finish its current request, then stop reading
+    pthread_mutex_lock(&server.clients_lock);
+    for (int i = 0; i < DAEMON_MAX_CLIENTS; i++) {
+        if (server.client_fds[i] >= 0) shutdown(server.client_fds[i], SHUT_RD);
+    }
+    while (server.clients > 0) pthread_cond_wait(&server.clients_gone, &server.clients_lock);
+    pthread_mutex_unlock(&server.clients_lock);
+
+    queue_close(&server.writes);
+    pthread_join(writer, NULL);
+    queue_destroy(&server.writes);
+
+    blockchain_save(chain_file);
+    blockchain_cleanup();
+    pthread_mutex_destroy(&server.verify_lock);
+    pthread_mutex_destroy(&server.clients_lock);
+    pthread_cond_destroy(&server.clients_gone);
+    return 1;
+}
+
+// Send each line of stdin as a request and print the responses. Returns
+// 0 if the server could not be reached or any request failed
+int daemon_client(const char *socket_path) {
+    struct sockaddr_un addr;
+    char *line = NULL;
+    size_t capacity = 0;
+    int all_ok = 1;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: Socket path %s is too long\n", socket_path);
+        return 0;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "Error: Could not connect to %s\n", socket_path);
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+    FILE *in = fdopen(fd, "r");
+    if (!in) {
+        close(fd);
+        return 0;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    while (getline(&line, &capacity, stdin) > 0) {
+        size_t len = strcspn(line, "\n");
+        if (len == 0) continue;
+        line[len] = '\n';
+        if (!send_all(fd, line, len + 1)) {
+            fprintf(stderr, "Error: Connection closed by server\n");
+            all_ok = 0;
+            break;
+        }
+
+        // Status line, then the body up to the lone "."
+        if (getline(&line, &capacity, in) <= 0) {
+            fprintf(stderr, "Error: Connection closed by server\n");
+            all_ok = 0;
+            break;
+        }
+        if (strncmp(line, "OK", 2) != 0) {
+            fprintf(stderr, "%s", line);
+            all_ok = 0;
+        }
+        while (getline(&line, &capacity, in) > 0 && strcmp(line, ".\n") != 0) {
+            fputs(line[0] == '.' ? line + 1 : line, stdout);
+        }
+        fflush(stdout);
+    }
+
+    free(line);
+    fclose(in);
+    return all_ok;
+}
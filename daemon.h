@@ -0,0 +1,12 @@
+// Daemon Mode over a Unix Domain Socket
+// ============================================================================
+
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#define DAEMON_SOCKET "insurance_blockchain.sock"
+
+int daemon_run(const char *socket_path, const char *chain_file);
+int daemon_client(const char *socket_path);
+
+#endif // DAEMON_H
@@ -0,0 +1,225 @@
+// String Dictionary for Repeated Event Fields
+// ============================================================================
+//
+// Policy, member and provider IDs and diagnosis codes repeat from event to
+// event, so records store a small integer per field instead of the text
+// (see codec.c) and the ID indexes are keyed by it. Each field has its own
+// dictionary: IDs are handed out in order of first use, 0 being the empty
+// string, and are never reused until the whole dictionary is reset. The
+// log persists the strings in that order (see storage.c), so a reloaded
+// dictionary hands out the same IDs.
+//
+// Strings live in fixed pages that never move, so dict_string takes no
+// lock; a reader only meets an ID after the record using it was linked
+// in. Interning and lookups by text share a lock over the hash table.
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "dict.h"
+
+#define DICT_PAGE_SIZE 4096
+#define DICT_MAX_PAGES 4096
+#define DICT_INITIAL_SLOTS 1024
+#define DICT_CHUNK_SIZE (64 * 1024)
+
+// A string is stored as its length byte, the text and a NUL
+typedef struct {
+    const uint8_t **pages[DICT_MAX_PAGES];  // ID -> string, page by page
+    _Atomic uint32_t count;                 // IDs handed out, 0 included
+    uint32_t *slots;                        // hash table of IDs; 0 marks a free slot
+    uint32_t slot_count;                    // always a power of two
+} Dictionary;
+
+static Dictionary dictionaries[DICT_FIELD_COUNT];
+static pthread_rwlock_t dict_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+// Chunked string storage shared by every field
+static uint8_t **chunks = NULL;
+static uint32_t chunk_count = 0;
+static uint8_t *chunk_next = NULL;
+static size_t chunk_free = 0;
+static size_t allocated = 0;
+
+static const uint8_t empty_string[2] = { 0, 0 };
+
+// FNV-1a
+static uint32_t hash_text(const char *text, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t)text[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static const uint8_t* entry(const Dictionary *dict, uint32_t id) {
+    return dict->pages[id / DICT_PAGE_SIZE][id % DICT_PAGE_SIZE];
+}
+
+// Slot holding text's ID, or the free slot where it belongs
+static uint32_t* find_slot(const Dictionary *dict, const char *text, size_t length) {
+    uint32_t i = hash_text(text, length) & (dict->slot_count - 1);
+    for (;; i = (i + 1) & (dict->slot_count - 1)) {
+        uint32_t id = dict->slots[i];
+        if (id == 0) return &dict->slots[i];
+        const uint8_t *stored = entry(dict, id);
+        if (stored[0] == length && memcmp(stored + 1, text, length) == 0) return &dict->slots[i];
+    }
+}
+
+// Double the table once it is 70% full
+static int grow_slots(Dictionary *dict) {
+    uint32_t slot_count = dict->slot_count ? dict->slot_count * 2 : DICT_INITIAL_SLOTS;
+    uint32_t *slots = (uint32_t*)calloc(slot_count, sizeof(uint32_t));
+    if (!slots) return 0;
+
+    uint32_t *old = dict->slots;
+    uint32_t old_count = dict->slot_count;
+    dict->slots = slots;
+    dict->slot_count = slot_count;
+    for (uint32_t i = 0; i < old_count; i++) {
+        if (old[i] != 0) {
+            const uint8_t *stored = entry(dict, old[i]);
+            *find_slot(dict, (const char*)stored + 1, stored[0]) = old[i];
+        }
+    }
+    free(old);
+    allocated += (size_t)(slot_count - old_count) * sizeof(uint32_t);
+    return 1;
+}
+
+static uint8_t* store_text(const char *text, size_t length) {
+    if (chunk_free < length + 2) {
+        uint8_t **grown = (uint8_t**)realloc(chunks, (chunk_count + 1) * sizeof(uint8_t*));
+        if (!grown) return NULL;
+        chunks = grown;
+        uint8_t *chunk = (uint8_t*)malloc(DICT_CHUNK_SIZE);
+        if (!chunk) return NULL;
+        chunks[chunk_count++] = chunk;
+        chunk_next = chunk;
+        chunk_free = DICT_CHUNK_SIZE;
+        allocated += DICT_CHUNK_SIZE;
+    }
+    uint8_t *stored = chunk_next;
+    stored[0] = (uint8_t)length;
+    memcpy(stored + 1, text, length);
+    stored[length + 1] = '\0';
+    chunk_next += length + 2;
+    chunk_free -= length + 2;
+    return stored;
+}
+
+// ID of text in field's dictionary, adding it if new. DICT_NONE when it
+// is too long or memory runs out. Only the writer interns
+uint32_t dict_intern(DictField field, const char *text, size_t length) {
+    Dictionary *dict = &dictionaries[field];
+
+    if (length == 0) return 0;
+    if (length > DICT_MAX_LENGTH) return DICT_NONE;
+
+    pthread_rwlock_wrlock(&dict_lock);
+    uint32_t count = atomic_load(&dict->count);
+    if (count == 0) count = 1;  // ID 0 is taken by the empty string
+    if ((count + 1) * 10 > dict->slot_count * 7 && !grow_slots(dict)) {
+        pthread_rwlock_unlock(&dict_lock);
+        return DICT_NONE;
+    }
+    uint32_t *slot = find_slot(dict, text, length);
+    if (*slot != 0) {
+        uint32_t id = *slot;
+        pthread_rwlock_unlock(&dict_lock);
+        return id;
+    }
+
+    uint32_t page = count / DICT_PAGE_SIZE;
+    if (page < DICT_MAX_PAGES && !dict->pages[page]) {
+        dict->pages[page] = (const uint8_t**)calloc(DICT_PAGE_SIZE, sizeof(uint8_t*));
+        if (dict->pages[page]) {
+            allocated += DICT_PAGE_SIZE * sizeof(uint8_t*);
+            if (page == 0) dict->pages[0][0] = empty_string;
+        }
+    }
+    const uint8_t *stored = page < DICT_MAX_PAGES && dict->pages[page] ? store_text(text, length) : NULL;
+    if (!stored) {
+        pthread_rwlock_unlock(&dict_lock);
+        return DICT_NONE;
+    }
+    dict->pages[page][count % DICT_PAGE_SIZE] = stored;
+    *slot = count;
+    atomic_store(&dict->count, count + 1);  // publishes the entry
+    pthread_rwlock_unlock(&dict_lock);
+    return count;
+}
+
+// ID of text if the dictionary holds it, DICT_NONE otherwise
+uint32_t dict_find(DictField field, const char *text, size_t length) {
+    const Dictionary *dict = &dictionaries[field];
+    uint32_t id = DICT_NONE;
+
+    if (length == 0) return 0;
+    if (length > DICT_MAX_LENGTH) return DICT_NONE;
+
+    pthread_rwlock_rdlock(&dict_lock);
+    if (dict->slot_count > 0) {
+        uint32_t found = *find_slot(dict, text, length);
+        if (found != 0) id = found;
+    }
+    pthread_rwlock_unlock(&dict_lock);
+    return id;
+}
+
+// NUL-terminated string for id, or NULL when the dictionary has no such ID
+const char* dict_string(DictField field, uint32_t id, size_t *length) {
+    const Dictionary *dict = &dictionaries[field];
+
+    if (id == 0) {
+        if (length) *length = 0;
+        return (const char*)empty_string + 1;
+    }
+    if (id >= atomic_load(&dict->count)) return NULL;
+    const uint8_t *stored = entry(dict, id);
+    if (length) *length = stored[0];
+    return (const char*)stored + 1;
+}
+
+// IDs in use, the empty string's included
+uint32_t dict_count(DictField field) {
+    uint32_t count = atomic_load(&dictionaries[field].count);
+    return count ? count : 1;
+}
+
+// Memory held by every dictionary
+size_t dict_bytes() {
+    pthread_rwlock_rdlock(&dict_lock);
+    size_t bytes = allocated + chunk_count * sizeof(uint8_t*);
+    pthread_rwlock_unlock(&dict_lock);
+    return bytes;
+}
+
+// Forget every string, e.g. before another chain is loaded. No reader
+// may be decoding records meanwhile
+void dict_reset() {
+    pthread_rwlock_wrlock(&dict_lock);
+    for (int field = 0; field < DICT_FIELD_COUNT; field++) {
+        Dictionary *dict = &dictionaries[field];
+        for (uint32_t page = 0; page < DICT_MAX_PAGES && dict->pages[page]; page++) {
+            free(dict->pages[page]);
+            dict->pages[page] = NULL;
+        }
+        free(dict->slots);
+        dict->slots = NULL;
+        dict->slot_count = 0;
+        atomic_store(&dict->count, 0);
+    }
+    for (uint32_t i = 0; i < chunk_count; i++) {
+        free(chunks[i]);
+    }
+    free(chunks);
+    chunks = NULL;
+    chunk_count = 0;
+    chunk_next = NULL;
+    chunk_free = 0;
+    allocated = 0;
+    pthread_rwlock_unlock(&dict_lock);
+}
@@ -0,0 +1,31 @@
+// String Dictionary for Repeated Event Fields
+// ============================================================================
+
+#ifndef DICT_H
+#define DICT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    DICT_POLICY,
+    DICT_MEMBER,
+    DICT_PROVIDER,
+    DICT_DIAGNOSIS,
+    DICT_FIELD_COUNT
+} DictField;
+
+// No such string; ID 0 is always the empty string
+#define DICT_NONE UINT32_MAX
+
+// Longest string a dictionary holds (the widest interned payload field)
+#define DICT_MAX_LENGTH 32
+
+uint32_t dict_intern(DictField field, const char *text, size_t length);
+uint32_t dict_find(DictField field, const char *text, size_t length);
+const char* dict_string(DictField field, uint32_t id, size_t *length);
+uint32_t dict_count(DictField field);
+size_t dict_bytes();
+void dict_reset();
+
+#endif // DICT_H
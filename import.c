@@ -0,0 +1,487 @@
+// Bulk Import of Event Files
+// ============================================================================
+//
+// Records flow through four stages, each on its own thread, connected by
+// bounded queues so a slow stage applies back-pressure instead of letting
+// the file pile up in memory:
+//
+//   parse -> validate -> mine -> persist
+//
+// Input is CSV or JSON Lines, decided per line: a line starting with '{'
+// is a JSON object, anything else a CSV row. Both carry the fields
+//
+//   event_type,policy_id,member_id,provider_id,amount,diagnosis_code,notes
+//
+// in that order for CSV (an optional header row naming them is skipped,
+// quoted fields may contain commas). Bad records are reported with their
+// line number and skipped; the rest of the batch carries on. With
+// batching enabled the mine stage packs events into batched blocks, so
+// only sealed blocks travel on to the persist stage.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <time.h>
+#include "import.h"
+#include "blockchain.h"
+#include "validation.h"
+#include "queue.h"
+
+#define IMPORT_QUEUE_DEPTH 256
+#define IMPORT_MAX_LINE 2048
+#define IMPORT_FIELDS 7
+
+typedef struct {
+    uint32_t line;
+    InsurancePayload payload;
+    char error[128];
+    Block block;
+} ImportRecord;
+
+typedef enum {
+    STAGE_PARSE,
+    STAGE_VALIDATE,
+    STAGE_MINE,
+    STAGE_PERSIST,
+    STAGE_COUNT
+} ImportStage;
+
+static const char *stage_names[STAGE_COUNT] = { "parse", "validate", "mine", "persist" };
+
+typedef struct {
+    FILE *fp;
+    BoundedQueue parsed;
+    BoundedQueue validated;
+    BoundedQueue mined;
+    uint32_t records[STAGE_COUNT];
+    double busy[STAGE_COUNT];     // seconds spent working, not waiting on queues
+    uint32_t rejected;
+    uint32_t failed;
+    uint32_t imported;   // events in persisted blocks
+    uint32_t blocks;
+} ImportPipeline;
+
+static const char *field_names[IMPORT_FIELDS] = {
+    "event_type", "policy_id", "member_id", "provider_id", "amount", "diagnosis_code", "notes"
+};
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int copy_field(char *dest, size_t size, const char *value, ImportRecord *record, const char *name) {
+    if (strlen(value) >= size) {
+        snprintf(record->error, sizeof(record->error), "%s longer than %zu characters", name, size - 1);
+        return 0;
+    }
+    strcpy(dest, value);
+    return 1;
+}
+
+// Store one named field into the record's payload
+static int assign_field(ImportRecord *record, int field, const char *value) {
+    InsurancePayload *payload = &record->payload;
+    char *end;
+
+    switch (field) {
+        case 0:
+            // string_to_event_type falls back to ENROLLMENT; reject anything
+            // that does not round-trip
+            payload->event_type = string_to_event_type(value);
+            if (strcmp(event_type_to_string(payload->event_type), value) != 0) {
+                snprintf(record->error, sizeof(record->error), "unknown event type '%.40s'", value);
+                return 0;
+            }
+            return 1;
+        case 1: return copy_field(payload->policy_id, sizeof(payload->policy_id), value, record, field_names[field]);
+        case 2: return copy_field(payload->member_id, sizeof(payload->member_id), value, record, field_names[field]);
+        case 3: return copy_field(payload->provider_id, sizeof(payload->provider_id), value, record, field_names[field]);
+        case 4:
+            payload->amount = value[0] ? strtod(value, &end) : 0.0;
+            if (value[0] && *end != '\0') {
+                snprintf(record->error, sizeof(record->error), "amount '%.40s' is not a number", value);
+                return 0;
+            }
+            return 1;
+        case 5: return copy_field(payload->diagnosis_code, sizeof(payload->diagnosis_code), value, record, field_names[field]);
+        case 6: return copy_field(payload->notes, sizeof(payload->notes), value, record, field_names[field]);
+        default: return 1;
+    }
+}
+
+// Split a CSV row in place. Quoted fields may hold commas and "" escapes;
+// the last field (notes) also takes any unquoted commas that remain
+static int split_csv(char *line, char **fields, int max) {
+    int count = 0;
+    char *read = line;
+
+    for (;;) {
+        char *write = read;
+        fields[count++] = write;
+        if (*read == '"') {
+            read++;
+            while (*read) {
+                if (*read == '"' && read[1] == '"') {
+                    *write++ = '"';
+                    read += 2;
+                } else if (*read == '"') {
+                    read++;
+                    break;
+                } else {
+                    *write++ = *read++;
+                }
+            }
+        }
+        while (*read && (*read != ',' || count == max)) *write++ = *read++;
+        if (*read != ',') {
+            *write = '\0';
+            return count;
+        }
+        read++;
+        *write = '\0';
+    }
+}
+
+static int parse_csv(char *line, ImportRecord *record) {
+    char *fields[IMPORT_FIELDS];
+    int count = split_csv(line, fields, IMPORT_FIELDS);
+
+    for (int i = 0; i < count; i++) {
+        if (!assign_field(record, i, fields[i])) return 0;
+    }
+    return 1;
+}
+
+// Read a JSON string starting at the opening quote into out; returns the
+// position after the closing quote, or NULL when malformed
+static const char* json_string(const char *p, char *out, size_t size) {
+    size_t len = 0;
+
+    if (*p++ != '"') return NULL;
+    while (*p && *p != '"') {
+        char c = *p++;
+        if (c == '\\') {
+            c = *p++;
+            switch (c) {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case 'r': c = '\r'; break;
+                case 'b': c = '\b'; break;
+                case 'f': c = '\f'; break;
+                case 'u':
+                    // Non-ASCII has no place in the fixed-width fields
+                    for (int i = 0; i < 4; i++) {
+                        if (!isxdigit((unsigned char)*p)) return NULL;
+                        p++;
+                    }
+                    c = '?';
+                    break;
+                case '"': case '\\': case '/': break;
+                default: return NULL;
+            }
+        }
+        if (len + 1 < size) out[len++] = c;
+    }
+    out[len] = '\0';
+    return *p == '"' ? p + 1 : NULL;
+}
+
+// Parse one flat JSON object of string and number values
+static int parse_json(const char *line, ImportRecord *record) {
+    const char *p = line;
+    char key[32];
+    char value[IMPORT_MAX_LINE];
+
+    while (isspace((unsigned char)*p)) p++;
+    p++;
+    for (;;) {
+        while (isspace((unsigned char)*p)) p++;
+        if (*p == '}') return 1;
+        if (!(p = json_string(p, key, sizeof(key)))) break;
+        while (isspace((unsigned char)*p)) p++;
+        if (*p++ != ':') break;
+        while (isspace((unsigned char)*p)) p++;
+
+        if (*p == '"') {
+            if (!(p = json_string(p, value, sizeof(value)))) break;
+        } else {
+            // Bare token: number, true, false or null
+            size_t len = 0;
+            while (*p && *p != ',' && *p != '}' && !isspace((unsigned char)*p) && len + 1 < sizeof(value)) {
+                value[len++] = *p++;
+            }
+            value[len] = '\0';
+            if (strcmp(value, "null") == 0) value[0] = '\0';
+        }
+
+        for (int i = 0; i < IMPORT_FIELDS; i++) {
+            if (strcmp(key, field_names[i]) == 0 && !assign_field(record, i, value)) return 0;
+        }
+
+        while (isspace((unsigned char)*p)) p++;
+        if (*p == ',') {
+            p++;
+        } else if (*p != '}') {
+            break;
+        }
+    }
+    snprintf(record->error, sizeof(record->error), "malformed JSON object");
+    return 0;
+}
+
+// Fill in what the interactive prompts would have set for this event
+static void apply_defaults(InsurancePayload *payload) {
+    if (payload->provider_id[0] == '\0' && payload->event_type == PREMIUM_PAYMENT) {
+        strcpy(payload->provider_id, "INSURER");
+    }
+    if (payload->diagnosis_code[0] == '\0') {
+        strcpy(payload->diagnosis_code, "N/A");
+    }
+    if (payload->notes[0] == '\0' && payload->event_type == PREMIUM_PAYMENT) {
+        strcpy(payload->notes, "Premium payment received");
+    }
+}
+
+// Why an event would be rejected, or NULL when it is acceptable
+static const char* payload_error(const InsurancePayload *payload) {
+    const char *error;
+
+    if ((error = id_error(payload->policy_id)) ||
+        (error = id_error(payload->member_id)) ||
+        (payload->provider_id[0] && (error = id_error(payload->provider_id))) ||
+        (error = amount_error(payload->amount))) {
+        return error;
+    }
+    return NULL;
+}
+
+// Parse and validate one CSV row or JSON object outside of a file import,
+// e.g. a daemon request. On failure error holds the reason
+int import_parse_event(char *text, InsurancePayload *payload, char *error, size_t size) {
+    ImportRecord record;
+    const char *reason;
+
+    memset(&record, 0, sizeof(record));
+    while (isspace((unsigned char)*text)) text++;
+    if (!(*text == '{' ? parse_json(text, &record) : parse_csv(text, &record))) {
+        snprintf(error, size, "%s", record.error);
+        return 0;
+    }
+    apply_defaults(&record.payload);
+    if ((reason = payload_error(&record.payload))) {
+        snprintf(error, size, "%s", reason);
+        return 0;
+    }
+    *payload = record.payload;
+    return 1;
+}
+
+static void* parse_stage(void *arg) {
+    ImportPipeline *pipeline = (ImportPipeline*)arg;
+    char line[IMPORT_MAX_LINE];
+    uint32_t line_no = 0;
+    int header_checked = 0;
+    double start = now_seconds();
+    double waited = 0.0;
+
+    while (fgets(line, sizeof(line), pipeline->fp)) {
+        line_no++;
+        size_t len = strcspn(line, "\r\n");
+        int truncated = line[len] == '\0' && !feof(pipeline->fp);
+        line[len] = '\0';
+        if (truncated) {
+            int c;
+            while ((c = fgetc(pipeline->fp)) != EOF && c != '\n') {}
+        }
+
+        char *text = line;
+        while (isspace((unsigned char)*text)) text++;
+        if (*text == '\0' || *text == '#') continue;
+        if (!header_checked) {
+            header_checked = 1;
+            if (strncasecmp(text, "event_type,", 11) == 0) continue;
+        }
+
+        ImportRecord *record = (ImportRecord*)calloc(1, sizeof(ImportRecord));
+        if (!record) {
+            printf("Error: Out of memory at line %u\n", line_no);
+            break;
+        }
+        record->line = line_no;
+        if (truncated) {
+            snprintf(record->error, sizeof(record->error), "line longer than %d characters", IMPORT_MAX_LINE - 1);
+        } else if (*text == '{' ? parse_json(text, record) : parse_csv(text, record)) {
+            apply_defaults(&record->payload);
+        }
+        pipeline->records[STAGE_PARSE]++;
+
+        double before = now_seconds();
+        int pushed = queue_push(&pipeline->parsed, record);
+        waited += now_seconds() - before;
+        if (!pushed) {
+            free(record);
+            break;
+        }
+    }
+    pipeline->busy[STAGE_PARSE] = now_seconds() - start - waited;
+    queue_close(&pipeline->parsed);
+    return NULL;
+}
+
+static void* validate_stage(void *arg) {
+    ImportPipeline *pipeline = (ImportPipeline*)arg;
+    void *item;
+
+    while (queue_pop(&pipeline->parsed, &item)) {
+        double start = now_seconds();
+        ImportRecord *record = (ImportRecord*)item;
+        const char *error;
+
+        if (record->error[0] == '\0' && (error = payload_error(&record->payload))) {
+            snprintf(record->error, sizeof(record->error), "%s", error);
+        }
+        pipeline->records[STAGE_VALIDATE]++;
+        pipeline->busy[STAGE_VALIDATE] += now_seconds() - start;
+
+        if (record->error[0] != '\0') {
+            printf("Line %u: %s\n", record->line, record->error);
+            pipeline->rejected++;
+            free(record);
+        } else if (!queue_push(&pipeline->validated, record)) {
+            free(record);
+        }
+    }
+    queue_close(&pipeline->validated);
+    return NULL;
+}
+
+static void* mine_stage(void *arg) {
+    ImportPipeline *pipeline = (ImportPipeline*)arg;
+    ImportRecord *record = NULL;
+    void *item;
+
+    for (;;) {
+        int more = queue_pop(&pipeline->validated, &item);
+        double start = now_seconds();
+        int mined;
+
+        // At the end of the input, seal the partial batch into the last record
+        if (more) {
+            record = (ImportRecord*)item;
+            mined = blockchain_submit_event(&record->payload, &record->block);
+            pipeline->records[STAGE_MINE]++;
+        } else {
+            record = (ImportRecord*)calloc(1, sizeof(ImportRecord));
+            mined = record ? blockchain_seal_batch(&record->block, 0) : -1;
+        }
+        pipeline->busy[STAGE_MINE] += now_seconds() - start;
+
+        if (mined < 0) {
+            if (more) {
+                printf("Line %u: mining failed\n", record->line);
+            } else {
+                printf("Error: Could not seal the final batch\n");
+            }
+            pipeline->failed++;
+            free(record);
+        } else if (mined == 0 || !queue_push(&pipeline->mined, record)) {
+            free(record);
+        }
+        if (!more) break;
+    }
+    queue_close(&pipeline->mined);
+    return NULL;
+}
+
+static void* persist_stage(void *arg) {
+    ImportPipeline *pipeline = (ImportPipeline*)arg;
+    void *item;
+
+    while (queue_pop(&pipeline->mined, &item)) {
+        double start = now_seconds();
+        ImportRecord *record = (ImportRecord*)item;
+
+        // A failed append stays in memory and is retried by the final save
+        blockchain_persist_block(record->block.block_id);
+        pipeline->imported += blockchain_block_event_count(&record->block);
+        pipeline->blocks++;
+        pipeline->records[STAGE_PERSIST]++;
+        pipeline->busy[STAGE_PERSIST] += now_seconds() - start;
+        free(record);
+    }
+    return NULL;
+}
+
+// Import every record of path into the chain, persisting to chain_file
+int import_file(const char *path, const char *chain_file) {
+    static void* (*const stages[STAGE_COUNT])(void*) = {
+        parse_stage, validate_stage, mine_stage, persist_stage
+    };
+    ImportPipeline pipeline;
+    pthread_t tids[STAGE_COUNT];
+    int started = 0;
+
+    if (!blockchain_get_instance()) {
+        printf("Error: Blockchain not initialized\n");
+        return 0;
+    }
+    memset(&pipeline, 0, sizeof(pipeline));
+    pipeline.fp = fopen(path, "r");
+    if (!pipeline.fp) {
+        printf("Error: Could not open %s\n", path);
+        return 0;
+    }
+
+    // Attach the log first so the persist stage can append as blocks arrive
+    if (!blockchain_attach(chain_file)) {
+        printf("Error: Not importing into %s\n", chain_file);
+        fclose(pipeline.fp);
+        return 0;
+    }
+
+    queue_init(&pipeline.parsed, IMPORT_QUEUE_DEPTH);
+    queue_init(&pipeline.validated, IMPORT_QUEUE_DEPTH);
+    queue_init(&pipeline.mined, IMPORT_QUEUE_DEPTH);
+
+    printf("Importing %s...\n", path);
+    double start = now_seconds();
+    for (; started < STAGE_COUNT; started++) {
+        if (pthread_create(&tids[started], NULL, stages[started], &pipeline) != 0) {
+            printf("Error: Could not start the %s stage\n", stage_names[started]);
+            queue_close(&pipeline.parsed);
+            queue_close(&pipeline.validated);
+            queue_close(&pipeline.mined);
+            break;
+        }
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    double elapsed = now_seconds() - start;
+
+    // Drain whatever a failed start left behind
+    void *item;
+    while (queue_pop(&pipeline.parsed, &item)) free(item);
+    while (queue_pop(&pipeline.validated, &item)) free(item);
+    while (queue_pop(&pipeline.mined, &item)) free(item);
+    queue_destroy(&pipeline.parsed);
+    queue_destroy(&pipeline.validated);
+    queue_destroy(&pipeline.mined);
+    fclose(pipeline.fp);
+
+    blockchain_save(chain_file);
+
+    printf("Imported %u record(s) in %u block(s), rejected %u, failed %u\n",
+           pipeline.imported, pipeline.blocks, pipeline.rejected, pipeline.failed);
+    printf("Elapsed %.3f s (%.0f records/s)\n", elapsed, elapsed > 0 ? pipeline.imported / elapsed : 0.0);
+    printf("%-10s %10s %10s\n", "Stage", "Records", "Busy (s)");
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        printf("%-10s %10u %10.3f\n", stage_names[i], pipeline.records[i], pipeline.busy[i]);
+    }
+    return started == STAGE_COUNT;
+}
@@ -0,0 +1,13 @@
+// Bulk Import of Event Files
+// ============================================================================
+
+#ifndef IMPORT_H
+#define IMPORT_H
+
+#include <stddef.h>
+#include "insurance_types.h"
+
+int import_file(const char *path, const char *chain_file);
+int import_parse_event(char *text, InsurancePayload *payload, char *error, size_t size);
+
+#endif // IMPORT_H
@@ -0,0 +1,273 @@
+// Secondary Indexes and Running Totals by Policy, Member and Provider
+// ============================================================================
+//
+// Every ID is interned (see dict.c), so each field's index is an array
+// indexed by dictionary ID holding the posting list of block heights that
+// carry it. Blocks are added in height order, so every posting list is
+// sorted without extra work. Each entry also keeps AccountTotals updated
+// on append, so reports cost one visit per ID.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "index.h"
+#include "dict.h"
+
+#define INDEX_INITIAL_SLOTS 64
+
+typedef struct {
+    PostingList postings;   // empty until an event carries the ID
+    AccountTotals totals;
+} IndexEntry;
+
+typedef struct {
+    IndexEntry *entries;    // by dictionary ID
+    uint32_t slots;
+    uint32_t used;          // entries with at least one event
+} IndexTable;
+
+static IndexTable tables[INDEX_FIELD_COUNT];
+
+static const DictField dict_fields[INDEX_FIELD_COUNT] = { DICT_POLICY, DICT_MEMBER, DICT_PROVIDER };
+
+// Make room for entry `id`, doubling as needed
+static int grow_table(IndexTable *table, uint32_t id) {
+    uint32_t slots = table->slots ? table->slots : INDEX_INITIAL_SLOTS;
+    while (slots <= id) slots *= 2;
+    IndexEntry *entries = (IndexEntry*)realloc(table->entries, slots * sizeof(IndexEntry));
+    if (!entries) return 0;
+    memset(entries + table->slots, 0, (slots - table->slots) * sizeof(IndexEntry));
+    table->entries = entries;
+    table->slots = slots;
+    return 1;
+}
+
+static int posting_append(PostingList *postings, uint32_t height) {
+    if (postings->count == postings->capacity) {
+        uint32_t capacity = postings->capacity ? postings->capacity * 2 : 4;
+        uint32_t *heights = (uint32_t*)realloc(postings->heights, capacity * sizeof(uint32_t));
+        if (!heights) return 0;
+        postings->heights = heights;
+        postings->capacity = capacity;
+    }
+    postings->heights[postings->count++] = height;
+    return 1;
+}
+
+static int preauth_decided(const char *notes) {
+    return strncasecmp(notes, "APPROVED", 8) == 0 || strncasecmp(notes, "DENIED", 6) == 0 ||
+           strncasecmp(notes, "PARTIAL", 7) == 0;
+}
+
+static void totals_apply(AccountTotals *totals, const InsurancePayload *payload, int closes_preauth) {
+    double amount = payload->amount * 100.0;
+    int64_t cents = (int64_t)(amount + (amount < 0 ? -0.5 : 0.5));
+    
+    totals->events++;
+    switch (payload->event_type) {
+        case PREMIUM_PAYMENT: totals->premiums_paid += cents; break;
+        case CLAIM_SUBMISSION: totals->claimed += cents; break;
+        case CLAIM_DECISION: totals->approved += cents; break;
+        case PREAUTH_REQUEST:
+            if (!preauth_decided(payload->notes)) totals->open_preauths++;
+            break;
+        default: break;
+    }
+    if (closes_preauth && totals->open_preauths > 0) totals->open_preauths--;
+}
+
+static int table_add(IndexField field, const char *id, size_t width, const InsurancePayload *event, uint32_t height,
+                     int closes_preauth) {
+    IndexTable *table = &tables[field];
+
+    // Every ID of a linked block has been interned by its encoding
+    uint32_t key = dict_find(dict_fields[field], id, strnlen(id, width));
+    if (key == 0) return 1;
+    if (key == DICT_NONE || (key >= table->slots && !grow_table(table, key))) return 0;
+
+    // A block with several events for one ID is listed once
+    IndexEntry *entry = &table->entries[key];
+    PostingList *postings = &entry->postings;
+    if (postings->count == 0) table->used++;
+    if ((postings->count == 0 || postings->heights[postings->count - 1] != height) &&
+        !posting_append(postings, height)) {
+        return 0;
+    }
+    totals_apply(&entry->totals, event, closes_preauth);
+    return 1;
+}
+
+// Record an event of block `height` under each of its IDs; heights must
+// not decrease. closes_preauth is set when the claim index matched the
+// event to an open preauth
+int index_add_event(const InsurancePayload *event, uint32_t height, int closes_preauth) {
+    if (!table_add(INDEX_POLICY, event->policy_id, sizeof(event->policy_id), event, height, closes_preauth) ||
+        !table_add(INDEX_MEMBER, event->member_id, sizeof(event->member_id), event, height, closes_preauth) ||
+        !table_add(INDEX_PROVIDER, event->provider_id, sizeof(event->provider_id), event, height,
+                   closes_preauth)) {
+        printf("Error: Could not index block %u\n", height);
+        return 0;
+    }
+    return 1;
+}
+
+static const IndexEntry* lookup_entry(IndexField field, const char *key) {
+    const IndexTable *table = &tables[field];
+    uint32_t id = dict_find(dict_fields[field], key, strlen(key));
+
+    if (id == 0 || id >= table->slots || table->entries[id].postings.count == 0) return NULL;
+    return &table->entries[id];
+}
+
+// Posting list for key, or NULL when no block carries it
+const PostingList* index_lookup(IndexField field, const char *key) {
+    const IndexEntry *entry = lookup_entry(field, key);
+    return entry ? &entry->postings : NULL;
+}
+
+const AccountTotals* index_totals(IndexField field, const char *key) {
+    const IndexEntry *entry = lookup_entry(field, key);
+    return entry ? &entry->totals : NULL;
+}
+
+uint32_t index_key_count(IndexField field) {
+    return tables[field].used;
+}
+
+typedef struct {
+    const char *key;
+    const IndexEntry *entry;
+} KeyedEntry;
+
+static int compare_keys(const void *a, const void *b) {
+    return strcmp(((const KeyedEntry*)a)->key, ((const KeyedEntry*)b)->key);
+}
+
+// Visit every ID of a field in sorted order
+void index_foreach(IndexField field, IndexVisitor visit, void *ctx) {
+    const IndexTable *table = &tables[field];
+    KeyedEntry *sorted = (KeyedEntry*)malloc((table->used > 0 ? table->used : 1) * sizeof(KeyedEntry));
+    uint32_t count = 0;
+
+    if (!sorted) {
+        printf("Error: Out of memory\n");
+        return;
+    }
+    for (uint32_t id = 1; id < table->slots && count < table->used; id++) {
+        if (table->entries[id].postings.count > 0) {
+            sorted[count].key = dict_string(dict_fields[field], id, NULL);
+            sorted[count].entry = &table->entries[id];
+            count++;
+        }
+    }
+    qsort(sorted, count, sizeof(KeyedEntry), compare_keys);
+    for (uint32_t i = 0; i < count; i++) {
+        visit(sorted[i].key, &sorted[i].entry->postings, &sorted[i].entry->totals, ctx);
+    }
+    free(sorted);
+}
+
+// Bytes index_snapshot_save will write
+size_t index_snapshot_size() {
+    size_t size = 0;
+    for (int field = 0; field < INDEX_FIELD_COUNT; field++) {
+        const IndexTable *table = &tables[field];
+        size += 2 * sizeof(uint32_t);
+        for (uint32_t id = 1; id < table->slots; id++) {
+            const PostingList *postings = &table->entries[id].postings;
+            if (postings->count > 0) {
+                size += 2 * sizeof(uint32_t) + sizeof(AccountTotals) + postings->count * sizeof(uint32_t);
+            }
+        }
+    }
+    return size;
+}
+
+// Every used entry of every field: per field the slots needed and the
+// entry count, then each entry's ID, totals, and posting list
+uint8_t* index_snapshot_save(uint8_t *out) {
+    for (int field = 0; field < INDEX_FIELD_COUNT; field++) {
+        const IndexTable *table = &tables[field];
+        uint32_t header[2] = { table->slots, table->used };
+        memcpy(out, header, sizeof(header));
+        out += sizeof(header);
+        for (uint32_t id = 1; id < table->slots; id++) {
+            const IndexEntry *entry = &table->entries[id];
+            if (entry->postings.count == 0) continue;
+            uint32_t key[2] = { id, entry->postings.count };
+            memcpy(out, key, sizeof(key));
+            out += sizeof(key);
+            memcpy(out, &entry->totals, sizeof(AccountTotals));
+            out += sizeof(AccountTotals);
+            memcpy(out, entry->postings.heights, entry->postings.count * sizeof(uint32_t));
+            out += entry->postings.count * sizeof(uint32_t);
+        }
+    }
+    return out;
+}
+
+// Restore what index_snapshot_save wrote into empty indexes. NULL when
+// the bytes are malformed or memory runs out; index_reset cleans up
+const uint8_t* index_snapshot_load(const uint8_t *in, const uint8_t *end) {
+    for (int field = 0; field < INDEX_FIELD_COUNT; field++) {
+        IndexTable *table = &tables[field];
+        uint32_t header[2];
+        if ((size_t)(end - in) < sizeof(header)) return NULL;
+        memcpy(header, in, sizeof(header));
+        in += sizeof(header);
+        if (header[0] > 0 && !grow_table(table, header[0] - 1)) return NULL;
+
+        for (uint32_t i = 0; i < header[1]; i++) {
+            uint32_t key[2];
+            if ((size_t)(end - in) < sizeof(key) + sizeof(AccountTotals)) return NULL;
+            memcpy(key, in, sizeof(key));
+            in += sizeof(key);
+            if (key[0] == 0 || key[0] >= table->slots || key[1] == 0 ||
+                table->entries[key[0]].postings.count > 0 || (size_t)(end - in) / sizeof(uint32_t) < key[1]) {
+                return NULL;
+            }
+            IndexEntry *entry = &table->entries[key[0]];
+            memcpy(&entry->totals, in, sizeof(AccountTotals));
+            in += sizeof(AccountTotals);
+            entry->postings.heights = (uint32_t*)malloc(key[1] * sizeof(uint32_t));
+            if (!entry->postings.heights) return NULL;
+            memcpy(entry->postings.heights, in, key[1] * sizeof(uint32_t));
+            in += (size_t)key[1] * sizeof(uint32_t);
+            entry->postings.count = entry->postings.capacity = key[1];
+            table->used++;
+        }
+    }
+    return in;
+}
+
+// Drop every index, e.g. before a rebuild
+void index_reset() {
+    for (int field = 0; field < INDEX_FIELD_COUNT; field++) {
+        IndexTable *table = &tables[field];
+        for (uint32_t id = 0; id < table->slots; id++) {
+            free(table->entries[id].postings.heights);
+        }
+        free(table->entries);
+        memset(table, 0, sizeof(*table));
+    }
+}
+
+const char* index_field_to_string(IndexField field) {
+    switch (field) {
+        case INDEX_POLICY: return "policy";
+        case INDEX_MEMBER: return "member";
+        case INDEX_PROVIDER: return "provider";
+        default: return "unknown";
+    }
+}
+
+int string_to_index_field(const char *str, IndexField *field) {
+    for (int i = 0; i < INDEX_FIELD_COUNT; i++) {
+        if (strcmp(str, index_field_to_string((IndexField)i)) == 0) {
+            *field = (IndexField)i;
+            return 1;
+        }
+    }
+    return 0;
+}
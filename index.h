@@ -0,0 +1,50 @@
+// Secondary Indexes and Running Totals by Policy, Member and Provider
+// ============================================================================
+
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "insurance_types.h"
+
+typedef enum {
+    INDEX_POLICY,
+    INDEX_MEMBER,
+    INDEX_PROVIDER,
+    INDEX_FIELD_COUNT
+} IndexField;
+
+// Heights of the blocks carrying one key, in chain order
+typedef struct {
+    uint32_t *heights;
+    uint32_t count;
+    uint32_t capacity;
+} PostingList;
+
+// Running totals for one ID, in cents. A preauth stays open until the
+// claim index (claims.c) matches a submission or decision to it; one
+// whose notes already record a decision never opens
+typedef struct {
+    int64_t premiums_paid;
+    int64_t claimed;
+    int64_t approved;
+    uint32_t open_preauths;
+    uint32_t events;
+} AccountTotals;
+
+typedef void (*IndexVisitor)(const char *key, const PostingList *postings, const AccountTotals *totals, void *ctx);
+
+int index_add_event(const InsurancePayload *event, uint32_t height, int closes_preauth);
+const PostingList* index_lookup(IndexField field, const char *key);
+const AccountTotals* index_totals(IndexField field, const char *key);
+uint32_t index_key_count(IndexField field);
+void index_foreach(IndexField field, IndexVisitor visit, void *ctx);
+size_t index_snapshot_size();
+uint8_t* index_snapshot_save(uint8_t *out);
+const uint8_t* index_snapshot_load(const uint8_t *in, const uint8_t *end);
+void index_reset();
+const char* index_field_to_string(IndexField field);
+int string_to_index_field(const char *str, IndexField *field);
+
+#endif // INDEX_H
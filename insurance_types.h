@@ -6,6 +6,7 @@
 
 #include <time.h>
 #include <stdint.h>
+#include <stddef.h>
 
 // Event Types for Insurance Transactions
 typedef enum {
@@ -27,23 +28,66 @@ typedef struct {
     char notes[256];
 } InsurancePayload;
 
-// Block Structure
+// Hash preimage formats: v1 is the original formatted text, v2 is the
+// fixed binary layout with the nonce last (see block_serialize_preimage),
+// v3 also commits the block's difficulty, v4 blocks carry a batch of
+// events and commit their Merkle root instead of a single payload
+#define HASH_VERSION_TEXT 1
+#define HASH_VERSION_BINARY 2
+#define HASH_VERSION_TARGET 3
+#define HASH_VERSION_BATCH 4
+#define HASH_VERSION_CURRENT HASH_VERSION_TARGET
+
+// Largest number of events one batched block may carry
+#define MAX_BATCH_EVENTS 65535
+
+// A batched block's events: their count, where the run starts in the
+// chain's event numbering, and the Merkle root the header commits to
+typedef struct {
+    uint32_t event_count;
+    uint32_t first_event;
+    uint8_t merkle_root[32];
+} EventBatch;
+
+// Block Structure, as decoded from its compact record (see codec.c)
 typedef struct Block {
     uint32_t block_id;
-    time_t timestamp;
-    InsurancePayload payload;
-    char prev_hash[65];
-    char hash[65];
+    uint32_t hash_version;
+    uint32_t difficulty;  // leading zero bits this block was mined at
     uint32_t nonce;
-    struct Block *next;
+    time_t timestamp;
+    union {
+        InsurancePayload payload;  // hash versions 1-3: the block's one event
+        EventBatch batch;          // HASH_VERSION_BATCH
+    };
+    uint8_t prev_hash[32];  // raw; the genesis block links to all zeros
+    uint8_t hash[32];       // raw; hex only for display
 } Block;
 
+// Where one block's compact record lives
+typedef struct {
+    const uint8_t *data;
+    uint32_t length;
+} RecordRef;
+
+// Records held in memory are indexed by height in fixed pages and packed
+// into chunks of an append-only arena, so neither ever moves
+#define BLOCK_PAGE_SIZE 1024
+#define RECORD_CHUNK_SIZE (1024 * 1024)
+
 // Blockchain Structure
 typedef struct {
-    Block *head;
-    Block *tail;
+    RecordRef **pages;    // page table; pages wholly below `mapped` are never allocated
+    uint32_t page_slots;  // capacity of the page table
+    uint32_t mapped;      // blocks [0, mapped) are decoded from the log on demand
     uint32_t length;
-    uint32_t difficulty;
+    uint32_t difficulty;  // leading zero bits required of each hash
+    uint8_t **chunks;     // record arena
+    uint32_t chunk_count;
+    uint8_t *arena_next;  // free space left in the newest chunk
+    size_t arena_free;
+    size_t arena_bytes;   // allocated for chunks
+    uint32_t event_count; // next event index
 } Blockchain;
 
 // Utility Functions
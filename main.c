@@ -1,7 +1,44 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "cli.h"
-int main() {
-    cli_run();
-    printf("Goodbye!\n");
-    return 0;
-}
\ No newline at end of file
+#include "daemon.h"
+#include "metrics.h"
+#include "blockchain.h"
+#include "cache.h"
+int main(int argc, char *argv[]) {
+    int status = 0;
+
+    // IB_METRICS_FILE=<path.prom> rewrites a Prometheus text file every
+    // IB_METRICS_INTERVAL seconds (default 10)
+    const char *metrics_file = getenv("IB_METRICS_FILE");
+    if (metrics_file && metrics_file[0]) {
+        const char *interval = getenv("IB_METRICS_INTERVAL");
+        if (!metrics_export_start(metrics_file, interval ? (uint32_t)atoi(interval) : 10)) {
+            fprintf(stderr, "Warning: Could not start metrics export to %s\n", metrics_file);
+        }
+    }
+
+    // IB_BLOCK_CACHE=<blocks> starts in bounded-memory mode with a block
+    // cache of that size
+    const char *block_cache = getenv("IB_BLOCK_CACHE");
+    if (block_cache && block_cache[0]) {
+        unsigned long blocks = strtoul(block_cache, NULL, 10);
+        if (blocks == 0 || blocks > CACHE_MAX_BLOCKS || !blockchain_set_block_cache((uint32_t)blocks)) {
+            fprintf(stderr, "Warning: Ignoring IB_BLOCK_CACHE=%s\n", block_cache);
+        }
+    }
+
+    // --daemon [socket] serves the chain; --client [socket] talks to it
+    if (argc > 1 && strcmp(argv[1], "--daemon") == 0) {
+        status = daemon_run(argc > 2 ? argv[2] : DAEMON_SOCKET, CHAIN_FILE) ? 0 : 1;
+    } else if (argc > 1 && strcmp(argv[1], "--client") == 0) {
+        status = daemon_client(argc > 2 ? argv[2] : DAEMON_SOCKET) ? 0 : 1;
+    } else {
+        cli_run();
+        printf("Goodbye!\n");
+    }
+
+    metrics_export_stop();
+    return status;
+}
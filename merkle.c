@@ -0,0 +1,67 @@
+// Merkle Trees over Block Events
+// ============================================================================
+//
+// Leaves are SHA-256(0x00 || serialized event) and inner nodes
+// SHA-256(0x01 || left || right); the prefixes keep a leaf from passing
+// for an inner node. An odd node at the end of a level is carried up
+// unchanged rather than paired with itself, so no two different event
+// lists share a root. Every level is hashed through the multi-buffer
+// kernels, since all of its nodes have the same length.
+
+#include <stdlib.h>
+#include <string.h>
+#include "merkle.h"
+#include "miner.h"
+#include "sha256_mb.h"
+
+// Nodes hashed per multi-buffer call
+#define MERKLE_CHUNK 64
+
+#define LEAF_SIZE (1 + PAYLOAD_SERIALIZED_SIZE)
+#define NODE_SIZE (1 + 2 * SHA256_BLOCK_SIZE)
+
+void merkle_root(const InsurancePayload *const *events, uint32_t count, uint8_t root[SHA256_BLOCK_SIZE]) {
+    uint8_t messages[MERKLE_CHUNK][LEAF_SIZE];
+    const uint8_t *inputs[MERKLE_CHUNK];
+
+    if (count == 0) {
+        memset(root, 0, SHA256_BLOCK_SIZE);
+        return;
+    }
+
+    uint8_t (*level)[SHA256_BLOCK_SIZE] = (uint8_t (*)[SHA256_BLOCK_SIZE])malloc((size_t)count * SHA256_BLOCK_SIZE);
+    if (!level) {
+        memset(root, 0xff, SHA256_BLOCK_SIZE);
+        return;
+    }
+
+    for (uint32_t base = 0; base < count; base += MERKLE_CHUNK) {
+        uint32_t n = count - base < MERKLE_CHUNK ? count - base : MERKLE_CHUNK;
+        for (uint32_t i = 0; i < n; i++) {
+            messages[i][0] = 0x00;
+            payload_serialize(events[base + i], messages[i] + 1);
+            inputs[i] = messages[i];
+        }
+        sha256_mb_hash(inputs, LEAF_SIZE, n, level + base);
+    }
+
+    // Hash pairs in place; level i+1 overwrites the front of level i
+    for (uint32_t width = count; width > 1; width = (width + 1) / 2) {
+        uint32_t pairs = width / 2;
+        for (uint32_t base = 0; base < pairs; base += MERKLE_CHUNK) {
+            uint32_t n = pairs - base < MERKLE_CHUNK ? pairs - base : MERKLE_CHUNK;
+            for (uint32_t i = 0; i < n; i++) {
+                messages[i][0] = 0x01;
+                memcpy(messages[i] + 1, level[2 * (base + i)], 2 * SHA256_BLOCK_SIZE);
+                inputs[i] = messages[i];
+            }
+            sha256_mb_hash(inputs, NODE_SIZE, n, level + base);
+        }
+        if (width % 2) {
+            memcpy(level[pairs], level[width - 1], SHA256_BLOCK_SIZE);
+        }
+    }
+
+    memcpy(root, level[0], SHA256_BLOCK_SIZE);
+    free(level);
+}
@@ -0,0 +1,13 @@
+// Merkle Trees over Block Events
+// ============================================================================
+
+#ifndef MERKLE_H
+#define MERKLE_H
+
+#include <stdint.h>
+#include "insurance_types.h"
+#include "sha256.h"
+
+void merkle_root(const InsurancePayload *const *events, uint32_t count, uint8_t root[SHA256_BLOCK_SIZE]);
+
+#endif // MERKLE_H
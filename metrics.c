@@ -0,0 +1,294 @@
+// Runtime Metrics
+// ============================================================================
+//
+// Counters and latency histograms live in per-thread shards, so recording
+// is a relaxed atomic add to a cache line no other thread writes. Reading
+// sums every shard under a lock. When a thread exits its shard is folded
+// into a retired total and recycled for the next thread, so short-lived
+// threads do not grow the shard list.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "metrics.h"
+
+typedef struct MetricShard {
+    _Atomic uint64_t counters[METRIC_COUNTER_COUNT];
+    _Atomic uint64_t buckets[METRIC_HISTOGRAM_COUNT][METRIC_BUCKETS + 1];
+    _Atomic uint64_t sum_ns[METRIC_HISTOGRAM_COUNT];
+    struct MetricShard *next;
+    int in_use;
+} MetricShard;
+
+static const double bucket_bounds[METRIC_BUCKETS] = {
+    0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05,
+    0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0, 30.0, 60.0
+};
+
+static const struct {
+    const char *name;
+    const char *help;
+    const char *label;
+} counter_info[METRIC_COUNTER_COUNT] = {
+    { "ib_hashes_total", "Proof-of-work hashes attempted", "Hashes attempted" },
+    { "ib_blocks_mined_total", "Blocks mined", "Blocks mined" },
+    { "ib_bytes_saved_total", "Bytes appended to the chain log", "Bytes saved" },
+    { "ib_bytes_loaded_total", "Bytes of chain log opened by load", "Bytes loaded" },
+    { "ib_verify_runs_total", "Chain verifications run", "Verify runs" },
+    { "ib_block_cache_hits_total", "Block reads served by the block cache", "Block cache hits" },
+    { "ib_block_cache_misses_total", "Block reads the block cache sent to the log", "Block cache misses" },
+};
+
+static const struct {
+    const char *name;
+    const char *help;
+    const char *label;
+} histogram_info[METRIC_HISTOGRAM_COUNT] = {
+    { "ib_mine_block_seconds", "Time to mine one block", "mine_block" },
+    { "ib_add_block_seconds", "Time to add one event, including mining and append", "add_block" },
+    { "ib_save_seconds", "Time to save the chain", "save" },
+    { "ib_verify_seconds", "Time to verify the chain", "verify" },
+};
+
+static pthread_mutex_t shards_lock = PTHREAD_MUTEX_INITIALIZER;
+static MetricShard *shards = NULL;
+static MetricShard retired;
+static pthread_key_t shard_key;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static __thread MetricShard *shard = NULL;
+
+// Thread exit: keep the shard's counts and hand the shard back
+static void retire_shard(void *arg) {
+    MetricShard *dead = (MetricShard*)arg;
+
+    pthread_mutex_lock(&shards_lock);
+    for (int c = 0; c < METRIC_COUNTER_COUNT; c++) {
+        atomic_fetch_add_explicit(&retired.counters[c], atomic_exchange(&dead->counters[c], 0), memory_order_relaxed);
+    }
+    for (int h = 0; h < METRIC_HISTOGRAM_COUNT; h++) {
+        for (int b = 0; b <= METRIC_BUCKETS; b++) {
+            atomic_fetch_add_explicit(&retired.buckets[h][b], atomic_exchange(&dead->buckets[h][b], 0),
+                                      memory_order_relaxed);
+        }
+        atomic_fetch_add_explicit(&retired.sum_ns[h], atomic_exchange(&dead->sum_ns[h], 0), memory_order_relaxed);
+    }
+    dead->in_use = 0;
+    pthread_mutex_unlock(&shards_lock);
+}
+
+static void make_key() {
+    pthread_key_create(&shard_key, retire_shard);
+}
+
+// This thread's shard, claimed on first use. NULL only when out of memory
+static MetricShard* local_shard() {
+    if (shard) return shard;
+
+    pthread_once(&key_once, make_key);
+    pthread_mutex_lock(&shards_lock);
+    MetricShard *found = shards;
+    while (found && found->in_use) found = found->next;
+    if (!found && (found = (MetricShard*)calloc(1, sizeof(MetricShard)))) {
+        found->next = shards;
+        shards = found;
+    }
+    if (found) found->in_use = 1;
+    pthread_mutex_unlock(&shards_lock);
+
+    if (found) pthread_setspecific(shard_key, found);
+    shard = found;
+    return shard;
+}
+
+void metrics_add(MetricCounter counter, uint64_t n) {
+    MetricShard *local = local_shard();
+    if (local) atomic_fetch_add_explicit(&local->counters[counter], n, memory_order_relaxed);
+}
+
+// Monotonic timestamp to pass to metrics_finish
+uint64_t metrics_start() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Record the time since start in a latency histogram
+void metrics_finish(MetricHistogram histogram, uint64_t start) {
+    MetricShard *local = local_shard();
+    uint64_t elapsed = metrics_start() - start;
+    double seconds = elapsed / 1e9;
+    int bucket = 0;
+
+    if (!local) return;
+    while (bucket < METRIC_BUCKETS && seconds > bucket_bounds[bucket]) bucket++;
+    atomic_fetch_add_explicit(&local->buckets[histogram][bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&local->sum_ns[histogram], elapsed, memory_order_relaxed);
+}
+
+static void add_shard(MetricsSnapshot *snapshot, MetricShard *from) {
+    for (int c = 0; c < METRIC_COUNTER_COUNT; c++) {
+        snapshot->counters[c] += atomic_load_explicit(&from->counters[c], memory_order_relaxed);
+    }
+    for (int h = 0; h < METRIC_HISTOGRAM_COUNT; h++) {
+        for (int b = 0; b <= METRIC_BUCKETS; b++) {
+            snapshot->buckets[h][b] += atomic_load_explicit(&from->buckets[h][b], memory_order_relaxed);
+        }
+        snapshot->sum_ns[h] += atomic_load_explicit(&from->sum_ns[h], memory_order_relaxed);
+    }
+}
+
+// Totals across every thread, live and exited
+void metrics_snapshot(MetricsSnapshot *snapshot) {
+    memset(snapshot, 0, sizeof(*snapshot));
+    pthread_mutex_lock(&shards_lock);
+    add_shard(snapshot, &retired);
+    for (MetricShard *s = shards; s; s = s->next) {
+        add_shard(snapshot, s);
+    }
+    pthread_mutex_unlock(&shards_lock);
+}
+
+static uint64_t histogram_count(const MetricsSnapshot *snapshot, int h) {
+    uint64_t count = 0;
+    for (int b = 0; b <= METRIC_BUCKETS; b++) count += snapshot->buckets[h][b];
+    return count;
+}
+
+// Upper bound, in ms, of the bucket holding quantile q; -1 past the last
+static double bucket_quantile(const MetricsSnapshot *snapshot, int h, uint64_t count, double q) {
+    uint64_t rank = (uint64_t)(q * count + 0.5);
+    uint64_t seen = 0;
+
+    if (rank == 0) rank = 1;
+    for (int b = 0; b < METRIC_BUCKETS; b++) {
+        seen += snapshot->buckets[h][b];
+        if (seen >= rank) return bucket_bounds[b] * 1e3;
+    }
+    return -1.0;
+}
+
+static void format_quantile(double ms, char *out, size_t size) {
+    if (ms < 0) {
+        snprintf(out, size, ">%g", bucket_bounds[METRIC_BUCKETS - 1] * 1e3);
+    } else {
+        snprintf(out, size, "<=%g", ms);
+    }
+}
+
+// Human-readable counters and latency table; quantiles are bucket bounds
+void metrics_print(FILE *fp) {
+    MetricsSnapshot snapshot;
+    metrics_snapshot(&snapshot);
+
+    fprintf(fp, "\n=== RUNTIME STATS ===\n");
+    for (int c = 0; c < METRIC_COUNTER_COUNT; c++) {
+        fprintf(fp, "%-18s %llu\n", counter_info[c].label, (unsigned long long)snapshot.counters[c]);
+    }
+    fprintf(fp, "\n%-12s %8s %11s %11s %11s %11s\n", "Latency", "Count", "Mean (ms)", "p50 (ms)", "p90 (ms)", "p99 (ms)");
+    for (int h = 0; h < METRIC_HISTOGRAM_COUNT; h++) {
+        uint64_t count = histogram_count(&snapshot, h);
+        char p50[16] = "-", p90[16] = "-", p99[16] = "-";
+        double mean = count ? snapshot.sum_ns[h] / 1e6 / count : 0.0;
+        if (count) {
+            format_quantile(bucket_quantile(&snapshot, h, count, 0.50), p50, sizeof(p50));
+            format_quantile(bucket_quantile(&snapshot, h, count, 0.90), p90, sizeof(p90));
+            format_quantile(bucket_quantile(&snapshot, h, count, 0.99), p99, sizeof(p99));
+        }
+        fprintf(fp, "%-12s %8llu %11.3f %11s %11s %11s\n", histogram_info[h].label, (unsigned long long)count,
+                mean, p50, p90, p99);
+    }
+    fprintf(fp, "\n");
+}
+
+// Prometheus text format, written to a temporary file and renamed so a
+// scraper never reads half a file
+int metrics_write_prometheus(const char *path) {
+    MetricsSnapshot snapshot;
+    char tmp_path[520];
+
+    metrics_snapshot(&snapshot);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *fp = fopen(tmp_path, "w");
+    if (!fp) return 0;
+
+    for (int c = 0; c < METRIC_COUNTER_COUNT; c++) {
+        fprintf(fp, "# HELP %s %s\n", counter_info[c].name, counter_info[c].help);
+        fprintf(fp, "# TYPE %s counter\n", counter_info[c].name);
+        fprintf(fp, "%s %llu\n", counter_info[c].name, (unsigned long long)snapshot.counters[c]);
+    }
+    for (int h = 0; h < METRIC_HISTOGRAM_COUNT; h++) {
+        const char *name = histogram_info[h].name;
+        uint64_t cumulative = 0;
+        fprintf(fp, "# HELP %s %s\n", name, histogram_info[h].help);
+        fprintf(fp, "# TYPE %s histogram\n", name);
+        for (int b = 0; b < METRIC_BUCKETS; b++) {
+            cumulative += snapshot.buckets[h][b];
+            fprintf(fp, "%s_bucket{le=\"%g\"} %llu\n", name, bucket_bounds[b], (unsigned long long)cumulative);
+        }
+        cumulative += snapshot.buckets[h][METRIC_BUCKETS];
+        fprintf(fp, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)cumulative);
+        fprintf(fp, "%s_sum %.9f\n", name, snapshot.sum_ns[h] / 1e9);
+        fprintf(fp, "%s_count %llu\n", name, (unsigned long long)cumulative);
+    }
+
+    int ok = fclose(fp) == 0;
+    if (!ok || rename(tmp_path, path) != 0) {
+        remove(tmp_path);
+        return 0;
+    }
+    return 1;
+}
+
+// Periodic export on a background thread
+static pthread_t export_thread;
+static pthread_mutex_t export_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t export_wake = PTHREAD_COND_INITIALIZER;
+static int exporting = 0;
+static int export_stop = 0;
+static char export_path[512];
+static uint32_t export_interval = 10;
+
+static void* export_loop(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&export_lock);
+    while (!export_stop) {
+        pthread_mutex_unlock(&export_lock);
+        if (!metrics_write_prometheus(export_path)) {
+            fprintf(stderr, "Warning: Could not write metrics to %s\n", export_path);
+        }
+        pthread_mutex_lock(&export_lock);
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += export_interval;
+        while (!export_stop && pthread_cond_timedwait(&export_wake, &export_lock, &deadline) == 0) {}
+    }
+    pthread_mutex_unlock(&export_lock);
+    return NULL;
+}
+
+// Rewrite path every interval_seconds until metrics_export_stop
+int metrics_export_start(const char *path, uint32_t interval_seconds) {
+    metrics_export_stop();
+    snprintf(export_path, sizeof(export_path), "%s", path);
+    export_interval = interval_seconds > 0 ? interval_seconds : 1;
+    export_stop = 0;
+    if (pthread_create(&export_thread, NULL, export_loop, NULL) != 0) return 0;
+    exporting = 1;
+    return 1;
+}
+
+// Stop the exporter after one last write, so the file ends current
+void metrics_export_stop() {
+    if (!exporting) return;
+    pthread_mutex_lock(&export_lock);
+    export_stop = 1;
+    pthread_cond_signal(&export_wake);
+    pthread_mutex_unlock(&export_lock);
+    pthread_join(export_thread, NULL);
+    exporting = 0;
+    metrics_write_prometheus(export_path);
+}
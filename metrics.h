@@ -0,0 +1,47 @@
+// Runtime Metrics
+// ============================================================================
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+typedef enum {
+    METRIC_HASHES,
+    METRIC_BLOCKS_MINED,
+    METRIC_BYTES_SAVED,
+    METRIC_BYTES_LOADED,
+    METRIC_VERIFY_RUNS,
+    METRIC_CACHE_HITS,
+    METRIC_CACHE_MISSES,
+    METRIC_COUNTER_COUNT
+} MetricCounter;
+
+typedef enum {
+    METRIC_MINE_BLOCK,
+    METRIC_ADD_BLOCK,
+    METRIC_SAVE,
+    METRIC_VERIFY,
+    METRIC_HISTOGRAM_COUNT
+} MetricHistogram;
+
+// Latency bucket upper bounds in seconds; one more bucket catches the rest
+#define METRIC_BUCKETS 18
+
+typedef struct {
+    uint64_t counters[METRIC_COUNTER_COUNT];
+    uint64_t buckets[METRIC_HISTOGRAM_COUNT][METRIC_BUCKETS + 1];
+    uint64_t sum_ns[METRIC_HISTOGRAM_COUNT];
+} MetricsSnapshot;
+
+void metrics_add(MetricCounter counter, uint64_t n);
+uint64_t metrics_start();
+void metrics_finish(MetricHistogram histogram, uint64_t start);
+void metrics_snapshot(MetricsSnapshot *snapshot);
+void metrics_print(FILE *fp);
+int metrics_write_prometheus(const char *path);
+int metrics_export_start(const char *path, uint32_t interval_seconds);
+void metrics_export_stop();
+
+#endif // METRICS_H
@@ -0,0 +1,371 @@
+// Proof of Work Mining Engine
+// ============================================================================
+//
+// The nonce space is striped across worker threads: thread t of n tries
+// nonces 1+t, 1+t+n, 1+t+2n, ... Every thread keeps going until it passes
+// the lowest winning nonce found so far, so the result is always the
+// smallest valid nonce - exactly what a single-threaded search returns.
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include "miner.h"
+#include "sha256_mb.h"
+#include "metrics.h"
+
+#define NONCE_NOT_FOUND UINT64_MAX
+#define MINER_MAX_THREADS 256
+
+static uint32_t mining_threads = 0;
+
+typedef struct {
+    Block block;
+    PowTarget target;
+    uint32_t first_nonce;
+    uint32_t stride;
+    _Atomic uint64_t *best_nonce;
+    uint64_t hashes;
+} MinerWorker;
+
+static void put_u32(uint8_t *out, uint32_t v) {
+    for (int i = 0; i < 4; i++) out[i] = (uint8_t)(v >> (i * 8));
+}
+
+static void put_u64(uint8_t *out, uint64_t v) {
+    for (int i = 0; i < 8; i++) out[i] = (uint8_t)(v >> (i * 8));
+}
+
+// Fixed-width, zero padded copy so bytes after the terminator never leak in
+static uint8_t *put_field(uint8_t *out, const char *field, size_t width) {
+    strncpy((char*)out, field, width);
+    return out + width;
+}
+
+// Fixed binary layout of one event: type, amount in cents, then the
+// zero-padded text fields. Shared by block preimages and Merkle leaves
+size_t payload_serialize(const InsurancePayload *p, uint8_t *out) {
+    double cents = p->amount * 100.0;
+    uint8_t *cursor = out;
+
+    put_u32(cursor, (uint32_t)p->event_type);
+    put_u64(cursor + 4, (uint64_t)(int64_t)(cents + (cents < 0 ? -0.5 : 0.5)));
+    cursor += 12;
+
+    cursor = put_field(cursor, p->policy_id, sizeof(p->policy_id));
+    cursor = put_field(cursor, p->member_id, sizeof(p->member_id));
+    cursor = put_field(cursor, p->provider_id, sizeof(p->provider_id));
+    cursor = put_field(cursor, p->diagnosis_code, sizeof(p->diagnosis_code));
+    cursor = put_field(cursor, p->notes, sizeof(p->notes));
+    return (size_t)(cursor - out);
+}
+
+// Serialize the binary preimage: header and payload in fixed layout,
+// little-endian integers, prev_hash as 32 raw bytes and the nonce last
+// so the prefix can be absorbed once per block. Batched blocks commit
+// their event count and Merkle root in place of the payload. Returns
+// the preimage length for the block's hash version
+size_t block_serialize_preimage(const Block *block, uint8_t *out) {
+    uint8_t *cursor = out;
+
+    put_u32(cursor, block->hash_version);
+    put_u32(cursor + 4, block->block_id);
+    cursor += 8;
+    if (block->hash_version >= HASH_VERSION_TARGET) {
+        put_u32(cursor, block->difficulty);
+        cursor += 4;
+    }
+    put_u64(cursor, (uint64_t)(int64_t)block->timestamp);
+    cursor += 8;
+
+    if (block->hash_version >= HASH_VERSION_BATCH) {
+        put_u32(cursor, block->batch.event_count);
+        memcpy(cursor + 4, block->batch.merkle_root, SHA256_BLOCK_SIZE);
+        cursor += 4 + SHA256_BLOCK_SIZE;
+    } else {
+        cursor += payload_serialize(&block->payload, cursor);
+    }
+
+    memcpy(cursor, block->prev_hash, SHA256_BLOCK_SIZE);
+    cursor += SHA256_BLOCK_SIZE;
+
+    put_u32(cursor, block->nonce);
+    return (size_t)(cursor - out) + sizeof(uint32_t);
+}
+
+// Legacy v1 preimage: formatted text with the nonce appended. It spells
+// prev_hash in hex, and the genesis block's all-zero link as "0"
+static void hash_text_preimage(const Block *block, uint32_t nonce, uint8_t hash[]) {
+    static const uint8_t zeros[SHA256_BLOCK_SIZE];
+    SHA256_CTX ctx;
+    char data[2048];
+    char prev_hash[65] = "0";
+
+    if (memcmp(block->prev_hash, zeros, SHA256_BLOCK_SIZE) != 0) {
+        bytes_to_hex(block->prev_hash, SHA256_BLOCK_SIZE, prev_hash);
+    }
+
+    snprintf(data, sizeof(data), "%u%ld%s%s%d%s%.2f%s%s%s%u",
+             block->block_id,
+             block->timestamp,
+             block->payload.policy_id,
+             block->payload.member_id,
+             block->payload.event_type,
+             block->payload.provider_id,
+             block->payload.amount,
+             block->payload.diagnosis_code,
+             block->payload.notes,
+             prev_hash,
+             nonce);
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, (uint8_t*)data, strlen(data));
+    sha256_final(&ctx, hash);
+}
+
+void block_hasher_init(BlockHasher *hasher, const Block *block) {
+    uint8_t preimage[BLOCK_PREIMAGE_MAX];
+
+    hasher->block = block;
+    sha256_init(&hasher->midstate);
+    if (block->hash_version == HASH_VERSION_TEXT) return;
+
+    size_t len = block_serialize_preimage(block, preimage);
+    sha256_update(&hasher->midstate, preimage, len - sizeof(uint32_t));
+
+    // The buffered prefix, the nonce and the padding fit one final block
+    uint64_t bitlen = (uint64_t)len * 8;
+    hasher->nonce_offset = hasher->midstate.datalen;
+    memset(hasher->tail, 0, sizeof(hasher->tail));
+    memcpy(hasher->tail, hasher->midstate.data, hasher->nonce_offset);
+    hasher->tail[hasher->nonce_offset + sizeof(uint32_t)] = 0x80;
+    for (int i = 0; i < 8; i++) {
+        hasher->tail[63 - i] = (uint8_t)(bitlen >> (i * 8));
+    }
+}
+
+// Hash the block with the given nonce, finishing from the cached midstate
+void block_hasher_hash(const BlockHasher *hasher, uint32_t nonce, uint8_t hash[]) {
+    if (hasher->block->hash_version == HASH_VERSION_TEXT) {
+        hash_text_preimage(hasher->block, nonce, hash);
+        return;
+    }
+
+    SHA256_CTX ctx = hasher->midstate;
+    uint8_t tail[sizeof(uint32_t)];
+    put_u32(tail, nonce);
+    sha256_update(&ctx, tail, sizeof(tail));
+    sha256_final(&ctx, hash);
+}
+
+// Hash the block once per nonce, finishing all of them through the
+// multi-buffer kernel
+void block_hasher_hash_batch(const BlockHasher *hasher, const uint32_t *nonces, size_t count, uint8_t (*hashes)[SHA256_BLOCK_SIZE]) {
+    uint32_t states[SHA256_MB_MAX_LANES][8];
+    uint8_t tails[SHA256_MB_MAX_LANES][64];
+    const uint8_t *blocks[SHA256_MB_MAX_LANES];
+
+    if (hasher->block->hash_version == HASH_VERSION_TEXT) {
+        for (size_t i = 0; i < count; i++) {
+            hash_text_preimage(hasher->block, nonces[i], hashes[i]);
+        }
+        return;
+    }
+
+    for (size_t base = 0; base < count; base += SHA256_MB_MAX_LANES) {
+        size_t batch = count - base < SHA256_MB_MAX_LANES ? count - base : SHA256_MB_MAX_LANES;
+        for (size_t i = 0; i < batch; i++) {
+            memcpy(states[i], hasher->midstate.state, sizeof(states[i]));
+            memcpy(tails[i], hasher->tail, sizeof(tails[i]));
+            put_u32(tails[i] + hasher->nonce_offset, nonces[base + i]);
+            blocks[i] = tails[i];
+        }
+        sha256_mb_compress(states, blocks, batch);
+        for (size_t i = 0; i < batch; i++) {
+            sha256_state_to_bytes(states[i], hashes[base + i]);
+        }
+    }
+}
+
+typedef struct {
+    uint8_t preimages[SHA256_MB_MAX_LANES][BLOCK_PREIMAGE_MAX];
+    const uint8_t *messages[SHA256_MB_MAX_LANES];
+    size_t slots[SHA256_MB_MAX_LANES];
+    size_t pending;
+    size_t len;
+} PreimageBatch;
+
+static void flush_preimages(PreimageBatch *batch, uint8_t (*hashes)[SHA256_BLOCK_SIZE]) {
+    uint8_t digests[SHA256_MB_MAX_LANES][SHA256_BLOCK_SIZE];
+
+    if (batch->pending == 0) return;
+    sha256_mb_hash(batch->messages, batch->len, batch->pending, digests);
+    for (size_t j = 0; j < batch->pending; j++) {
+        memcpy(hashes[batch->slots[j]], digests[j], SHA256_BLOCK_SIZE);
+    }
+    batch->pending = 0;
+}
+
+// Hash independent blocks; equal-length binary preimages go through the
+// multi-buffer kernel in lockstep
+void block_hash_batch(const Block *const *blocks, size_t count, uint8_t (*hashes)[SHA256_BLOCK_SIZE]) {
+    PreimageBatch batch;
+    batch.pending = 0;
+    batch.len = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        if (blocks[i]->hash_version == HASH_VERSION_TEXT) {
+            hash_text_preimage(blocks[i], blocks[i]->nonce, hashes[i]);
+            continue;
+        }
+
+        uint8_t preimage[BLOCK_PREIMAGE_MAX];
+        size_t len = block_serialize_preimage(blocks[i], preimage);
+        if (batch.pending > 0 && len != batch.len) {
+            flush_preimages(&batch, hashes);
+        }
+        memcpy(batch.preimages[batch.pending], preimage, len);
+        batch.messages[batch.pending] = batch.preimages[batch.pending];
+        batch.slots[batch.pending++] = i;
+        batch.len = len;
+
+        if (batch.pending == SHA256_MB_MAX_LANES) {
+            flush_preimages(&batch, hashes);
+        }
+    }
+    flush_preimages(&batch, hashes);
+}
+
+// Calculate hash of a block
+void block_calculate_hash(const Block *block, char *output) {
+    BlockHasher hasher;
+    uint8_t hash[SHA256_BLOCK_SIZE];
+
+    block_hasher_init(&hasher, block);
+    block_hasher_hash(&hasher, block->nonce, hash);
+    bytes_to_hex(hash, SHA256_BLOCK_SIZE, output);
+}
+
+// Target requiring the given number of leading zero bits
+void pow_target_from_bits(PowTarget *target, uint32_t zero_bits) {
+    memset(target->threshold, 0xff, SHA256_BLOCK_SIZE);
+    if (zero_bits > SHA256_BLOCK_SIZE * 8) zero_bits = SHA256_BLOCK_SIZE * 8;
+
+    uint32_t whole = zero_bits / 8;
+    memset(target->threshold, 0, whole);
+    if (whole < SHA256_BLOCK_SIZE) {
+        target->threshold[whole] = (uint8_t)(0xff >> (zero_bits % 8));
+    }
+}
+
+int hash_meets_target(const uint8_t hash[], const PowTarget *target) {
+    return memcmp(hash, target->threshold, SHA256_BLOCK_SIZE) <= 0;
+}
+
+// Lower the shared best nonce if ours is smaller
+static void publish_nonce(_Atomic uint64_t *best, uint64_t nonce) {
+    uint64_t current = atomic_load(best);
+    while (nonce < current &&
+           !atomic_compare_exchange_weak(best, &current, nonce)) {
+    }
+}
+
+static void *miner_worker(void *arg) {
+    MinerWorker *worker = (MinerWorker*)arg;
+    BlockHasher hasher;
+    uint32_t nonces[SHA256_MB_MAX_LANES];
+    uint8_t hashes[SHA256_MB_MAX_LANES][SHA256_BLOCK_SIZE];
+    size_t lanes = sha256_mb_kernel()->lanes;
+
+    block_hasher_init(&hasher, &worker->block);
+
+    uint64_t nonce = worker->first_nonce;
+    while (nonce <= UINT32_MAX) {
+        if (nonce >= atomic_load_explicit(worker->best_nonce, memory_order_relaxed)) break;
+
+        // One kernel-width batch of this worker's stripe
+        size_t batch = 0;
+        for (; batch < lanes && nonce <= UINT32_MAX; batch++, nonce += worker->stride) {
+            nonces[batch] = (uint32_t)nonce;
+        }
+        block_hasher_hash_batch(&hasher, nonces, batch, hashes);
+        worker->hashes += batch;
+
+        // Check in nonce order so the first hit is this stripe's lowest
+        for (size_t i = 0; i < batch; i++) {
+            if (hash_meets_target(hashes[i], &worker->target)) {
+                publish_nonce(worker->best_nonce, nonces[i]);
+                return NULL;
+            }
+        }
+    }
+    return NULL;
+}
+
+// Proof of Work Mining
+int miner_mine_block(Block *block, const PowTarget *target) {
+    uint64_t start = metrics_start();
+    uint32_t threads = miner_get_threads();
+    _Atomic uint64_t best_nonce = NONCE_NOT_FOUND;
+    MinerWorker workers[threads];
+    pthread_t tids[threads];
+    int running[threads];
+
+    for (uint32_t t = 0; t < threads; t++) {
+        workers[t].block = *block;
+        workers[t].target = *target;
+        workers[t].first_nonce = t + 1;
+        workers[t].stride = threads;
+        workers[t].best_nonce = &best_nonce;
+        workers[t].hashes = 0;
+    }
+
+    // Worker 0 always runs on the calling thread
+    running[0] = 0;
+    for (uint32_t t = 1; t < threads; t++) {
+        running[t] = pthread_create(&tids[t], NULL, miner_worker, &workers[t]) == 0;
+    }
+    miner_worker(&workers[0]);
+    for (uint32_t t = 1; t < threads; t++) {
+        if (running[t]) {
+            pthread_join(tids[t], NULL);
+        } else {
+            // Thread could not be started; cover its stripe here
+            miner_worker(&workers[t]);
+        }
+    }
+
+    // Counted here rather than by the workers, whose threads are short-lived
+    uint64_t hashed = 0;
+    for (uint32_t t = 0; t < threads; t++) hashed += workers[t].hashes;
+    metrics_add(METRIC_HASHES, hashed);
+
+    uint64_t nonce = atomic_load(&best_nonce);
+    if (nonce == NONCE_NOT_FOUND) {
+        printf("Error: Nonce space exhausted for block %u\n", block->block_id);
+        return 0;
+    }
+
+    // Only the winning nonce is hashed into the header
+    BlockHasher hasher;
+    block->nonce = (uint32_t)nonce;
+    block_hasher_init(&hasher, block);
+    block_hasher_hash(&hasher, block->nonce, block->hash);
+    metrics_add(METRIC_BLOCKS_MINED, 1);
+    metrics_finish(METRIC_MINE_BLOCK, start);
+    return 1;
+}
+
+void miner_set_threads(uint32_t threads) {
+    mining_threads = threads > MINER_MAX_THREADS ? MINER_MAX_THREADS : threads;
+}
+
+// Configured worker count, or one per online core when unset
+uint32_t miner_get_threads() {
+    if (mining_threads > 0) return mining_threads;
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1) return 1;
+    return cores > MINER_MAX_THREADS ? MINER_MAX_THREADS : (uint32_t)cores;
+}
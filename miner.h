@@ -0,0 +1,50 @@
+// Proof of Work Mining Engine
+// ============================================================================
+
+#ifndef MINER_H
+#define MINER_H
+
+#include <stdint.h>
+#include "insurance_types.h"
+#include "sha256.h"
+
+// Size of the binary preimages; the nonce occupies the last 4 bytes.
+// v3 adds the block's own difficulty so its target is committed too;
+// v4 replaces the payload with the event count and Merkle root
+#define BLOCK_PREIMAGE_SIZE_V2 432
+#define BLOCK_PREIMAGE_SIZE_V3 436
+#define BLOCK_PREIMAGE_SIZE_V4 92
+#define BLOCK_PREIMAGE_MAX BLOCK_PREIMAGE_SIZE_V3
+
+// Serialized size of one event (see payload_serialize)
+#define PAYLOAD_SERIALIZED_SIZE 380
+
+// Proof-of-work target: a hash is valid when, read as a 256-bit
+// big-endian number, it is less than or equal to the threshold
+typedef struct {
+    uint8_t threshold[SHA256_BLOCK_SIZE];
+} PowTarget;
+
+// SHA-256 state after absorbing everything except the nonce, plus the
+// padded final message block with the nonce slot left open
+typedef struct {
+    const Block *block;
+    SHA256_CTX midstate;
+    uint8_t tail[64];
+    uint32_t nonce_offset;
+} BlockHasher;
+
+size_t payload_serialize(const InsurancePayload *payload, uint8_t *out);
+size_t block_serialize_preimage(const Block *block, uint8_t *out);
+void block_hasher_init(BlockHasher *hasher, const Block *block);
+void block_hasher_hash(const BlockHasher *hasher, uint32_t nonce, uint8_t hash[]);
+void block_hasher_hash_batch(const BlockHasher *hasher, const uint32_t *nonces, size_t count, uint8_t (*hashes)[SHA256_BLOCK_SIZE]);
+void block_hash_batch(const Block *const *blocks, size_t count, uint8_t (*hashes)[SHA256_BLOCK_SIZE]);
+void block_calculate_hash(const Block *block, char *output);
+void pow_target_from_bits(PowTarget *target, uint32_t zero_bits);
+int hash_meets_target(const uint8_t hash[], const PowTarget *target);
+int miner_mine_block(Block *block, const PowTarget *target);
+void miner_set_threads(uint32_t threads);
+uint32_t miner_get_threads();
+
+#endif // MINER_H
@@ -0,0 +1,101 @@
+// Bounded Blocking Queue
+// ============================================================================
+
+#include <stdlib.h>
+#include <errno.h>
+#include "queue.h"
+
+int queue_init(BoundedQueue *queue, size_t capacity) {
+    queue->items = (void**)malloc((capacity > 0 ? capacity : 1) * sizeof(void*));
+    if (!queue->items) return 0;
+    queue->capacity = capacity > 0 ? capacity : 1;
+    queue->head = 0;
+    queue->count = 0;
+    queue->closed = 0;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+    return 1;
+}
+
+// Wait for room and enqueue; fails once the queue is closed
+int queue_push(BoundedQueue *queue, void *item) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->capacity && !queue->closed) {
+        pthread_cond_wait(&queue->not_full, &queue->lock);
+    }
+    if (queue->closed) {
+        pthread_mutex_unlock(&queue->lock);
+        return 0;
+    }
+    queue->items[(queue->head + queue->count) % queue->capacity] = item;
+    queue->count++;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+    return 1;
+}
+
+// Wait for an item; fails only when the queue is closed and empty
+int queue_pop(BoundedQueue *queue, void **item) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0 && !queue->closed) {
+        pthread_cond_wait(&queue->not_empty, &queue->lock);
+    }
+    if (queue->count == 0) {
+        pthread_mutex_unlock(&queue->lock);
+        return 0;
+    }
+    *item = queue->items[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+    pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue->lock);
+    return 1;
+}
+
+// As queue_pop, but give up at deadline (CLOCK_REALTIME); returns -1
+// when it timed out with nothing to pop
+int queue_pop_until(BoundedQueue *queue, void **item, const struct timespec *deadline) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0 && !queue->closed) {
+        if (pthread_cond_timedwait(&queue->not_empty, &queue->lock, deadline) == ETIMEDOUT) {
+            if (queue->count > 0 || queue->closed) break;
+            pthread_mutex_unlock(&queue->lock);
+            return -1;
+        }
+    }
+    if (queue->count == 0) {
+        pthread_mutex_unlock(&queue->lock);
+        return 0;
+    }
+    *item = queue->items[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+    pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue->lock);
+    return 1;
+}
+
+size_t queue_length(BoundedQueue *queue) {
+    pthread_mutex_lock(&queue->lock);
+    size_t count = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+    return count;
+}
+
+// No more pushes; consumers drain the remaining items
+void queue_close(BoundedQueue *queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = 1;
+    pthread_cond_broadcast(&queue->not_empty);
+    pthread_cond_broadcast(&queue->not_full);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+void queue_destroy(BoundedQueue *queue) {
+    free(queue->items);
+    queue->items = NULL;
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_cond_destroy(&queue->not_full);
+}
@@ -0,0 +1,33 @@
+// Bounded Blocking Queue
+// ============================================================================
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <time.h>
+
+// Fixed-capacity FIFO of pointers, safe for any number of producers and
+// consumers. Pushes block while it is full and pops while it is empty;
+// once closed, pops drain what is left and then fail
+typedef struct {
+    void **items;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    int closed;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} BoundedQueue;
+
+int queue_init(BoundedQueue *queue, size_t capacity);
+int queue_push(BoundedQueue *queue, void *item);
+int queue_pop(BoundedQueue *queue, void **item);
+int queue_pop_until(BoundedQueue *queue, void **item, const struct timespec *deadline);
+size_t queue_length(BoundedQueue *queue);
+void queue_close(BoundedQueue *queue);
+void queue_destroy(BoundedQueue *queue);
+
+#endif // QUEUE_H
@@ -0,0 +1,89 @@
+// Difficulty Retargeting
+// ============================================================================
+//
+// Holds the time to mine a block near a goal. The writer records how
+// long each proof of work took and at what difficulty; a block of d bits
+// needs 2^d hashes on average, so the window of recent blocks gives the
+// hash rate actually achieved, and the next difficulty is the one whose
+// expected work takes `goal` seconds at that rate. Each step moves at
+// most RETARGET_MAX_STEP bits, so one slow or lucky block cannot swing
+// the target.
+//
+// A goal of 0 turns retargeting off and the difficulty stays wherever it
+// was set. Every block records the difficulty it was mined at, so
+// verification checks each proof of work against its own target whatever
+// the controller did. Only the writer calls in here.
+
+#include <math.h>
+#include <string.h>
+#include "retarget.h"
+
+static double goal = 1.0;
+static uint32_t difficulties[RETARGET_WINDOW];
+static double durations[RETARGET_WINDOW];
+static uint32_t samples = 0;
+static uint32_t next_sample = 0;
+
+// Target seconds per block; 0 (or anything not a finite positive
+// number) keeps the difficulty fixed
+void retarget_set_goal(double seconds) {
+    goal = isfinite(seconds) && seconds > 0 ? seconds : 0;
+    retarget_reset();
+}
+
+double retarget_goal() {
+    return goal;
+}
+
+// A block mined at difficulty bits in the given wall time
+void retarget_record(uint32_t difficulty, double seconds) {
+    difficulties[next_sample] = difficulty;
+    durations[next_sample] = seconds;
+    next_sample = (next_sample + 1) % RETARGET_WINDOW;
+    if (samples < RETARGET_WINDOW) samples++;
+}
+
+static double expected_hashes(uint32_t difficulty) {
+    double hashes = 1;
+    while (difficulty--) hashes *= 2;
+    return hashes;
+}
+
+// Difficulty for the block after one mined at `difficulty`
+uint32_t retarget_next(uint32_t difficulty) {
+    if (goal <= 0 || samples == 0) return difficulty;
+
+    double work = 0, seconds = 0;
+    for (uint32_t i = 0; i < samples; i++) {
+        work += expected_hashes(difficulties[i]);
+        seconds += durations[i];
+    }
+    if (seconds < 1e-6) seconds = 1e-6;
+
+    // Nearest whole number of bits to the work that fits the goal, never
+    // past the cap (the count stops there, so a huge rate cannot spin it)
+    double fits = work / seconds * goal / 1.4142135623730951;
+    int64_t bits = 0;
+    for (; fits >= 1 && bits < RETARGET_MAX_BITS; fits /= 2) bits++;
+    if (bits > (int64_t)difficulty + RETARGET_MAX_STEP) bits = (int64_t)difficulty + RETARGET_MAX_STEP;
+    if (bits < (int64_t)difficulty - RETARGET_MAX_STEP) bits = (int64_t)difficulty - RETARGET_MAX_STEP;
+    if (bits < 0) bits = 0;
+    return (uint32_t)bits;
+}
+
+// Mean mining time over the window, 0 before any block
+double retarget_mean_seconds() {
+    double seconds = 0;
+    for (uint32_t i = 0; i < samples; i++) {
+        seconds += durations[i];
+    }
+    return samples ? seconds / samples : 0;
+}
+
+// Forget the measured blocks, e.g. when another chain is loaded
+void retarget_reset() {
+    memset(difficulties, 0, sizeof(difficulties));
+    memset(durations, 0, sizeof(durations));
+    samples = 0;
+    next_sample = 0;
+}
@@ -0,0 +1,23 @@
+// Difficulty Retargeting
+// ============================================================================
+
+#ifndef RETARGET_H
+#define RETARGET_H
+
+#include <stdint.h>
+
+// Blocks whose mining times steer the next difficulty
+#define RETARGET_WINDOW 16
+// Most a single retarget may move the difficulty, in bits
+#define RETARGET_MAX_STEP 2
+// Expected work stays well inside the 32-bit nonce space
+#define RETARGET_MAX_BITS 28
+
+void retarget_set_goal(double seconds);
+double retarget_goal();
+void retarget_record(uint32_t difficulty, double seconds);
+uint32_t retarget_next(uint32_t difficulty);
+double retarget_mean_seconds();
+void retarget_reset();
+
+#endif // RETARGET_H
@@ -9,7 +9,7 @@
 #include <ctype.h>
 #include "sha256.h"
 
-static const uint32_t k[64] = {
+const uint32_t sha256_k[64] = {
     0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,
     0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,0x72be5d74,0x80deb1fe,0x9bdc06a7,0xc19bf174,
     0xe49b69c1,0xefbe4786,0x0fc19dc6,0x240ca1cc,0x2de92c6f,0x4a7484aa,0x5cb0a9dc,0x76f988da,
@@ -28,25 +28,31 @@ static const uint32_t k[64] = {
 #define SIG0(x) (ROTRIGHT(x,7) ^ ROTRIGHT(x,18) ^ ((x) >> 3))
 #define SIG1(x) (ROTRIGHT(x,17) ^ ROTRIGHT(x,19) ^ ((x) >> 10))
 
-static void sha256_transform(SHA256_CTX *ctx, const uint8_t data[]) {
+// Scalar reference compression function; the multi-buffer kernels in
+// sha256_mb.c are checked against this at startup
+void sha256_compress(uint32_t state[8], const uint8_t data[]) {
     uint32_t a, b, c, d, e, f, g, h, i, j, t1, t2, m[64];
     
     for (i = 0, j = 0; i < 16; ++i, j += 4)
-        m[i] = (data[j] << 24) | (data[j + 1] << 16) | (data[j + 2] << 8) | (data[j + 3]);
+        m[i] = ((uint32_t)data[j] << 24) | (data[j + 1] << 16) | (data[j + 2] << 8) | (data[j + 3]);
     for ( ; i < 64; ++i)
         m[i] = SIG1(m[i - 2]) + m[i - 7] + SIG0(m[i - 15]) + m[i - 16];
 
-    a = ctx->state[0]; b = ctx->state[1]; c = ctx->state[2]; d = ctx->state[3];
-    e = ctx->state[4]; f = ctx->state[5]; g = ctx->state[6]; h = ctx->state[7];
+    a = state[0]; b = state[1]; c = state[2]; d = state[3];
+    e = state[4]; f = state[5]; g = state[6]; h = state[7];
 
     for (i = 0; i < 64; ++i) {
-        t1 = h + EP1(e) + CH(e,f,g) + k[i] + m[i];
+        t1 = h + EP1(e) + CH(e,f,g) + sha256_k[i] + m[i];
         t2 = EP0(a) + MAJ(a,b,c);
         h = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
     }
 
-    ctx->state[0] += a; ctx->state[1] += b; ctx->state[2] += c; ctx->state[3] += d;
-    ctx->state[4] += e; ctx->state[5] += f; ctx->state[6] += g; ctx->state[7] += h;
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+static void sha256_transform(SHA256_CTX *ctx, const uint8_t data[]) {
+    sha256_compress(ctx->state, data);
 }
 
 void sha256_init(SHA256_CTX *ctx) {
@@ -59,15 +65,30 @@ void sha256_init(SHA256_CTX *ctx) {
 }
 
 void sha256_update(SHA256_CTX *ctx, const uint8_t data[], size_t len) {
-    for (size_t i = 0; i < len; ++i) {
-        ctx->data[ctx->datalen] = data[i];
-        ctx->datalen++;
-        if (ctx->datalen == 64) {
-            sha256_transform(ctx, ctx->data);
-            ctx->bitlen += 512;
-            ctx->datalen = 0;
-        }
+    // Top up a partially filled buffer first
+    if (ctx->datalen > 0) {
+        size_t take = 64 - ctx->datalen;
+        if (take > len) take = len;
+        memcpy(ctx->data + ctx->datalen, data, take);
+        ctx->datalen += take;
+        data += take;
+        len -= take;
+        if (ctx->datalen < 64) return;
+        sha256_transform(ctx, ctx->data);
+        ctx->bitlen += 512;
+        ctx->datalen = 0;
     }
+    
+    // Whole blocks are compressed straight from the caller's buffer
+    while (len >= 64) {
+        sha256_transform(ctx, data);
+        ctx->bitlen += 512;
+        data += 64;
+        len -= 64;
+    }
+    
+    memcpy(ctx->data, data, len);
+    ctx->datalen = len;
 }
 
 void sha256_final(SHA256_CTX *ctx, uint8_t hash[]) {
@@ -94,21 +115,45 @@ void sha256_final(SHA256_CTX *ctx, uint8_t hash[]) {
     ctx->data[56] = ctx->bitlen >> 56;
     sha256_transform(ctx, ctx->data);
     
-    for (i = 0; i < 4; ++i) {
-        hash[i]      = (ctx->state[0] >> (24 - i * 8)) & 0x000000ff;
-        hash[i + 4]  = (ctx->state[1] >> (24 - i * 8)) & 0x000000ff;
-        hash[i + 8]  = (ctx->state[2] >> (24 - i * 8)) & 0x000000ff;
-        hash[i + 12] = (ctx->state[3] >> (24 - i * 8)) & 0x000000ff;
-        hash[i + 16] = (ctx->state[4] >> (24 - i * 8)) & 0x000000ff;
-        hash[i + 20] = (ctx->state[5] >> (24 - i * 8)) & 0x000000ff;
-        hash[i + 24] = (ctx->state[6] >> (24 - i * 8)) & 0x000000ff;
-        hash[i + 28] = (ctx->state[7] >> (24 - i * 8)) & 0x000000ff;
+    sha256_state_to_bytes(ctx->state, hash);
+}
+
+void sha256_state_to_bytes(const uint32_t state[8], uint8_t hash[]) {
+    for (int i = 0; i < 4; ++i) {
+        hash[i]      = (state[0] >> (24 - i * 8)) & 0x000000ff;
+        hash[i + 4]  = (state[1] >> (24 - i * 8)) & 0x000000ff;
+        hash[i + 8]  = (state[2] >> (24 - i * 8)) & 0x000000ff;
+        hash[i + 12] = (state[3] >> (24 - i * 8)) & 0x000000ff;
+        hash[i + 16] = (state[4] >> (24 - i * 8)) & 0x000000ff;
+        hash[i + 20] = (state[5] >> (24 - i * 8)) & 0x000000ff;
+        hash[i + 24] = (state[6] >> (24 - i * 8)) & 0x000000ff;
+        hash[i + 28] = (state[7] >> (24 - i * 8)) & 0x000000ff;
     }
 }
 
 void bytes_to_hex(const uint8_t *bytes, size_t len, char *hex) {
+    static const char digits[] = "0123456789abcdef";
     for (size_t i = 0; i < len; i++) {
-        sprintf(hex + (i * 2), "%02x", bytes[i]);
+        hex[i * 2] = digits[bytes[i] >> 4];
+        hex[i * 2 + 1] = digits[bytes[i] & 0xf];
     }
     hex[len * 2] = '\0';
-}
\ No newline at end of file
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Decode exactly len bytes of hex; returns 0 if the string is malformed
+int hex_to_bytes(const char *hex, uint8_t *bytes, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        int hi = hex_digit(hex[i * 2]);
+        int lo = hi < 0 ? -1 : hex_digit(hex[i * 2 + 1]);
+        if (lo < 0) return 0;
+        bytes[i] = (uint8_t)((hi << 4) | lo);
+    }
+    return hex[len * 2] == '\0';
+}
@@ -16,9 +16,14 @@ typedef struct {
     uint32_t state[8];
 } SHA256_CTX;
 
+extern const uint32_t sha256_k[64];
+
+void sha256_compress(uint32_t state[8], const uint8_t data[]);
+void sha256_state_to_bytes(const uint32_t state[8], uint8_t hash[]);
 void sha256_init(SHA256_CTX *ctx);
 void sha256_update(SHA256_CTX *ctx, const uint8_t data[], size_t len);
 void sha256_final(SHA256_CTX *ctx, uint8_t hash[]);
 void bytes_to_hex(const uint8_t *bytes, size_t len, char *hex);
+int hex_to_bytes(const char *hex, uint8_t *bytes, size_t len);
 
 #endif // SHA256_H
\ No newline at end of file
@@ -0,0 +1,262 @@
+// Multi-buffer SHA-256 with Runtime Kernel Dispatch
+// ============================================================================
+//
+// Kernels hash several independent messages in lockstep (SSE4.1: 4 lanes,
+// AVX2: 8, AVX-512: 16) or use the SHA extensions on one message at a time.
+// The best kernel the CPU supports is picked on first use, after it has
+// been cross-checked against the scalar sha256_compress reference. Set
+// IB_SHA256_KERNEL to a kernel name to force a choice.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "sha256_mb.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define SHA256_MB_X86 1
+#endif
+
+#define LOAD_BE32(p) (((uint32_t)(p)[0] << 24) | ((uint32_t)(p)[1] << 16) | \
+                      ((uint32_t)(p)[2] << 8) | (uint32_t)(p)[3])
+
+static void scalar_compress(uint32_t (*states)[8], const uint8_t *const *blocks) {
+    sha256_compress(states[0], blocks[0]);
+}
+
+static const Sha256Kernel scalar_kernel = { "scalar", 1, scalar_compress };
+
+#ifdef SHA256_MB_X86
+
+#define VROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define VCH(x, y, z) (((x) & (y)) ^ (~(x) & (z)))
+#define VMAJ(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define VEP0(x) (VROTR(x, 2) ^ VROTR(x, 13) ^ VROTR(x, 22))
+#define VEP1(x) (VROTR(x, 6) ^ VROTR(x, 11) ^ VROTR(x, 25))
+#define VSIG0(x) (VROTR(x, 7) ^ VROTR(x, 18) ^ ((x) >> 3))
+#define VSIG1(x) (VROTR(x, 17) ^ VROTR(x, 19) ^ ((x) >> 10))
+
+#define MB_NAME sse41_compress
+#define MB_VEC_NAME sse41_vec
+#define MB_LANES 4
+#define MB_TARGET "sse4.1"
+#include "sha256_mb_kernel.h"
+
+#define MB_NAME avx2_compress
+#define MB_VEC_NAME avx2_vec
+#define MB_LANES 8
+#define MB_TARGET "avx2"
+#include "sha256_mb_kernel.h"
+
+#define MB_NAME avx512_compress
+#define MB_VEC_NAME avx512_vec
+#define MB_LANES 16
+#define MB_TARGET "avx512f"
+#include "sha256_mb_kernel.h"
+
+// SHA-NI single-buffer compression, four rounds per group of message words
+__attribute__((target("sha,sse4.1")))
+static void shani_compress(uint32_t (*states)[8], const uint8_t *const *blocks) {
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    uint32_t *state = states[0];
+    const uint8_t *data = blocks[0];
+    __m128i msgs[4];
+
+    __m128i tmp = _mm_loadu_si128((const __m128i*)&state[0]);
+    __m128i state1 = _mm_loadu_si128((const __m128i*)&state[4]);
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);
+    state1 = _mm_shuffle_epi32(state1, 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+    __m128i abef_save = state0;
+    __m128i cdgh_save = state1;
+
+    for (int i = 0; i < 4; i++) {
+        msgs[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + i * 16)), mask);
+    }
+
+    for (int group = 0; group < 16; group++) {
+        __m128i wk = _mm_add_epi32(msgs[group & 3], _mm_loadu_si128((const __m128i*)&sha256_k[group * 4]));
+        state1 = _mm_sha256rnds2_epu32(state1, state0, wk);
+        wk = _mm_shuffle_epi32(wk, 0x0E);
+        state0 = _mm_sha256rnds2_epu32(state0, state1, wk);
+
+        // Schedule the message words four groups ahead
+        if (group < 12) {
+            __m128i next = _mm_sha256msg1_epu32(msgs[group & 3], msgs[(group + 1) & 3]);
+            next = _mm_add_epi32(next, _mm_alignr_epi8(msgs[(group + 3) & 3], msgs[(group + 2) & 3], 4));
+            msgs[group & 3] = _mm_sha256msg2_epu32(next, msgs[(group + 3) & 3]);
+        }
+    }
+
+    state0 = _mm_add_epi32(state0, abef_save);
+    state1 = _mm_add_epi32(state1, cdgh_save);
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+    _mm_storeu_si128((__m128i*)&state[0], state0);
+    _mm_storeu_si128((__m128i*)&state[4], state1);
+}
+
+static const Sha256Kernel simd_kernels[] = {
+    { "avx512", 16, avx512_compress },
+    { "sha-ni", 1, shani_compress },
+    { "avx2", 8, avx2_compress },
+    { "sse4.1", 4, sse41_compress },
+};
+
+static int cpu_has_sha_ni() {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return 0;
+    return (ebx >> 29) & 1;
+}
+
+static int kernel_supported(const Sha256Kernel *kernel) {
+    __builtin_cpu_init();
+    if (strcmp(kernel->name, "avx512") == 0) return __builtin_cpu_supports("avx512f");
+    if (strcmp(kernel->name, "sha-ni") == 0) return cpu_has_sha_ni() && __builtin_cpu_supports("sse4.1");
+    if (strcmp(kernel->name, "avx2") == 0) return __builtin_cpu_supports("avx2");
+    if (strcmp(kernel->name, "sse4.1") == 0) return __builtin_cpu_supports("sse4.1");
+    return 0;
+}
+
+#endif // SHA256_MB_X86
+
+static const Sha256Kernel *active_kernel = &scalar_kernel;
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+// Run a kernel over pseudo-random blocks and states and compare every
+// lane with the scalar reference
+static int kernel_self_test(const Sha256Kernel *kernel) {
+    uint8_t data[SHA256_MB_MAX_LANES][64];
+    const uint8_t *blocks[SHA256_MB_MAX_LANES];
+    uint32_t states[SHA256_MB_MAX_LANES][8];
+    uint32_t expected[SHA256_MB_MAX_LANES][8];
+    uint32_t seed = 0x9e3779b9;
+
+    for (int round = 0; round < 4; round++) {
+        for (size_t lane = 0; lane < kernel->lanes; lane++) {
+            for (int i = 0; i < 64; i++) {
+                seed = seed * 1664525u + 1013904223u;
+                data[lane][i] = (uint8_t)(seed >> 24);
+            }
+            for (int j = 0; j < 8; j++) {
+                seed = seed * 1664525u + 1013904223u;
+                states[lane][j] = seed;
+            }
+            blocks[lane] = data[lane];
+            memcpy(expected[lane], states[lane], sizeof(states[lane]));
+            sha256_compress(expected[lane], data[lane]);
+        }
+        kernel->compress(states, blocks);
+        if (memcmp(states, expected, kernel->lanes * sizeof(states[0])) != 0) return 0;
+    }
+    return 1;
+}
+
+static void select_kernel() {
+#ifdef SHA256_MB_X86
+    const char *forced = getenv("IB_SHA256_KERNEL");
+    if (forced && strcmp(forced, scalar_kernel.name) == 0) return;
+
+    for (size_t i = 0; i < sizeof(simd_kernels) / sizeof(simd_kernels[0]); i++) {
+        const Sha256Kernel *kernel = &simd_kernels[i];
+        if (forced && strcmp(forced, kernel->name) != 0) continue;
+        if (!kernel_supported(kernel)) continue;
+        if (!kernel_self_test(kernel)) {
+            printf("Warning: SHA-256 %s kernel failed self-test, skipping\n", kernel->name);
+            continue;
+        }
+        active_kernel = kernel;
+        return;
+    }
+#endif
+}
+
+const Sha256Kernel* sha256_mb_kernel() {
+    pthread_once(&kernel_once, select_kernel);
+    return active_kernel;
+}
+
+// Whether this CPU can run the named kernel, whether or not it was picked
+int sha256_mb_kernel_supported(const char *name) {
+    if (strcmp(name, scalar_kernel.name) == 0) return 1;
+#ifdef SHA256_MB_X86
+    for (size_t i = 0; i < sizeof(simd_kernels) / sizeof(simd_kernels[0]); i++) {
+        if (strcmp(name, simd_kernels[i].name) == 0) return kernel_supported(&simd_kernels[i]);
+    }
+#endif
+    return 0;
+}
+
+// Compress count independent blocks, each into its own state. A partial
+// final batch is padded with copies of the last lane
+void sha256_mb_compress(uint32_t (*states)[8], const uint8_t *const *blocks, size_t count) {
+    const Sha256Kernel *kernel = sha256_mb_kernel();
+    size_t lanes = kernel->lanes;
+    size_t i = 0;
+
+    for (; i + lanes <= count; i += lanes) {
+        kernel->compress(states + i, blocks + i);
+    }
+    if (i == count) return;
+
+    uint32_t spare_states[SHA256_MB_MAX_LANES][8];
+    const uint8_t *spare_blocks[SHA256_MB_MAX_LANES];
+    size_t rest = count - i;
+    for (size_t lane = 0; lane < lanes; lane++) {
+        size_t src = i + (lane < rest ? lane : rest - 1);
+        memcpy(spare_states[lane], states[src], sizeof(spare_states[lane]));
+        spare_blocks[lane] = blocks[src];
+    }
+    kernel->compress(spare_states, spare_blocks);
+    memcpy(states + i, spare_states, rest * sizeof(spare_states[0]));
+}
+
+// Hash count messages that all share the same length
+void sha256_mb_hash(const uint8_t *const *messages, size_t len, size_t count, uint8_t (*digests)[SHA256_BLOCK_SIZE]) {
+    static const uint32_t initial_state[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    uint32_t states[SHA256_MB_MAX_LANES][8];
+    const uint8_t *blocks[SHA256_MB_MAX_LANES];
+    uint8_t tails[SHA256_MB_MAX_LANES][128];
+    size_t full = len / 64;
+    size_t rest = len % 64;
+    size_t tail_len = rest < 56 ? 64 : 128;
+    uint64_t bitlen = (uint64_t)len * 8;
+
+    for (size_t base = 0; base < count; base += SHA256_MB_MAX_LANES) {
+        size_t batch = count - base < SHA256_MB_MAX_LANES ? count - base : SHA256_MB_MAX_LANES;
+
+        for (size_t m = 0; m < batch; m++) {
+            memcpy(states[m], initial_state, sizeof(initial_state));
+        }
+        for (size_t b = 0; b < full; b++) {
+            for (size_t m = 0; m < batch; m++) blocks[m] = messages[base + m] + b * 64;
+            sha256_mb_compress(states, blocks, batch);
+        }
+
+        // Padding: 0x80, zeros, then the 64-bit big-endian message length
+        for (size_t m = 0; m < batch; m++) {
+            memset(tails[m], 0, tail_len);
+            memcpy(tails[m], messages[base + m] + full * 64, rest);
+            tails[m][rest] = 0x80;
+            for (int i = 0; i < 8; i++) {
+                tails[m][tail_len - 1 - i] = (uint8_t)(bitlen >> (i * 8));
+            }
+        }
+        for (size_t off = 0; off < tail_len; off += 64) {
+            for (size_t m = 0; m < batch; m++) blocks[m] = tails[m] + off;
+            sha256_mb_compress(states, blocks, batch);
+        }
+
+        for (size_t m = 0; m < batch; m++) {
+            sha256_state_to_bytes(states[m], digests[base + m]);
+        }
+    }
+}
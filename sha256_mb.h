@@ -0,0 +1,25 @@
+// Multi-buffer SHA-256 with Runtime Kernel Dispatch
+// ============================================================================
+
+#ifndef SHA256_MB_H
+#define SHA256_MB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sha256.h"
+
+// Widest kernel lane count; callers can size batch buffers with this
+#define SHA256_MB_MAX_LANES 16
+
+typedef struct {
+    const char *name;
+    size_t lanes;
+    void (*compress)(uint32_t (*states)[8], const uint8_t *const *blocks);
+} Sha256Kernel;
+
+const Sha256Kernel* sha256_mb_kernel();
+int sha256_mb_kernel_supported(const char *name);
+void sha256_mb_compress(uint32_t (*states)[8], const uint8_t *const *blocks, size_t count);
+void sha256_mb_hash(const uint8_t *const *messages, size_t len, size_t count, uint8_t (*digests)[SHA256_BLOCK_SIZE]);
+
+#endif // SHA256_MB_H
@@ -0,0 +1,52 @@
+// Multi-buffer SHA-256 Kernel Template
+// ============================================================================
+//
+// Included once per instruction set by sha256_mb.c with MB_NAME, MB_LANES
+// and MB_TARGET defined. Compresses MB_LANES independent 64-byte blocks in
+// lockstep, one message per vector lane. No include guard on purpose.
+
+typedef uint32_t MB_VEC_NAME __attribute__((vector_size(MB_LANES * 4)));
+
+__attribute__((target(MB_TARGET)))
+static void MB_NAME(uint32_t (*states)[8], const uint8_t *const *blocks) {
+    MB_VEC_NAME w[64];
+    MB_VEC_NAME a, b, c, d, e, f, g, h, t1, t2, kv;
+    MB_VEC_NAME s[8];
+
+    for (int i = 0; i < 16; i++) {
+        for (int lane = 0; lane < MB_LANES; lane++) {
+            w[i][lane] = LOAD_BE32(blocks[lane] + i * 4);
+        }
+    }
+    for (int i = 16; i < 64; i++) {
+        w[i] = VSIG1(w[i - 2]) + w[i - 7] + VSIG0(w[i - 15]) + w[i - 16];
+    }
+
+    for (int j = 0; j < 8; j++) {
+        for (int lane = 0; lane < MB_LANES; lane++) {
+            s[j][lane] = states[lane][j];
+        }
+    }
+    a = s[0]; b = s[1]; c = s[2]; d = s[3];
+    e = s[4]; f = s[5]; g = s[6]; h = s[7];
+
+    for (int i = 0; i < 64; i++) {
+        kv = (MB_VEC_NAME){0} + sha256_k[i];
+        t1 = h + VEP1(e) + VCH(e, f, g) + kv + w[i];
+        t2 = VEP0(a) + VMAJ(a, b, c);
+        h = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    s[0] += a; s[1] += b; s[2] += c; s[3] += d;
+    s[4] += e; s[5] += f; s[6] += g; s[7] += h;
+    for (int j = 0; j < 8; j++) {
+        for (int lane = 0; lane < MB_LANES; lane++) {
+            states[lane][j] = s[j][lane];
+        }
+    }
+}
+
+#undef MB_VEC_NAME
+#undef MB_NAME
+#undef MB_LANES
+#undef MB_TARGET
@@ -0,0 +1,133 @@
+// SHA-256 Kernel Cross-Check
+// ============================================================================
+//
+// Usage: IB_SHA256_KERNEL=<kernel> sha256_test <kernel>
+//
+// Checks the kernel forced through IB_SHA256_KERNEL against the scalar
+// sha256_compress reference: the kernel itself over its full lane width,
+// sha256_mb_compress over every batch size up to twice the widest kernel
+// (so partial batches are padded), and sha256_mb_hash over message
+// lengths either side of each padding boundary, in batches of every size.
+// A kernel this CPU lacks is skipped; one it has that was not picked
+// failed its self-test and fails here. `make test` runs every kernel.
+
+#include <stdio.h>
+#include <string.h>
+#include "sha256.h"
+#include "sha256_mb.h"
+
+#define COMPRESS_ROUNDS 8
+#define MAX_BATCH (2 * SHA256_MB_MAX_LANES + 1)
+#define MAX_MESSAGE 1024
+
+static uint32_t seed = 0x9e3779b9;
+
+static uint32_t next_random() {
+    seed = seed * 1664525u + 1013904223u;
+    return seed;
+}
+
+static void fill_random(uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        data[i] = (uint8_t)(next_random() >> 24);
+    }
+}
+
+// Random blocks into random states, batch at a time, against the reference
+static int check_compress(const Sha256Kernel *kernel) {
+    uint8_t data[MAX_BATCH][64];
+    const uint8_t *blocks[MAX_BATCH];
+    uint32_t states[MAX_BATCH][8];
+    uint32_t expected[MAX_BATCH][8];
+
+    for (int round = 0; round < COMPRESS_ROUNDS; round++) {
+        for (size_t count = 1; count <= MAX_BATCH; count++) {
+            for (size_t i = 0; i < count; i++) {
+                fill_random(data[i], sizeof(data[i]));
+                for (int j = 0; j < 8; j++) states[i][j] = next_random();
+                blocks[i] = data[i];
+                memcpy(expected[i], states[i], sizeof(states[i]));
+                sha256_compress(expected[i], data[i]);
+            }
+            // The kernel alone only ever sees whole batches
+            if (count == kernel->lanes) {
+                uint32_t direct[SHA256_MB_MAX_LANES][8];
+                memcpy(direct, states, count * sizeof(states[0]));
+                kernel->compress(direct, blocks);
+                if (memcmp(direct, expected, count * sizeof(expected[0])) != 0) {
+                    printf("FAIL %s: kernel output differs over %zu lane(s)\n", kernel->name, count);
+                    return 0;
+                }
+            }
+            sha256_mb_compress(states, blocks, count);
+            for (size_t i = 0; i < count; i++) {
+                if (memcmp(states[i], expected[i], sizeof(expected[i])) != 0) {
+                    printf("FAIL %s: sha256_mb_compress lane %zu of %zu differs\n", kernel->name, i, count);
+                    return 0;
+                }
+            }
+        }
+    }
+    return 1;
+}
+
+static int check_length(const Sha256Kernel *kernel, size_t len) {
+    static uint8_t data[SHA256_MB_MAX_LANES + 1][MAX_MESSAGE];
+    const uint8_t *messages[SHA256_MB_MAX_LANES + 1];
+    uint8_t digests[SHA256_MB_MAX_LANES + 1][SHA256_BLOCK_SIZE];
+    uint8_t expected[SHA256_BLOCK_SIZE];
+
+    for (size_t count = 1; count <= SHA256_MB_MAX_LANES + 1; count++) {
+        for (size_t i = 0; i < count; i++) {
+            fill_random(data[i], len);
+            messages[i] = data[i];
+        }
+        sha256_mb_hash(messages, len, count, digests);
+        for (size_t i = 0; i < count; i++) {
+            SHA256_CTX ctx;
+            sha256_init(&ctx);
+            sha256_update(&ctx, data[i], len);
+            sha256_final(&ctx, expected);
+            if (memcmp(digests[i], expected, SHA256_BLOCK_SIZE) != 0) {
+                printf("FAIL %s: sha256_mb_hash of %zu byte(s), message %zu of %zu differs\n",
+                       kernel->name, len, i, count);
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// Every length up to three blocks, then both sides of later boundaries
+static int check_hash(const Sha256Kernel *kernel) {
+    static const size_t longer[] = { 247, 248, 255, 256, 511, 512, 1000, MAX_MESSAGE };
+
+    for (size_t len = 0; len <= 192; len++) {
+        if (!check_length(kernel, len)) return 0;
+    }
+    for (size_t i = 0; i < sizeof(longer) / sizeof(longer[0]); i++) {
+        if (!check_length(kernel, longer[i])) return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: IB_SHA256_KERNEL=<kernel> %s <kernel>\n", argv[0]);
+        return 2;
+    }
+    const char *wanted = argv[1];
+    const Sha256Kernel *kernel = sha256_mb_kernel();
+
+    if (strcmp(kernel->name, wanted) != 0) {
+        if (!sha256_mb_kernel_supported(wanted)) {
+            printf("SKIP %s: not supported by this CPU\n", wanted);
+            return 0;
+        }
+        printf("FAIL %s: supported but not selected (failed its self-test?)\n", wanted);
+        return 1;
+    }
+    if (!check_compress(kernel) || !check_hash(kernel)) return 1;
+    printf("PASS %s (%zu lane(s))\n", kernel->name, kernel->lanes);
+    return 0;
+}
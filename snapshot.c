@@ -0,0 +1,291 @@
+// Derived-State Snapshots
+// ============================================================================
+//
+// Loading a log maps its blocks without reading them, but the ID indexes,
+// query columns and claim index are built from every event. A snapshot
+// saves them as of some height, so a load restores them and replays only
+// the blocks appended since.
+//
+// A snapshot lives next to the chain file as <chain>.snap: a
+// SnapshotHeader sealed with a checksum over its fields and the body,
+// then the body, i.e. the indexes (index_snapshot_save), the columns
+// (columns_snapshot_save) and the open claims (claims_snapshot_save). The
+// body refers to dictionary IDs, which the log's dictionary keeps stable,
+// and is only used while block height - 1 of the chain still has the
+// snapshot's tip hash. Writing a new snapshot moves the previous one to
+// <chain>.snap.1, so a torn or stale newest file still leaves one to fall
+// back on. The checksum only has to catch torn or damaged files (like a
+// checkpoint's seal, anyone could recompute it), so it is a 64-bit
+// multiply-rotate hash over four lanes of words rather than SHA-256, and
+// costs a fraction of the read.
+//
+// snapshot_capture copies the state into memory while the caller keeps
+// writers off the chain, which costs a memcpy per posting list and
+// column; sealing, writing and fsync happen on a background thread, so
+// appends carry on meanwhile. Only one snapshot is written at a time.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "snapshot.h"
+#include "index.h"
+#include "columns.h"
+#include "claims.h"
+
+#define SNAPSHOT_MAGIC 0x504e5349u  // "ISNP"
+#define SNAPSHOT_VERSION 3  // 1 had no claims, 2 never closed preauths
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    SnapshotInfo info;
+    uint64_t body_size;
+    uint64_t seal;
+} SnapshotHeader;
+
+// A captured snapshot on its way to disk
+typedef struct {
+    char chain_file[512];
+    SnapshotHeader header;
+    uint8_t *body;
+} SnapshotJob;
+
+static uint32_t interval = SNAPSHOT_INTERVAL;
+
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t writer;
+static int writer_started = 0;   // joined by the next capture or wait
+static int writer_busy = 0;
+static int last_written = 1;
+
+static void snapshot_path(const char *chain_file, uint32_t generation, char *path, size_t size) {
+    if (generation == 0) {
+        snprintf(path, size, "%s.snap", chain_file);
+    } else {
+        snprintf(path, size, "%s.snap.%u", chain_file, generation);
+    }
+}
+
+#define PRIME1 0x9E3779B185EBCA87ull
+#define PRIME2 0xC2B2AE3D27D4EB4Full
+
+static uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t mix(uint64_t lane, uint64_t word) {
+    return rotl64(lane + word * PRIME2, 31) * PRIME1;
+}
+
+// Checksum of the header's fields before the seal, then the body
+static uint64_t seal_snapshot(const SnapshotHeader *header, const uint8_t *body) {
+    uint64_t lanes[4] = { PRIME1 + PRIME2, PRIME2, 0, -PRIME1 };
+    size_t size = header->body_size;
+    size_t i = 0;
+
+    for (; i + 32 <= size; i += 32) {
+        for (int lane = 0; lane < 4; lane++) {
+            uint64_t word;
+            memcpy(&word, body + i + lane * 8, sizeof(word));
+            lanes[lane] = mix(lanes[lane], word);
+        }
+    }
+    uint64_t hash = rotl64(lanes[0], 1) + rotl64(lanes[1], 7) + rotl64(lanes[2], 12) + rotl64(lanes[3], 18);
+    for (; i < size; i++) {
+        hash = mix(hash, body[i]);
+    }
+    const uint8_t *fields = (const uint8_t*)header;
+    for (size_t j = 0; j < offsetof(SnapshotHeader, seal); j += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, fields + j, sizeof(word));
+        hash = mix(hash, word);
+    }
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    return hash ^ (hash >> 29);
+}
+
+// Written to a temporary file and renamed, as checkpoints are, after the
+// older generations have moved up one
+static int write_snapshot(SnapshotJob *job) {
+    char path[540], tmp_path[560], older[540];
+
+    job->header.seal = seal_snapshot(&job->header, job->body);
+    snapshot_path(job->chain_file, 0, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *fp = fopen(tmp_path, "wb");
+    if (!fp) return 0;
+    int ok = fwrite(&job->header, sizeof(job->header), 1, fp) == 1 &&
+             fwrite(job->body, 1, job->header.body_size, fp) == job->header.body_size &&
+             fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    if (fclose(fp) != 0) ok = 0;
+    if (!ok) {
+        unlink(tmp_path);
+        return 0;
+    }
+
+    for (uint32_t generation = SNAPSHOT_GENERATIONS - 1; generation > 0; generation--) {
+        snapshot_path(job->chain_file, generation - 1, path, sizeof(path));
+        snapshot_path(job->chain_file, generation, older, sizeof(older));
+        if (rename(path, older) != 0 && errno != ENOENT) return 0;
+    }
+    snapshot_path(job->chain_file, 0, path, sizeof(path));
+    return rename(tmp_path, path) == 0;
+}
+
+static void* writer_thread(void *arg) {
+    SnapshotJob *job = (SnapshotJob*)arg;
+    int ok = write_snapshot(job);
+
+    free(job->body);
+    free(job);
+    pthread_mutex_lock(&writer_lock);
+    writer_busy = 0;
+    last_written = ok;
+    pthread_mutex_unlock(&writer_lock);
+    return NULL;
+}
+
+// Copy the indexes, columns and claims and write them out in the
+// background as chain_file's newest snapshot. The caller keeps writers
+// off the chain for the duration. Returns 0 when the previous snapshot
+// is still being written or memory runs out
+int snapshot_capture(const char *chain_file, const SnapshotInfo *info) {
+    pthread_mutex_lock(&writer_lock);
+    int busy = writer_busy;
+    int started = writer_started;
+    pthread_mutex_unlock(&writer_lock);
+    if (busy) return 0;
+    if (started) {
+        pthread_join(writer, NULL);
+        writer_started = 0;
+    }
+
+    SnapshotJob *job = (SnapshotJob*)calloc(1, sizeof(SnapshotJob));
+    size_t size = index_snapshot_size() + columns_snapshot_size() + claims_snapshot_size();
+    uint8_t *body = job ? (uint8_t*)malloc(size) : NULL;
+    if (!body) {
+        free(job);
+        return 0;
+    }
+    uint8_t *end = claims_snapshot_save(columns_snapshot_save(index_snapshot_save(body)));
+    if ((size_t)(end - body) != size) {
+        free(body);
+        free(job);
+        return 0;
+    }
+
+    snprintf(job->chain_file, sizeof(job->chain_file), "%s", chain_file);
+    job->header.magic = SNAPSHOT_MAGIC;
+    job->header.version = SNAPSHOT_VERSION;
+    job->header.info = *info;
+    job->header.body_size = size;
+    job->body = body;
+
+    pthread_mutex_lock(&writer_lock);
+    writer_busy = 1;
+    pthread_mutex_unlock(&writer_lock);
+    if (pthread_create(&writer, NULL, writer_thread, job) != 0) {
+        pthread_mutex_lock(&writer_lock);
+        writer_busy = 0;
+        pthread_mutex_unlock(&writer_lock);
+        free(body);
+        free(job);
+        return 0;
+    }
+    writer_started = 1;
+    return 1;
+}
+
+// Wait for a snapshot being written. Returns 0 when the last one failed
+int snapshot_wait() {
+    if (writer_started) {
+        pthread_join(writer, NULL);
+        writer_started = 0;
+    }
+    return last_written;
+}
+
+// Read and check generation 0 (newest) or older of chain_file's
+// snapshots. Returns 0 when it is missing, torn or fails its seal
+int snapshot_read(const char *chain_file, uint32_t generation, Snapshot *snapshot) {
+    char path[540];
+    SnapshotHeader header;
+
+    memset(snapshot, 0, sizeof(*snapshot));
+    snapshot_path(chain_file, generation, path, sizeof(path));
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return 0;
+
+    long file_size = -1;
+    if (fseek(fp, 0, SEEK_END) == 0) file_size = ftell(fp);
+    rewind(fp);
+    if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != SNAPSHOT_MAGIC ||
+        header.version != SNAPSHOT_VERSION || file_size < 0 ||
+        header.body_size != (uint64_t)file_size - sizeof(header)) {
+        printf("Warning: Ignoring unreadable snapshot %s\n", path);
+        fclose(fp);
+        return 0;
+    }
+    uint8_t *body = (uint8_t*)malloc(header.body_size ? header.body_size : 1);
+    if (!body || fread(body, 1, header.body_size, fp) != header.body_size) {
+        printf("Warning: Could not read snapshot %s\n", path);
+        free(body);
+        fclose(fp);
+        return 0;
+    }
+    fclose(fp);
+
+    if (seal_snapshot(&header, body) != header.seal) {
+        printf("Warning: Snapshot %s failed its seal check\n", path);
+        free(body);
+        return 0;
+    }
+    snapshot->info = header.info;
+    snapshot->body = body;
+    snapshot->size = header.body_size;
+    return 1;
+}
+
+// Load a snapshot's indexes, columns and claims into the empty ones. On
+// failure the caller resets them
+int snapshot_restore(const Snapshot *snapshot) {
+    const uint8_t *end = snapshot->body + snapshot->size;
+    const uint8_t *in = index_snapshot_load(snapshot->body, end);
+    if (in) in = columns_snapshot_load(in, end);
+    if (in) in = claims_snapshot_load(in, end);
+    return in == end;
+}
+
+void snapshot_free(Snapshot *snapshot) {
+    free(snapshot->body);
+    snapshot->body = NULL;
+}
+
+// Delete every snapshot of chain_file
+int snapshot_remove(const char *chain_file) {
+    char path[540], tmp_path[560];
+    int ok = 1;
+
+    snapshot_wait();
+    for (uint32_t generation = 0; generation < SNAPSHOT_GENERATIONS; generation++) {
+        snapshot_path(chain_file, generation, path, sizeof(path));
+        if (unlink(path) != 0 && errno != ENOENT) ok = 0;
+    }
+    snapshot_path(chain_file, 0, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    if (unlink(tmp_path) != 0 && errno != ENOENT) ok = 0;
+    return ok;
+}
+
+// Blocks between automatic snapshots; 0 turns them off
+void snapshot_set_interval(uint32_t blocks) {
+    interval = blocks;
+}
+
+uint32_t snapshot_interval() {
+    return interval;
+}
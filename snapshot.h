@@ -0,0 +1,40 @@
+// Derived-State Snapshots
+// ============================================================================
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sha256.h"
+
+// Blocks appended between automatic snapshots, by default
+#define SNAPSHOT_INTERVAL 10000
+// Snapshots kept: <chain>.snap and the one before it, <chain>.snap.1
+#define SNAPSHOT_GENERATIONS 2
+
+// What a snapshot covers: blocks [0, height) of the chain whose block
+// height - 1 has tip_hash
+typedef struct {
+    uint32_t height;
+    uint32_t event_count;                   // the chain's next event index
+    uint8_t tip_hash[SHA256_BLOCK_SIZE];
+} SnapshotInfo;
+
+// A snapshot read back from disk, not yet applied
+typedef struct {
+    SnapshotInfo info;
+    uint8_t *body;
+    size_t size;
+} Snapshot;
+
+int snapshot_capture(const char *chain_file, const SnapshotInfo *info);
+int snapshot_wait();
+int snapshot_read(const char *chain_file, uint32_t generation, Snapshot *snapshot);
+int snapshot_restore(const Snapshot *snapshot);
+void snapshot_free(Snapshot *snapshot);
+int snapshot_remove(const char *chain_file);
+void snapshot_set_interval(uint32_t blocks);
+uint32_t snapshot_interval();
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,1216 @@
+// Append-only Segment Log Storage
+// ============================================================================
+//
+// Blocks are appended as framed compact records (see codec.c) to numbered
+// segment files <base>.seg000000, <base>.seg000001, ... A segment is closed
+// once it reaches SEGMENT_BYTES. Records vary in size, so <base>.idx keeps
+// one 64-bit entry per height, the record's segment and offset. An append
+// is a single positioned write; index entries are written at each group
+// commit, once the records they point to are synced. Every frame carries
+// its height and a CRC-32 of its stored bytes; a record may be stored
+// compressed when that makes it smaller.
+//
+// Records name IDs and diagnosis codes by their dictionary IDs (see
+// dict.c). New dictionary strings are appended to <base>.dict ahead of the
+// first record using them and synced before it, so every durable record
+// can be decoded. Opening a log loads its dictionary in their place.
+//
+// On open, the last index entries are checked against their frames and
+// the segments are scanned past the last good entry for records whose
+// entry never made it to disk, so a crash loses at most a torn record.
+// Anything after the last good record is cut off.
+//
+// Segments are mmap'ed read-only when the log is opened and whenever a
+// segment fills up, so loading costs a handful of syscalls regardless of
+// chain size and reads touch only the pages they need. Records appended
+// to the open segment after it was mapped are read back with pread. With
+// store_set_mapped(store, 0) nothing stays mapped and every record is
+// read with pread instead, so pages the reads touch are not kept in the
+// process; callers that do so cache what they read themselves.
+//
+// Version 1 logs stored every block as a fixed 576-byte slot and the
+// events of batched blocks in a companion <base>.events file; version 2
+// logs kept every text field inline. Both are rewritten in this format by
+// store_upgrade, which builds the new log beside the old one and then
+// swaps the files. <base>.upgrading is written before the first file
+// moves and records how far the swap got, so a crash part way through is
+// finished on the next load instead of leaving no complete log.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include "storage.h"
+#include "codec.h"
+#include "dict.h"
+#include "sha256.h"
+#include "metrics.h"
+
+#define SEGMENT_MAGIC 0x47455349u  // "ISEG"
+#define INDEX_MAGIC 0x58444949u    // "IIDX"
+#define EVENTS_MAGIC 0x54564549u   // "IEVT"
+#define RECORD_MAGIC 0x43455249u   // "IREC"
+#define DICT_MAGIC 0x43494449u     // "IDIC"
+#define UPGRADE_MAGIC 0x47505549u  // "IUPG"
+#define STORE_VERSION 3
+#define STORE_MIN_VERSION 2        // oldest log store_open reads, to upgrade it
+#define SEGMENT_BYTES (64u << 20)
+#define MAX_SEGMENTS 4096
+#define MAX_RECORD CODEC_RECORD_MAX(MAX_BATCH_EVENTS)
+
+// Records smaller than this are never worth compressing
+#define COMPRESS_MIN 128
+
+// Records before the last few group commits were fsync'ed, so recovery
+// only has to validate this many trailing index entries
+#define RECOVERY_WINDOW 1024
+
+// Index entry: segment in the high bits, byte offset in the low 40
+#define ENTRY(segment, offset) ((uint64_t)(segment) << 40 | (uint64_t)(offset))
+#define ENTRY_SEGMENT(entry) ((uint32_t)((entry) >> 40))
+#define ENTRY_OFFSET(entry) ((entry) & ((1ull << 40) - 1))
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t segment;
+    uint32_t first_height;
+} SegmentHeader;
+
+// Contents of <base>.upgrading while store_upgrade swaps the logs
+typedef enum {
+    UPGRADE_MOVING_OLD,   // old log moving to <base>.v<version>
+    UPGRADE_MOVING_NEW    // upgraded log moving from <base>.upgrade
+} UpgradePhase;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;     // of the old log
+    uint32_t phase;       // UpgradePhase
+} UpgradeMarker;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t height;
+    uint32_t length;      // bytes stored after this header
+    uint32_t raw_length;  // record size; larger than length when compressed
+    uint32_t crc;         // of the stored bytes
+} RecordHeader;
+
+// Version 1 layout, only read by store_upgrade: the block was stored as
+// the in-memory struct of the time, with its hashes as hex text
+#define V1_SEGMENT_RECORDS 65536
+#define V1_RECORD_ALIGN 64
+
+typedef struct {
+    uint32_t block_id;
+    uint32_t hash_version;
+    uint32_t difficulty;
+    uint32_t nonce;
+    time_t timestamp;
+    union {
+        InsurancePayload payload;
+        EventBatch batch;
+    };
+    char prev_hash[65];
+    char hash[65];
+} BlockV1;
+
+_Static_assert(sizeof(time_t) == 8, "Block timestamp must be 64-bit");
+_Static_assert(offsetof(BlockV1, timestamp) == 16 && offsetof(BlockV1, payload) == 24 &&
+               offsetof(BlockV1, prev_hash) == 408 && offsetof(BlockV1, hash) == 473 &&
+               sizeof(BlockV1) == 544, "BlockV1 no longer matches the version 1 record format");
+
+typedef struct {
+    uint32_t magic;
+    uint32_t length;
+    uint32_t crc;
+    uint32_t height;
+    BlockV1 body;
+} RecordFrameV1;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t crc;
+    uint32_t index;
+    InsurancePayload payload;
+} EventFrameV1;
+
+#define V1_RECORD_STRIDE ((sizeof(RecordFrameV1) + V1_RECORD_ALIGN - 1) / V1_RECORD_ALIGN * V1_RECORD_ALIGN)
+#define V1_EVENT_STRIDE sizeof(EventFrameV1)
+
+struct ChainStore {
+    char base[512];
+    int fd;                 // last segment, open for appends
+    int index_fd;
+    uint32_t segment;
+    uint64_t segment_size;  // bytes in the last segment
+    uint32_t count;
+    uint32_t indexed;       // entries written to the index file
+    uint32_t index_synced;  // of those, entries known to be on disk
+    uint32_t unsynced;
+    uint64_t *entries;      // index entry per height
+    uint32_t entry_slots;
+    uint32_t version;       // of the log's segments
+    int dict_fd;
+    uint64_t dict_size;
+    uint32_t dict_saved[DICT_FIELD_COUNT];  // IDs written to the dictionary file
+    int dict_unsynced;
+    const uint8_t *maps[MAX_SEGMENTS];
+    size_t map_sizes[MAX_SEGMENTS];
+    int unmapped;                   // see store_set_mapped
+    int read_fds[MAX_SEGMENTS];     // finished segments, while unmapped
+};
+
+static uint32_t group_commit = 32;
+static int compression = 0;
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_init() {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t crc32(const void *data, size_t len) {
+    const uint8_t *bytes = (const uint8_t*)data;
+    uint32_t crc = 0xFFFFFFFFu;
+
+    pthread_once(&crc_once, crc_init);
+    for (size_t i = 0; i < len; i++) {
+        crc = crc_table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+static void segment_path(const char *base, uint32_t segment, char *path, size_t size) {
+    snprintf(path, size, "%s.seg%06u", base, segment);
+}
+
+static void index_path(const char *base, char *path, size_t size) {
+    snprintf(path, size, "%s.idx", base);
+}
+
+static void events_path(const char *base, char *path, size_t size) {
+    snprintf(path, size, "%s.events", base);
+}
+
+static void dict_path(const char *base, char *path, size_t size) {
+    snprintf(path, size, "%s.dict", base);
+}
+
+static void marker_path(const char *base, char *path, size_t size) {
+    snprintf(path, size, "%s.upgrading", base);
+}
+
+static int write_full(int fd, const void *data, size_t len, off_t offset) {
+    const uint8_t *bytes = (const uint8_t*)data;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, bytes, len, offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        bytes += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+    return 1;
+}
+
+static int read_full(int fd, void *data, size_t len, off_t offset) {
+    uint8_t *bytes = (uint8_t*)data;
+    while (len > 0) {
+        ssize_t n = pread(fd, bytes, len, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        bytes += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+    return 1;
+}
+
+// (Re)map a segment read-only over its current length
+static int map_segment(ChainStore *store, uint32_t segment, int fd) {
+    struct stat st;
+
+    if (fstat(fd, &st) != 0) return 0;
+    if (store->maps[segment]) {
+        munmap((void*)store->maps[segment], store->map_sizes[segment]);
+        store->maps[segment] = NULL;
+        store->map_sizes[segment] = 0;
+    }
+    if (st.st_size == 0) return 1;
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) return 0;
+    store->maps[segment] = (const uint8_t*)map;
+    store->map_sizes[segment] = (size_t)st.st_size;
+    return 1;
+}
+
+static int create_segment(ChainStore *store, uint32_t segment) {
+    char path[540];
+    SegmentHeader header = { SEGMENT_MAGIC, STORE_VERSION, segment, store->count };
+
+    if (segment >= MAX_SEGMENTS) {
+        printf("Error: Chain log is full (%u segments)\n", MAX_SEGMENTS);
+        return 0;
+    }
+    segment_path(store->base, segment, path, sizeof(path));
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("Error: Could not create segment %s\n", path);
+        return 0;
+    }
+    if (!write_full(fd, &header, sizeof(header), 0) || fsync(fd) != 0) {
+        printf("Error: Could not write segment header %s\n", path);
+        close(fd);
+        return 0;
+    }
+
+    // The finished segment is immutable from here on; map all of it
+    if (store->fd >= 0 && store->unmapped) {
+        store->read_fds[store->segment] = store->fd;
+    } else if (store->fd >= 0) {
+        map_segment(store, store->segment, store->fd);
+        close(store->fd);
+    }
+    store->fd = fd;
+    store->segment = segment;
+    store->segment_size = sizeof(header);
+    store->version = STORE_VERSION;
+    return 1;
+}
+
+// Segment 0 sets the log's version; every later segment must match it
+static int check_header(ChainStore *store, int fd, uint32_t segment) {
+    SegmentHeader header;
+    if (!read_full(fd, &header, sizeof(header), 0)) return 0;
+    if (segment == 0) store->version = header.version;
+    return header.magic == SEGMENT_MAGIC && header.version == store->version &&
+           header.version >= STORE_MIN_VERSION && header.version <= STORE_VERSION && header.segment == segment;
+}
+
+static int add_entry(ChainStore *store, uint64_t entry) {
+    if (store->count == store->entry_slots) {
+        uint32_t slots = store->entry_slots ? store->entry_slots * 2 : 1024;
+        uint64_t *entries = (uint64_t*)realloc(store->entries, slots * sizeof(uint64_t));
+        if (!entries) return 0;
+        store->entries = entries;
+        store->entry_slots = slots;
+    }
+    store->entries[store->count++] = entry;
+    return 1;
+}
+
+// Length of the intact record for `height` framed at offset of a mapped
+// segment, or 0 when there is none
+static size_t mapped_frame(const ChainStore *store, uint32_t segment, uint64_t offset, uint32_t height) {
+    RecordHeader header;
+    size_t size = store->map_sizes[segment];
+
+    if (!store->maps[segment] || offset + sizeof(header) > size) return 0;
+    memcpy(&header, store->maps[segment] + offset, sizeof(header));
+    if (header.magic != RECORD_MAGIC || header.height != height || header.length > MAX_RECORD ||
+        header.raw_length > MAX_RECORD || header.length > size - offset - sizeof(header) ||
+        header.crc != crc32(store->maps[segment] + offset + sizeof(header), header.length)) {
+        return 0;
+    }
+    return sizeof(header) + header.length;
+}
+
+// Check the tail of the index against the mapped segments, pick up
+// records that reached a segment but not the index, and cut off whatever
+// follows the last good record
+static int recover_tail(ChainStore *store, uint32_t last) {
+    uint32_t indexed = store->count;
+    uint32_t valid = indexed > RECOVERY_WINDOW ? indexed - RECOVERY_WINDOW : 0;
+    uint32_t segment = 0;
+    uint64_t end = sizeof(SegmentHeader);
+
+    // Entries before the window were synced long ago; a bad one there
+    // means a damaged log, not a torn tail
+    if (valid > 0) {
+        uint64_t entry = store->entries[valid - 1];
+        segment = ENTRY_SEGMENT(entry);
+        size_t length = segment <= last ? mapped_frame(store, segment, ENTRY_OFFSET(entry), valid - 1) : 0;
+        if (length == 0) return 0;
+        end = ENTRY_OFFSET(entry) + length;
+    }
+    for (; valid < indexed; valid++) {
+        uint64_t entry = store->entries[valid];
+        size_t length = ENTRY_SEGMENT(entry) <= last ?
+            mapped_frame(store, ENTRY_SEGMENT(entry), ENTRY_OFFSET(entry), valid) : 0;
+        if (length == 0) break;
+        segment = ENTRY_SEGMENT(entry);
+        end = ENTRY_OFFSET(entry) + length;
+    }
+    store->count = valid;
+
+    // Records written after their index entries were lost
+    for (;;) {
+        size_t length = mapped_frame(store, segment, end, store->count);
+        if (length == 0 && segment < last) {
+            length = mapped_frame(store, segment + 1, sizeof(SegmentHeader), store->count);
+            if (length > 0) {
+                segment++;
+                end = sizeof(SegmentHeader);
+            }
+        }
+        if (length == 0 || !add_entry(store, ENTRY(segment, end))) break;
+        end += length;
+    }
+
+    store->indexed = store->count;
+    store->index_synced = store->count;
+    if (store->count != indexed) {
+        printf("Recovered %s: index now covers %u block(s), was %u\n", store->base, store->count, indexed);
+    }
+    if (store->count > valid &&
+        !write_full(store->index_fd, store->entries + valid, (store->count - valid) * sizeof(uint64_t),
+                    (off_t)(sizeof(SegmentHeader) + (uint64_t)valid * sizeof(uint64_t)))) {
+        return 0;
+    }
+    if (ftruncate(store->index_fd, (off_t)(sizeof(SegmentHeader) + (uint64_t)store->count * sizeof(uint64_t))) != 0 ||
+        fsync(store->index_fd) != 0) {
+        return 0;
+    }
+
+    // Segments past the last good record hold nothing worth keeping
+    char path[540];
+    for (uint32_t dead = last; dead > segment; dead--) {
+        if (store->maps[dead]) munmap((void*)store->maps[dead], store->map_sizes[dead]);
+        store->maps[dead] = NULL;
+        store->map_sizes[dead] = 0;
+        segment_path(store->base, dead, path, sizeof(path));
+        unlink(path);
+    }
+    if (segment != last) {
+        close(store->fd);
+        segment_path(store->base, segment, path, sizeof(path));
+        store->fd = open(path, O_RDWR);
+        if (store->fd < 0) return 0;
+    }
+    store->segment = segment;
+    store->segment_size = end;
+
+    struct stat st;
+    if (fstat(store->fd, &st) != 0) return 0;
+    if ((uint64_t)st.st_size != end) {
+        printf("Recovered segment %u: discarded torn data after block %u\n", segment, store->count);
+        if (ftruncate(store->fd, (off_t)end) != 0 || fsync(store->fd) != 0) return 0;
+    }
+    return map_segment(store, segment, store->fd);
+}
+
+// Whether a log is at base_path, counting one an interrupted upgrade
+// left part moved
+int store_exists(const char *base_path) {
+    char path[540];
+    segment_path(base_path, 0, path, sizeof(path));
+    if (access(path, F_OK) == 0) return 1;
+    marker_path(base_path, path, sizeof(path));
+    return access(path, F_OK) == 0;
+}
+
+// Read the index into memory; a missing index is rebuilt from the segments
+static int open_index(ChainStore *store) {
+    char path[540];
+    struct stat st;
+    SegmentHeader header = { INDEX_MAGIC, STORE_VERSION, 0, 0 };
+
+    index_path(store->base, path, sizeof(path));
+    store->index_fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (store->index_fd < 0 || fstat(store->index_fd, &st) != 0) return 0;
+
+    if (st.st_size < (off_t)sizeof(header)) {
+        return write_full(store->index_fd, &header, sizeof(header), 0) && fsync(store->index_fd) == 0;
+    }
+
+    SegmentHeader found;
+    if (!read_full(store->index_fd, &found, sizeof(found), 0) || found.magic != INDEX_MAGIC ||
+        found.version < STORE_MIN_VERSION || found.version > STORE_VERSION) {
+        return 0;
+    }
+    uint64_t count = (uint64_t)(st.st_size - (off_t)sizeof(header)) / sizeof(uint64_t);
+    if (count > UINT32_MAX) return 0;
+    store->entry_slots = count > 1024 ? (uint32_t)count : 1024;
+    store->entries = (uint64_t*)malloc(store->entry_slots * sizeof(uint64_t));
+    if (!store->entries) return 0;
+    store->count = (uint32_t)count;
+    return count == 0 || read_full(store->index_fd, store->entries, count * sizeof(uint64_t), sizeof(header));
+}
+
+// Parse the dictionary file into the in-memory dictionaries, replacing
+// what they held; a torn last entry is cut off
+static int load_dictionary(ChainStore *store, uint64_t size) {
+    uint8_t *data = (uint8_t*)malloc(size);
+    SegmentHeader header;
+    uint64_t end = sizeof(header);
+
+    if (!data || !read_full(store->dict_fd, data, size, 0)) {
+        free(data);
+        return 0;
+    }
+    memcpy(&header, data, sizeof(header));
+    int ok = header.magic == DICT_MAGIC && header.version == STORE_VERSION;
+
+    // Each entry is its field, its length and the text; IDs follow from
+    // the order of the entries
+    dict_reset();
+    while (ok && end + 2 <= size) {
+        uint8_t field = data[end], length = data[end + 1];
+        if (field >= DICT_FIELD_COUNT || length == 0 || length > DICT_MAX_LENGTH || end + 2 + length > size) break;
+        uint32_t expected = dict_count((DictField)field);
+        ok = dict_intern((DictField)field, (const char*)data + end + 2, length) == expected;
+        end += 2 + (uint64_t)length;
+    }
+    free(data);
+    if (!ok) return 0;
+
+    for (int field = 0; field < DICT_FIELD_COUNT; field++) {
+        store->dict_saved[field] = dict_count((DictField)field);
+    }
+    store->dict_size = end;
+    if (end < size) {
+        printf("Recovered %s: discarded a torn dictionary entry\n", store->base);
+        if (ftruncate(store->dict_fd, (off_t)end) != 0 || fsync(store->dict_fd) != 0) return 0;
+    }
+    return 1;
+}
+
+// A new log starts out with whatever the dictionaries hold, written
+// before its first record; an existing one loads its own
+static int open_dictionary(ChainStore *store, int existing) {
+    char path[540];
+    struct stat st;
+    SegmentHeader header = { DICT_MAGIC, STORE_VERSION, 0, 0 };
+
+    dict_path(store->base, path, sizeof(path));
+    // Records of a log that lost its dictionary can no longer be decoded
+    store->dict_fd = open(path, existing && store->count > 0 ? O_RDWR : O_RDWR | O_CREAT, 0644);
+    if (store->dict_fd < 0 || fstat(store->dict_fd, &st) != 0) return 0;
+
+    if (existing && st.st_size >= (off_t)sizeof(header)) {
+        return load_dictionary(store, (uint64_t)st.st_size);
+    }
+    if (existing && store->count > 0) return 0;
+    for (int field = 0; field < DICT_FIELD_COUNT; field++) {
+        store->dict_saved[field] = 1;  // ID 0 is implied
+    }
+    store->dict_size = sizeof(header);
+    return write_full(store->dict_fd, &header, sizeof(header), 0) && ftruncate(store->dict_fd, sizeof(header)) == 0 &&
+           fsync(store->dict_fd) == 0;
+}
+
+// Write out the dictionary strings added since the last append, so they
+// reach the file before any record using them
+static int write_dictionary(ChainStore *store) {
+    uint8_t buffer[4096];
+    size_t used = 0;
+
+    for (int field = 0; field < DICT_FIELD_COUNT; field++) {
+        uint32_t count = dict_count((DictField)field);
+        for (uint32_t id = store->dict_saved[field]; id < count; id++) {
+            size_t length;
+            const char *text = dict_string((DictField)field, id, &length);
+            if (used + 2 + DICT_MAX_LENGTH > sizeof(buffer)) {
+                if (!write_full(store->dict_fd, buffer, used, (off_t)store->dict_size)) return 0;
+                store->dict_size += used;
+                used = 0;
+            }
+            buffer[used] = (uint8_t)field;
+            buffer[used + 1] = (uint8_t)length;
+            memcpy(buffer + used + 2, text, length);
+            used += 2 + length;
+        }
+        if (count > store->dict_saved[field]) store->dict_unsynced = 1;
+        store->dict_saved[field] = count;
+    }
+    if (used > 0 && !write_full(store->dict_fd, buffer, used, (off_t)store->dict_size)) return 0;
+    store->dict_size += used;
+    return 1;
+}
+
+static ChainStore* open_segments(ChainStore *store, const char *base_path);
+
+// Open the log at base_path, recovering a torn tail; with create set, an
+// empty log is started when none exists. Opening an existing log replaces
+// the in-memory dictionaries with its own
+ChainStore* store_open(const char *base_path, int create) {
+    ChainStore *store = (ChainStore*)calloc(1, sizeof(ChainStore));
+    if (!store) return NULL;
+    snprintf(store->base, sizeof(store->base), "%s", base_path);
+    store->fd = -1;
+    store->index_fd = -1;
+    store->dict_fd = -1;
+    for (uint32_t i = 0; i < MAX_SEGMENTS; i++) {
+        store->read_fds[i] = -1;
+    }
+
+    int existing = store_exists(base_path);
+    if (!existing) {
+        char path[540];
+        if (!create) {
+            free(store);
+            return NULL;
+        }
+        // An index or dictionary without segments is left over from a
+        // removed log
+        index_path(base_path, path, sizeof(path));
+        unlink(path);
+        dict_path(base_path, path, sizeof(path));
+        unlink(path);
+    }
+    if (!open_index(store)) {
+        printf("Error: Could not open the index of %s\n", base_path);
+        store_close(store);
+        return NULL;
+    }
+    store = open_segments(store, base_path);
+
+    // Logs waiting for store_upgrade have no dictionary
+    if (store && store->version == STORE_VERSION && !open_dictionary(store, existing)) {
+        printf("Error: Could not open the dictionary of %s\n", base_path);
+        store_close(store);
+        return NULL;
+    }
+    return store;
+}
+
+static ChainStore* open_segments(ChainStore *store, const char *base_path) {
+    if (!store_exists(base_path)) {
+        if (!create_segment(store, 0)) {
+            store_close(store);
+            return NULL;
+        }
+        return store;
+    }
+
+    // Map every segment; a last one torn while rolling over is dropped
+    char path[540];
+    uint32_t last = 0;
+    for (uint32_t segment = 0; segment < MAX_SEGMENTS; segment++) {
+        segment_path(base_path, segment, path, sizeof(path));
+        int fd = open(path, O_RDWR);
+        if (fd < 0) break;
+
+        int valid = check_header(store, fd, segment);
+        segment_path(base_path, segment + 1, path, sizeof(path));
+        if (!valid && segment > 0 && access(path, F_OK) != 0) {
+            printf("Recovered: dropping segment %u, torn while it was created\n", segment);
+            close(fd);
+            segment_path(base_path, segment, path, sizeof(path));
+            unlink(path);
+            break;
+        }
+        if (!valid || !map_segment(store, segment, fd)) {
+            close(fd);
+            segment_path(base_path, segment, path, sizeof(path));
+            printf("Error: %s is not a valid chain segment\n", path);
+            store_close(store);
+            return NULL;
+        }
+        if (store->fd >= 0) close(store->fd);
+        store->fd = fd;
+        last = segment;
+    }
+
+    if (!recover_tail(store, last)) {
+        printf("Error: Could not recover the log at %s\n", base_path);
+        store_close(store);
+        return NULL;
+    }
+    return store;
+}
+
+// Delete the index, dictionary and every segment of the log at
+// base_path, and the events file of a version 1 log
+int store_remove(const char *base_path) {
+    char path[540];
+    index_path(base_path, path, sizeof(path));
+    if (unlink(path) != 0 && errno != ENOENT) return 0;
+    dict_path(base_path, path, sizeof(path));
+    if (unlink(path) != 0 && errno != ENOENT) return 0;
+    events_path(base_path, path, sizeof(path));
+    if (unlink(path) != 0 && errno != ENOENT) return 0;
+    for (uint32_t segment = 0;; segment++) {
+        segment_path(base_path, segment, path, sizeof(path));
+        if (unlink(path) != 0) return errno == ENOENT;
+    }
+}
+
+// Bytes on disk for the log at base_path: every segment plus the index
+// and dictionary
+uint64_t store_disk_bytes(const char *base_path) {
+    char path[540];
+    struct stat st;
+    uint64_t bytes = 0;
+
+    index_path(base_path, path, sizeof(path));
+    if (stat(path, &st) == 0) bytes += (uint64_t)st.st_size;
+    dict_path(base_path, path, sizeof(path));
+    if (stat(path, &st) == 0) bytes += (uint64_t)st.st_size;
+    for (uint32_t segment = 0;; segment++) {
+        segment_path(base_path, segment, path, sizeof(path));
+        if (stat(path, &st) != 0) return bytes;
+        bytes += (uint64_t)st.st_size;
+    }
+}
+
+static int write_frame(int fd, const RecordHeader *header, const uint8_t *stored, off_t offset) {
+    struct iovec parts[2] = {
+        { (void*)header, sizeof(*header) },
+        { (void*)stored, header->length }
+    };
+    size_t left = sizeof(*header) + header->length;
+
+    for (;;) {
+        ssize_t n = pwritev(fd, parts, 2, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return 0;
+        if ((size_t)n == left) return 1;
+        // Short write: finish the rest with plain positioned writes
+        const uint8_t *frame = (const uint8_t*)header;
+        if ((size_t)n < sizeof(*header)) {
+            return write_full(fd, frame + n, sizeof(*header) - (size_t)n, offset + n) &&
+                   write_full(fd, stored, header->length, offset + (off_t)sizeof(*header));
+        }
+        size_t done = (size_t)n - sizeof(*header);
+        return write_full(fd, stored + done, header->length - done, offset + n);
+    }
+}
+
+// Make every appended record durable, its dictionary strings first, then
+// write their index entries, so an entry never reaches disk ahead of its
+// record. Recovery rebuilds lost entries from the segments, so the index
+// itself is only synced once half the recovery window is at stake, or
+// when asked to
+static int flush(ChainStore *store, int sync_index) {
+    if (store->unsynced == 0 && store->index_synced == store->count && !store->dict_unsynced) return 1;
+    if (store->dict_unsynced) {
+        if (fdatasync(store->dict_fd) != 0) {
+            printf("Error: fsync failed on the dictionary of %s\n", store->base);
+            return 0;
+        }
+        store->dict_unsynced = 0;
+    }
+    if (store->unsynced > 0 && fdatasync(store->fd) != 0) {
+        printf("Error: fsync failed on segment %u\n", store->segment);
+        return 0;
+    }
+    off_t at = (off_t)(sizeof(SegmentHeader) + (uint64_t)store->indexed * sizeof(uint64_t));
+    if (!write_full(store->index_fd, store->entries + store->indexed,
+                    (store->count - store->indexed) * sizeof(uint64_t), at)) {
+        printf("Error: Could not update the index of %s\n", store->base);
+        return 0;
+    }
+    store->indexed = store->count;
+    store->unsynced = 0;
+    if (sync_index || store->count - store->index_synced >= RECOVERY_WINDOW / 2) {
+        if (fdatasync(store->index_fd) != 0) {
+            printf("Error: Could not update the index of %s\n", store->base);
+            return 0;
+        }
+        store->index_synced = store->count;
+    }
+    return 1;
+}
+
+// Append one record; fsync and its index entry are batched by group
+// commit. Readers must be held off while this runs
+int store_append(ChainStore *store, const uint8_t *record, uint32_t length) {
+    uint32_t height = store->count;
+    uint8_t *packed = NULL;
+
+    if (store->version != STORE_VERSION) {
+        printf("Error: %s must be upgraded before blocks are appended\n", store->base);
+        return 0;
+    }
+    if (length > MAX_RECORD) {
+        printf("Error: Block %u is too large to store\n", height);
+        return 0;
+    }
+    if (store->segment_size > sizeof(SegmentHeader) &&
+        store->segment_size + sizeof(RecordHeader) + length > SEGMENT_BYTES) {
+        if (!store_sync(store) || !create_segment(store, store->segment + 1)) return 0;
+    }
+
+    RecordHeader header = { RECORD_MAGIC, height, length, length, 0 };
+    const uint8_t *stored = record;
+    if (compression && length >= COMPRESS_MIN && (packed = (uint8_t*)malloc(length))) {
+        size_t size = codec_compress(record, length, packed);
+        if (size > 0) {
+            header.length = (uint32_t)size;
+            stored = packed;
+        }
+    }
+    header.crc = crc32(stored, header.length);
+
+    uint64_t entry = ENTRY(store->segment, store->segment_size);
+    int written = write_dictionary(store) && write_frame(store->fd, &header, stored, (off_t)store->segment_size) && add_entry(store, entry);
+    free(packed);
+    if (!written) {
+        printf("Error: Could not append block %u\n", height);
+        return 0;
+    }
+    uint64_t size = sizeof(header) + header.length;
+    store->segment_size += size;
+    store->unsynced++;
+    metrics_add(METRIC_BYTES_SAVED, size + sizeof(entry));
+    if (store->unsynced >= group_commit) {
+        return flush(store, 0);
+    }
+    return 1;
+}
+
+int store_sync(ChainStore *store) {
+    return flush(store, 1);
+}
+
+// Descriptor to pread a segment with, -1 when it is mapped instead
+static int segment_fd(const ChainStore *store, uint32_t segment) {
+    if (segment == store->segment) return store->fd;
+    return segment < MAX_SEGMENTS ? store->read_fds[segment] : -1;
+}
+
+static uint8_t *record_buffer(StoreRecord *record, size_t size) {
+    if (size > record->capacity) {
+        uint8_t *grown = (uint8_t*)realloc(record->buffer, size);
+        if (!grown) return NULL;
+        record->buffer = grown;
+        record->capacity = size;
+    }
+    return record->buffer;
+}
+
+// Block h's record. An uncompressed record in a mapped segment is handed
+// out in place with only its frame header checked. Recovery CRC-checks
+// just the last RECOVERY_WINDOW records on open, so older ones are never
+// checksummed here; a damaged one is left to decoding, and to
+// verification, which rehashes every block. Anything else is read or
+// expanded into the record's buffer with its CRC checked. Safe to call
+// from several threads while no append is in progress
+int store_read(const ChainStore *store, uint32_t height, StoreRecord *record) {
+    RecordHeader header;
+    const uint8_t *stored;
+
+    if (height >= store->count) return 0;
+    uint32_t segment = ENTRY_SEGMENT(store->entries[height]);
+    uint64_t offset = ENTRY_OFFSET(store->entries[height]);
+    const uint8_t *map = segment < MAX_SEGMENTS ? store->maps[segment] : NULL;
+    size_t map_size = map ? store->map_sizes[segment] : 0;
+
+    if (offset + sizeof(header) <= map_size) {
+        memcpy(&header, map + offset, sizeof(header));
+    } else if (!read_full(segment_fd(store, segment), &header, sizeof(header), (off_t)offset)) {
+        return 0;
+    }
+    if (header.magic != RECORD_MAGIC || header.height != height || header.length > MAX_RECORD ||
+        header.raw_length > MAX_RECORD || header.length > header.raw_length) {
+        printf("Error: Block %u has a damaged record header\n", height);
+        return 0;
+    }
+
+    uint64_t body = offset + sizeof(header);
+    if (body + header.length <= map_size) {
+        stored = map + body;
+        if (header.length == header.raw_length) {
+            record->data = stored;
+            record->length = header.length;
+            return 1;
+        }
+    } else {
+        uint8_t *buffer = record_buffer(record, (size_t)header.length + header.raw_length);
+        if (!buffer || !read_full(segment_fd(store, segment), buffer, header.length, (off_t)body)) return 0;
+        stored = buffer;
+    }
+
+    if (header.crc != crc32(stored, header.length)) {
+        printf("Error: Block %u failed its record checksum\n", height);
+        return 0;
+    }
+    if (header.length == header.raw_length) {
+        record->data = stored;
+        record->length = header.length;
+        return 1;
+    }
+
+    // Expanded after the stored bytes when those were read into the buffer too
+    size_t at = stored == record->buffer ? header.length : 0;
+    uint8_t *buffer = record_buffer(record, at + header.raw_length);
+    if (!buffer) return 0;
+    stored = at ? buffer : stored;
+    if (!codec_decompress(stored, header.length, buffer + at, header.raw_length)) {
+        printf("Error: Block %u failed to decompress\n", height);
+        return 0;
+    }
+    record->data = buffer + at;
+    record->length = header.raw_length;
+    return 1;
+}
+
+void store_release(StoreRecord *record) {
+    free(record->buffer);
+    record->buffer = NULL;
+    record->capacity = 0;
+}
+
+uint32_t store_count(const ChainStore *store) {
+    return store->count;
+}
+
+const char* store_path(const ChainStore *store) {
+    return store->base;
+}
+
+// Number of appends per fsync; 1 syncs every block. Capped so index
+// entries not yet synced always fall inside the window recovery validates
+void store_set_group_commit(uint32_t blocks) {
+    if (blocks < 1) blocks = 1;
+    group_commit = blocks > RECOVERY_WINDOW / 2 ? RECOVERY_WINDOW / 2 : blocks;
+}
+
+// Keep the segments mapped (the default) or unmap them and read every
+// record with pread. A segment that cannot be switched stays as it was.
+// Readers must be held off while this runs
+int store_set_mapped(ChainStore *store, int mapped) {
+    char path[540];
+    int ok = 1;
+
+    for (uint32_t segment = 0; segment <= store->segment && segment < MAX_SEGMENTS; segment++) {
+        int last = segment == store->segment;
+        if (mapped) {
+            int fd = last ? store->fd : store->read_fds[segment];
+            if (store->maps[segment] || fd < 0) continue;
+            if (!map_segment(store, segment, fd)) {
+                ok = 0;
+            } else if (!last) {
+                close(fd);
+                store->read_fds[segment] = -1;
+            }
+        } else if (store->maps[segment]) {
+            if (!last) {
+                segment_path(store->base, segment, path, sizeof(path));
+                store->read_fds[segment] = open(path, O_RDONLY);
+                if (store->read_fds[segment] < 0) {
+                    ok = 0;
+                    continue;
+                }
+            }
+            munmap((void*)store->maps[segment], store->map_sizes[segment]);
+            store->maps[segment] = NULL;
+            store->map_sizes[segment] = 0;
+        }
+    }
+    store->unmapped = !mapped;
+    return ok;
+}
+
+// Compress records appended from now on when that makes them smaller
+void store_set_compression(int enabled) {
+    compression = enabled;
+}
+
+void store_close(ChainStore *store) {
+    if (!store) return;
+    if (store->fd >= 0) {
+        store_sync(store);
+        close(store->fd);
+    }
+    if (store->index_fd >= 0) close(store->index_fd);
+    if (store->dict_fd >= 0) close(store->dict_fd);
+    for (uint32_t i = 0; i < MAX_SEGMENTS; i++) {
+        if (store->maps[i]) munmap((void*)store->maps[i], store->map_sizes[i]);
+        if (store->read_fds[i] >= 0) close(store->read_fds[i]);
+    }
+    free(store->entries);
+    free(store);
+}
+
+// Version of the log at base_path, 0 when there is none
+static uint32_t log_version(const char *base_path) {
+    char path[540];
+    SegmentHeader header;
+
+    segment_path(base_path, 0, path, sizeof(path));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    int read = read_full(fd, &header, sizeof(header), 0) && header.magic == SEGMENT_MAGIC;
+    close(fd);
+    return read ? header.version : 0;
+}
+
+// Whether the log at base_path is in an older format store_upgrade
+// rewrites, or its upgrade was interrupted
+int store_needs_upgrade(const char *base_path) {
+    char path[540];
+    marker_path(base_path, path, sizeof(path));
+    if (access(path, F_OK) == 0) return 1;
+    uint32_t version = log_version(base_path);
+    return version > 0 && version < STORE_VERSION;
+}
+
+static int read_v1_event(int fd, uint32_t index, InsurancePayload *event) {
+    EventFrameV1 frame;
+    if (fd < 0 || !read_full(fd, &frame, sizeof(frame), (off_t)V1_EVENT_STRIDE * (1 + (off_t)index))) return 0;
+    if (frame.magic != EVENTS_MAGIC || frame.index != index ||
+        frame.crc != crc32(&frame.payload, sizeof(InsurancePayload))) {
+        return 0;
+    }
+    *event = frame.payload;
+    return 1;
+}
+
+static int reserve_record(uint8_t **record, size_t *capacity, uint32_t events) {
+    size_t needed = CODEC_RECORD_MAX(events);
+    if (needed > *capacity) {
+        uint8_t *grown = (uint8_t*)realloc(*record, needed);
+        if (!grown) return 0;
+        *record = grown;
+        *capacity = needed;
+    }
+    return 1;
+}
+
+// Re-encode one version 1 block, with its events, as a compact record
+static size_t convert_v1_block(const BlockV1 *old, int event_fd, uint8_t **record, size_t *capacity) {
+    Block block;
+    uint32_t events = old->hash_version >= HASH_VERSION_BATCH ? old->batch.event_count : 0;
+
+    if (events > MAX_BATCH_EVENTS) return 0;
+    memset(&block, 0, sizeof(block));
+    block.block_id = old->block_id;
+    block.hash_version = old->hash_version;
+    block.difficulty = old->difficulty;
+    block.nonce = old->nonce;
+    block.timestamp = old->timestamp;
+    if (events > 0) {
+        block.batch = old->batch;
+    } else {
+        block.payload = old->payload;
+    }
+    // Genesis linked to "0", which is no hash: it becomes all zeros
+    if (!hex_to_bytes(old->prev_hash, block.prev_hash, SHA256_BLOCK_SIZE)) memset(block.prev_hash, 0, SHA256_BLOCK_SIZE);
+    if (!hex_to_bytes(old->hash, block.hash, SHA256_BLOCK_SIZE)) memset(block.hash, 0, SHA256_BLOCK_SIZE);
+
+    if (!reserve_record(record, capacity, events)) return 0;
+    size_t length = codec_encode_block(&block, *record);
+    for (uint32_t i = 0; length > 0 && i < events; i++) {
+        InsurancePayload event;
+        if (!read_v1_event(event_fd, old->batch.first_event + i, &event)) {
+            printf("Error: Event %u of block %u is unreadable\n", old->batch.first_event + i, old->block_id);
+            return 0;
+        }
+        size_t size = codec_encode_event(&event, *record + length);
+        length = size ? length + size : 0;
+    }
+    return length;
+}
+
+// Re-encode one version 2 record with its text fields interned
+static size_t convert_v2_record(const StoreRecord *old, uint8_t **record, size_t *capacity) {
+    const uint8_t *end = old->data + old->length;
+    Block block;
+
+    const uint8_t *cursor = codec_decode_block_v2(old->data, end, &block);
+    uint32_t events = cursor && block.hash_version >= HASH_VERSION_BATCH ? block.batch.event_count : 0;
+    if (!cursor || events > MAX_BATCH_EVENTS || !reserve_record(record, capacity, events)) return 0;
+
+    size_t length = codec_encode_block(&block, *record);
+    for (uint32_t i = 0; length > 0 && i < events; i++) {
+        InsurancePayload event;
+        if (!(cursor = codec_decode_event_v2(cursor, end, &event))) return 0;
+        size_t size = codec_encode_event(&event, *record + length);
+        length = size ? length + size : 0;
+    }
+    return cursor == end ? length : 0;
+}
+
+// Move every file of a log; only the first segment must exist. A move
+// that was cut short is resumed: segments already at `to` are skipped
+static int rename_log(const char *from, const char *to) {
+    void (*companions[])(const char*, char*, size_t) = { index_path, dict_path, events_path };
+    char old_path[560], new_path[560];
+
+    for (size_t i = 0; i < sizeof(companions) / sizeof(companions[0]); i++) {
+        companions[i](from, old_path, sizeof(old_path));
+        companions[i](to, new_path, sizeof(new_path));
+        if (rename(old_path, new_path) != 0 && errno != ENOENT) return 0;
+    }
+    for (uint32_t segment = 0;; segment++) {
+        segment_path(from, segment, old_path, sizeof(old_path));
+        segment_path(to, segment, new_path, sizeof(new_path));
+        if (rename(old_path, new_path) == 0) continue;
+        if (errno != ENOENT) return 0;
+        if (access(new_path, F_OK) != 0) return segment > 0;
+    }
+}
+
+// Move an open log to base path `to`, where no log may exist yet, e.g.
+// once a log built beside it is complete and synced
+int store_rename(ChainStore *store, const char *to) {
+    if (store_exists(to) || strlen(to) >= sizeof(store->base) || !rename_log(store->base, to)) return 0;
+    snprintf(store->base, sizeof(store->base), "%s", to);
+    return 1;
+}
+
+// Append every block of a version 1 log to fresh, counting them in
+// height. The log ends at the first torn or damaged record, as opening it
+// would have
+static int upgrade_v1(const char *base_path, ChainStore *fresh, uint32_t *height) {
+    char path[540];
+    uint8_t *record = NULL;
+    size_t capacity = 0;
+    int ok = 1, more = 1;
+
+    events_path(base_path, path, sizeof(path));
+    int event_fd = open(path, O_RDONLY);
+    for (uint32_t segment = 0; ok && more; segment++) {
+        segment_path(base_path, segment, path, sizeof(path));
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) break;
+
+        for (uint32_t slot = 0; slot < V1_SEGMENT_RECORDS; slot++, (*height)++) {
+            RecordFrameV1 frame;
+            if (!read_full(fd, &frame, sizeof(frame), (off_t)V1_RECORD_STRIDE * (1 + slot)) ||
+                frame.magic != RECORD_MAGIC || frame.length != sizeof(BlockV1) || frame.height != *height ||
+                frame.crc != crc32(&frame.body, sizeof(BlockV1))) {
+                more = 0;  // the end of the old log
+                break;
+            }
+            size_t length = convert_v1_block(&frame.body, event_fd, &record, &capacity);
+            if (length == 0 || !store_append(fresh, record, (uint32_t)length)) {
+                ok = 0;
+                break;
+            }
+        }
+        close(fd);
+    }
+    if (event_fd >= 0) close(event_fd);
+    free(record);
+    return ok;
+}
+
+// Append every block of a version 2 log to fresh; opening the old log
+// recovers its tail as before
+static int upgrade_v2(const char *base_path, ChainStore *fresh, uint32_t *height) {
+    ChainStore *old = store_open(base_path, 0);
+    StoreRecord stored = { 0 };
+    uint8_t *record = NULL;
+    size_t capacity = 0;
+    int ok = old != NULL;
+
+    for (; ok && *height < old->count; (*height)++) {
+        size_t length = store_read(old, *height, &stored) ? convert_v2_record(&stored, &record, &capacity) : 0;
+        if (length == 0 || !store_append(fresh, record, (uint32_t)length)) {
+            ok = 0;
+            break;
+        }
+    }
+    store_release(&stored);
+    free(record);
+    store_close(old);
+    return ok;
+}
+
+static int write_marker(const char *base_path, const UpgradeMarker *marker) {
+    char path[540];
+    marker_path(base_path, path, sizeof(path));
+    int fd = open(path, O_WRONLY | O_CREAT, 0644);
+    if (fd < 0) return 0;
+    int ok = write_full(fd, marker, sizeof(*marker), 0) && fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+static int read_marker(const char *base_path, UpgradeMarker *marker) {
+    char path[540];
+    marker_path(base_path, path, sizeof(path));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    int ok = read_full(fd, marker, sizeof(*marker), 0) && marker->magic == UPGRADE_MAGIC &&
+             marker->phase <= UPGRADE_MOVING_NEW;
+    close(fd);
+    return ok;
+}
+
+// Move the old log aside and the upgraded one into its place, from the
+// phase the marker records. Every step can be repeated, so a swap cut
+// short by a crash is finished by running this again
+static int swap_upgraded(const char *base_path, UpgradeMarker *marker) {
+    char work[520], kept[520], path[540];
+
+    snprintf(work, sizeof(work), "%s.upgrade", base_path);
+    snprintf(kept, sizeof(kept), "%s.v%u", base_path, marker->version);
+    if (marker->phase == UPGRADE_MOVING_OLD) {
+        if (!rename_log(base_path, kept)) return 0;
+        marker->phase = UPGRADE_MOVING_NEW;
+        if (!write_marker(base_path, marker)) return 0;
+    }
+    if (!rename_log(work, base_path)) return 0;
+    marker_path(base_path, path, sizeof(path));
+    return unlink(path) == 0;
+}
+
+// Rewrite an older log at base_path in the current format, building its
+// dictionary afresh. The new log is built beside it, then the old files
+// move to <base>.v<version>.* and the new ones take their place. A swap
+// a crash interrupted is finished first; a marker torn while it was
+// written means no file moved yet, so the upgrade starts over
+int store_upgrade(const char *base_path) {
+    char work[520], kept[520];
+    UpgradeMarker marker;
+    uint32_t height = 0;
+
+    if (read_marker(base_path, &marker)) {
+        snprintf(kept, sizeof(kept), "%s.v%u", base_path, marker.version);
+        if (!swap_upgraded(base_path, &marker)) {
+            printf("Error: Could not finish the interrupted upgrade of %s\n", base_path);
+            return 0;
+        }
+        printf("Recovered: finished the interrupted upgrade of %s (old log kept as %s.*)\n", base_path, kept);
+        return 1;
+    }
+    uint32_t version = log_version(base_path);
+    if (version == 0 || version >= STORE_VERSION) return 0;
+
+    snprintf(work, sizeof(work), "%s.upgrade", base_path);
+    snprintf(kept, sizeof(kept), "%s.v%u", base_path, version);
+    store_remove(work);
+    dict_reset();
+    ChainStore *fresh = store_open(work, 1);
+    if (!fresh) return 0;
+
+    int ok = version == 1 ? upgrade_v1(base_path, fresh, &height) : upgrade_v2(base_path, fresh, &height);
+    if (!ok) {
+        store_close(fresh);
+        store_remove(work);
+        printf("Error: Could not upgrade %s at block %u\n", base_path, height);
+        return 0;
+    }
+
+    int synced = store_sync(fresh);
+    store_close(fresh);
+    marker = (UpgradeMarker){ UPGRADE_MAGIC, version, UPGRADE_MOVING_OLD };
+    if (!synced || !write_marker(base_path, &marker) || !swap_upgraded(base_path, &marker)) {
+        printf("Error: Could not replace %s with its upgraded log\n", base_path);
+        return 0;
+    }
+    printf("Upgraded %s to the current log format (%u blocks; old log kept as %s.*)\n", base_path, height, kept);
+    return 1;
+}
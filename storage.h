@@ -0,0 +1,40 @@
+// Append-only Segment Log Storage
+// ============================================================================
+
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "insurance_types.h"
+
+typedef struct ChainStore ChainStore;
+
+// A record read back from the log: data points into a mapped segment or
+// into buffer, which grows as needed and is freed by store_release
+typedef struct {
+    const uint8_t *data;
+    uint32_t length;
+    uint8_t *buffer;
+    size_t capacity;
+} StoreRecord;
+
+ChainStore* store_open(const char *base_path, int create);
+int store_exists(const char *base_path);
+int store_remove(const char *base_path);
+uint64_t store_disk_bytes(const char *base_path);
+int store_needs_upgrade(const char *base_path);
+int store_upgrade(const char *base_path);
+int store_rename(ChainStore *store, const char *to);
+int store_append(ChainStore *store, const uint8_t *record, uint32_t length);
+int store_sync(ChainStore *store);
+int store_read(const ChainStore *store, uint32_t height, StoreRecord *record);
+void store_release(StoreRecord *record);
+uint32_t store_count(const ChainStore *store);
+const char* store_path(const ChainStore *store);
+void store_set_group_commit(uint32_t blocks);
+void store_set_compression(int enabled);
+int store_set_mapped(ChainStore *store, int mapped);
+void store_close(ChainStore *store);
+
+#endif // STORAGE_H
@@ -0,0 +1,76 @@
+// Buffered Text Output
+// ============================================================================
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include "textbuf.h"
+
+void textbuf_init(TextBuffer *buf, char *storage, size_t capacity, FILE *sink) {
+    buf->data = storage;
+    buf->capacity = capacity;
+    buf->len = 0;
+    buf->sink = sink;
+}
+
+void textbuf_flush(TextBuffer *buf) {
+    if (buf->len > 0) fwrite(buf->data, 1, buf->len, buf->sink);
+    buf->len = 0;
+}
+
+// Room for n bytes at the end of the buffer, flushing first if needed.
+// n must not exceed the capacity; finish with textbuf_commit
+char* textbuf_reserve(TextBuffer *buf, size_t n) {
+    if (buf->capacity - buf->len < n) textbuf_flush(buf);
+    return buf->data + buf->len;
+}
+
+void textbuf_commit(TextBuffer *buf, size_t n) {
+    buf->len += n;
+}
+
+void textbuf_append(TextBuffer *buf, const char *text) {
+    size_t n = strlen(text);
+    if (n > buf->capacity) {
+        textbuf_flush(buf);
+        fwrite(text, 1, n, buf->sink);
+        return;
+    }
+    memcpy(textbuf_reserve(buf, n), text, n);
+    buf->len += n;
+}
+
+void textbuf_printf(TextBuffer *buf, const char *format, ...) {
+    va_list args;
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        size_t room = buf->capacity - buf->len;
+        va_start(args, format);
+        int n = vsnprintf(buf->data + buf->len, room, format, args);
+        va_end(args);
+        if (n < 0) return;
+        if ((size_t)n < room) {
+            buf->len += (size_t)n;
+            return;
+        }
+        textbuf_flush(buf);
+    }
+
+    // Longer than the whole buffer: straight to the sink
+    va_start(args, format);
+    vfprintf(buf->sink, format, args);
+    va_end(args);
+}
+
+// Local time in ctime's layout, newline included, without its shared
+// static buffer
+void textbuf_time(TextBuffer *buf, time_t when) {
+    struct tm tm;
+    char *at = textbuf_reserve(buf, 32);
+
+    if (!localtime_r(&when, &tm)) {
+        textbuf_append(buf, "(invalid time)\n");
+        return;
+    }
+    buf->len += strftime(at, 32, "%a %b %e %H:%M:%S %Y\n", &tm);
+}
@@ -0,0 +1,28 @@
+// Buffered Text Output
+// ============================================================================
+
+#ifndef TEXTBUF_H
+#define TEXTBUF_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <time.h>
+
+// Caller-provided storage that is written to sink whenever it fills, so a
+// report of any length costs a handful of large writes
+typedef struct {
+    char *data;
+    size_t capacity;
+    size_t len;
+    FILE *sink;
+} TextBuffer;
+
+void textbuf_init(TextBuffer *buf, char *storage, size_t capacity, FILE *sink);
+char* textbuf_reserve(TextBuffer *buf, size_t n);
+void textbuf_commit(TextBuffer *buf, size_t n);
+void textbuf_append(TextBuffer *buf, const char *text);
+void textbuf_printf(TextBuffer *buf, const char *format, ...) __attribute__((format(printf, 2, 3)));
+void textbuf_time(TextBuffer *buf, time_t when);
+void textbuf_flush(TextBuffer *buf);
+
+#endif // TEXTBUF_H
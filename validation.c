@@ -6,27 +6,42 @@
 #include <string.h>
 #include <ctype.h>
 
-int validate_id(const char *id) {
+// Why an ID is invalid, or NULL when it is fine
+const char* id_error(const char *id) {
     if (strlen(id) == 0 || strlen(id) >= 32) {
-        printf("Error: ID must be between 1-31 characters\n");
-        return 0;
+        return "ID must be between 1-31 characters";
     }
     for (size_t i = 0; i < strlen(id); i++) {
         if (!isalnum(id[i]) && id[i] != '_' && id[i] != '-') {
-            printf("Error: ID can only contain letters, numbers, underscores, and hyphens\n");
-            return 0;
+            return "ID can only contain letters, numbers, underscores, and hyphens";
         }
     }
-    return 1;
+    return NULL;
 }
 
-int validate_amount(double amount) {
+const char* amount_error(double amount) {
     if (amount < 0.0) {
-        printf("Error: Amount cannot be negative\n");
-        return 0;
+        return "Amount cannot be negative";
     }
     if (amount > 1000000.0) {
-        printf("Error: Amount cannot exceed $1,000,000.00\n");
+        return "Amount cannot exceed $1,000,000.00";
+    }
+    return NULL;
+}
+
+int validate_id(const char *id) {
+    const char *error = id_error(id);
+    if (error) {
+        printf("Error: %s\n", error);
+        return 0;
+    }
+    return 1;
+}
+
+int validate_amount(double amount) {
+    const char *error = amount_error(amount);
+    if (error) {
+        printf("Error: %s\n", error);
         return 0;
     }
     return 1;
@@ -49,11 +64,12 @@ int read_amount(double *amount) {
     return 1;
 }
 
-void mask_string(const char *input, char *output, int show_first, int show_last) {
+// Returns the length written, so callers can mask straight into a buffer
+size_t mask_string(const char *input, char *output, int show_first, int show_last) {
     int len = strlen(input);
     if (len <= show_first + show_last) {
         strcpy(output, input);
-        return;
+        return len;
     }
     
     int i;
@@ -69,12 +85,13 @@ void mask_string(const char *input, char *output, int show_first, int show_last)
         output[i] = input[i];
     }
     output[len] = '\0';
+    return len;
 }
 
-void mask_amount(double amount, char *output) {
+size_t mask_amount(double amount, char *output) {
     if (amount == 0.0) {
         strcpy(output, "0.00");
-        return;
+        return 4;
     }
     
     char temp[32];
@@ -98,4 +115,5 @@ void mask_amount(double amount, char *output) {
         }
     }
     output[len] = '\0';
+    return len;
 }
\ No newline at end of file
@@ -1,10 +1,14 @@
 #ifndef VALIDATION_H
 #define VALIDATION_H
 
+#include <stddef.h>
+
+const char* id_error(const char *id);
+const char* amount_error(double amount);
 int validate_id(const char *id);
 int validate_amount(double amount);
 int read_amount(double *amount);
-void mask_string(const char *input, char *output, int show_first, int show_last);
-void mask_amount(double amount, char *output);
+size_t mask_string(const char *input, char *output, int show_first, int show_last);
+size_t mask_amount(double amount, char *output);
 
 #endif // VALIDATION_H
@@ -0,0 +1,214 @@
+// Parallel Chain Verification
+// ============================================================================
+//
+// Each block is checked against data that is already stored: its own hash,
+// its own proof-of-work target and its predecessor's stored hash. None of
+// that depends on the result for any other block, so the chain is split
+// into contiguous ranges, one per worker. Workers stop early once a lower
+// block has already failed, and the lowest failing block is reported.
+// Batched blocks also have their events rehashed into a Merkle root that
+// must match the one their header commits.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "verify.h"
+#include "miner.h"
+#include "merkle.h"
+
+// Blocks hashed together per multi-buffer call
+#define VERIFY_BATCH 64
+
+typedef struct {
+    BlockFetch fetch;
+    EventFetch fetch_event;
+    void *ctx;
+    uint32_t begin;
+    uint32_t end;
+    _Atomic uint32_t *first_failure;
+    VerifyStatus status;
+    uint32_t failed_at;
+} VerifyWorker;
+
+static VerifyStatus check_block(const Block *block, const Block *prev, const uint8_t hash[]) {
+    PowTarget target;
+
+    if (memcmp(block->hash, hash, SHA256_BLOCK_SIZE) != 0) return VERIFY_HASH_MISMATCH;
+
+    if (prev && memcmp(block->prev_hash, prev->hash, SHA256_BLOCK_SIZE) != 0) {
+        return VERIFY_LINKAGE_BROKEN;
+    }
+
+    pow_target_from_bits(&target, block->difficulty);
+    if (!hash_meets_target(hash, &target)) return VERIFY_POW_NOT_MET;
+
+    return VERIFY_OK;
+}
+
+// Scratch for one block's events, grown as larger batches come along
+typedef struct {
+    const InsurancePayload **events;
+    InsurancePayload *scratch;
+    uint32_t capacity;
+} EventBuffer;
+
+static VerifyStatus check_batch(const VerifyWorker *worker, uint32_t height, const Block *block, EventBuffer *buffer) {
+    uint8_t root[SHA256_BLOCK_SIZE];
+    uint32_t count = block->batch.event_count;
+
+    if (count == 0 || count > MAX_BATCH_EVENTS) return VERIFY_MERKLE_MISMATCH;
+    if (count > buffer->capacity) {
+        const InsurancePayload **events = (const InsurancePayload**)realloc(buffer->events, count * sizeof(*events));
+        if (events) buffer->events = events;
+        InsurancePayload *scratch = (InsurancePayload*)realloc(buffer->scratch, count * sizeof(*scratch));
+        if (scratch) buffer->scratch = scratch;
+        if (!events || !scratch) return VERIFY_UNREADABLE;
+        buffer->capacity = count;
+    }
+    if (!worker->fetch_event(worker->ctx, height, buffer->scratch, count)) return VERIFY_UNREADABLE;
+    for (uint32_t i = 0; i < count; i++) {
+        buffer->events[i] = &buffer->scratch[i];
+    }
+    merkle_root(buffer->events, count, root);
+    return memcmp(root, block->batch.merkle_root, SHA256_BLOCK_SIZE) == 0 ? VERIFY_OK : VERIFY_MERKLE_MISMATCH;
+}
+
+static void record_failure(_Atomic uint32_t *first, uint32_t index) {
+    uint32_t current = atomic_load(first);
+    while (index < current &&
+           !atomic_compare_exchange_weak(first, &current, index)) {
+    }
+}
+
+static void *verify_worker(void *arg) {
+    VerifyWorker *worker = (VerifyWorker*)arg;
+    uint8_t hashes[VERIFY_BATCH][SHA256_BLOCK_SIZE];
+    const Block *blocks[VERIFY_BATCH];
+    Block scratch[VERIFY_BATCH];
+    Block prev_scratch;
+    const Block *prev = NULL;
+    EventBuffer buffer = { NULL, NULL, 0 };
+
+    // Without block begin - 1 the first block's linkage cannot be checked
+    if (worker->begin > 0 && worker->begin < worker->end) {
+        if (!worker->fetch(worker->ctx, worker->begin - 1, &prev_scratch)) {
+            worker->status = VERIFY_UNREADABLE;
+            worker->failed_at = worker->begin - 1;
+            record_failure(worker->first_failure, worker->begin - 1);
+            goto done;
+        }
+        prev = &prev_scratch;
+    }
+
+    for (uint32_t base = worker->begin; base < worker->end; base += VERIFY_BATCH) {
+        if (base >= atomic_load_explicit(worker->first_failure, memory_order_relaxed)) break;
+
+        uint32_t count = worker->end - base < VERIFY_BATCH ? worker->end - base : VERIFY_BATCH;
+        for (uint32_t i = 0; i < count; i++) {
+            blocks[i] = &scratch[i];
+            if (!worker->fetch(worker->ctx, base + i, &scratch[i])) {
+                worker->status = VERIFY_UNREADABLE;
+                worker->failed_at = base + i;
+                record_failure(worker->first_failure, base + i);
+                goto done;
+            }
+        }
+        block_hash_batch(blocks, count, hashes);
+
+        for (uint32_t i = 0; i < count; i++) {
+            VerifyStatus status = check_block(blocks[i], prev, hashes[i]);
+            if (status == VERIFY_OK && blocks[i]->hash_version >= HASH_VERSION_BATCH) {
+                status = check_batch(worker, base + i, blocks[i], &buffer);
+            }
+            if (status != VERIFY_OK) {
+                worker->status = status;
+                worker->failed_at = base + i;
+                record_failure(worker->first_failure, base + i);
+                goto done;
+            }
+            prev = blocks[i];
+        }
+
+        // The batch's last block links the next batch; keep it past reuse of scratch
+        if (prev) {
+            prev_scratch = *prev;
+            prev = &prev_scratch;
+        }
+    }
+
+done:
+    free(buffer.events);
+    free(buffer.scratch);
+    return NULL;
+}
+
+// Verify blocks [begin, count) and report the lowest failing block, if
+// any. Block begin - 1 is fetched too, for the linkage check, and is
+// reported unreadable if it cannot be
+VerifyResult verify_blocks(BlockFetch fetch, EventFetch fetch_event, void *ctx, uint32_t begin, uint32_t count, uint32_t threads) {
+    VerifyResult result = { VERIFY_OK, 0 };
+    _Atomic uint32_t first_failure = UINT32_MAX;
+    uint32_t total = count > begin ? count - begin : 0;
+
+    if (threads < 1) threads = 1;
+    if (threads > total) threads = total > 0 ? total : 1;
+
+    VerifyWorker workers[threads];
+    pthread_t tids[threads];
+    int running[threads];
+    uint32_t per_worker = total / threads;
+    uint32_t extra = total % threads;
+
+    for (uint32_t t = 0; t < threads; t++) {
+        uint32_t size = per_worker + (t < extra ? 1 : 0);
+        workers[t].fetch = fetch;
+        workers[t].fetch_event = fetch_event;
+        workers[t].ctx = ctx;
+        workers[t].begin = begin;
+        workers[t].end = begin + size;
+        workers[t].first_failure = &first_failure;
+        workers[t].status = VERIFY_OK;
+        workers[t].failed_at = 0;
+        begin += size;
+    }
+
+    // Worker 0 always runs on the calling thread
+    running[0] = 0;
+    for (uint32_t t = 1; t < threads; t++) {
+        running[t] = pthread_create(&tids[t], NULL, verify_worker, &workers[t]) == 0;
+    }
+    verify_worker(&workers[0]);
+    for (uint32_t t = 1; t < threads; t++) {
+        if (running[t]) {
+            pthread_join(tids[t], NULL);
+        } else {
+            verify_worker(&workers[t]);
+        }
+    }
+
+    // A block fetched for linkage can fail in two workers; the one that
+    // owns it reports first
+    uint32_t failed = atomic_load(&first_failure);
+    for (uint32_t t = 0; t < threads; t++) {
+        if (workers[t].status != VERIFY_OK && workers[t].failed_at == failed) {
+            result.status = workers[t].status;
+            result.block_num = failed;
+            break;
+        }
+    }
+    return result;
+}
+
+const char* verify_status_to_string(VerifyStatus status) {
+    switch(status) {
+        case VERIFY_OK: return "OK";
+        case VERIFY_HASH_MISMATCH: return "Hash mismatch";
+        case VERIFY_LINKAGE_BROKEN: return "Chain linkage broken";
+        case VERIFY_POW_NOT_MET: return "Proof of work below target";
+        case VERIFY_UNREADABLE: return "Block unreadable";
+        case VERIFY_MERKLE_MISMATCH: return "Merkle root does not match events";
+        default: return "Unknown failure";
+    }
+}
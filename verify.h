@@ -0,0 +1,35 @@
+// Parallel Chain Verification
+// ============================================================================
+
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stdint.h>
+#include "insurance_types.h"
+
+typedef enum {
+    VERIFY_OK,
+    VERIFY_HASH_MISMATCH,
+    VERIFY_LINKAGE_BROKEN,
+    VERIFY_POW_NOT_MET,
+    VERIFY_UNREADABLE,
+    VERIFY_MERKLE_MISMATCH
+} VerifyStatus;
+
+typedef struct {
+    VerifyStatus status;
+    uint32_t block_num;
+} VerifyResult;
+
+// Decodes block h into block, returning 0 when it cannot be read; must be
+// safe to call from several threads at once
+typedef int (*BlockFetch)(void *ctx, uint32_t height, Block *block);
+
+// Decodes exactly `count` events of batched block h into events; same
+// threading rules as BlockFetch
+typedef int (*EventFetch)(void *ctx, uint32_t height, InsurancePayload *events, uint32_t count);
+
+VerifyResult verify_blocks(BlockFetch fetch, EventFetch fetch_event, void *ctx, uint32_t begin, uint32_t count, uint32_t threads);
+const char* verify_status_to_string(VerifyStatus status);
+
+#endif // VERIFY_H